@@ -0,0 +1,274 @@
+/**
+ * @file bench_utils.h
+ * @author noahyzhang
+ * @brief 性能测试公共工具：计时、分位数统计以及文本/JSON 输出
+ * @version 0.1
+ * @date 2023-05-12
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace shm_bench {
+
+/**
+ * @brief 获取当前单调时间（纳秒）
+ *
+ * @return uint64_t
+ */
+inline uint64_t now_ns() {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * static_cast<uint64_t>(1000000000) + tp.tv_nsec;
+}
+
+/**
+ * @brief 防止编译器把被测代码优化掉
+ *
+ * @tparam T
+ * @param val
+ */
+template <class T>
+inline void do_not_optimize(const T& val) {
+    asm volatile("" : : "r,m"(val) : "memory");
+}
+
+// 单项测试结果
+struct BENCH_RESULT {
+    std::string name;
+    // 参数，形如 "node_size=16,node_count=256"
+    std::string params;
+    uint64_t ops = 0;
+    uint64_t bytes_per_op = 0;
+    double ns_per_op = 0;
+    double ops_per_sec = 0;
+    double bytes_per_sec = 0;
+    double p50_ns = 0;
+    double p90_ns = 0;
+    double p99_ns = 0;
+    double p999_ns = 0;
+    double min_ns = 0;
+    double max_ns = 0;
+};
+
+/**
+ * @brief 取已排序样本的分位数
+ *
+ * @param sorted
+ * @param quantile
+ * @return double
+ */
+inline double percentile(const std::vector<double>& sorted, double quantile) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = static_cast<size_t>(quantile * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+/**
+ * @brief 根据样本填充结果
+ *
+ * @param samples 每个样本为单次操作的耗时（纳秒）
+ * @param total_ops
+ * @param total_ns
+ * @param result
+ */
+inline void fill_result(std::vector<double>* samples, uint64_t total_ops, uint64_t total_ns, BENCH_RESULT* result) {
+    std::sort(samples->begin(), samples->end());
+    result->ops = total_ops;
+    result->ns_per_op = total_ops > 0 ? static_cast<double>(total_ns) / total_ops : 0;
+    result->ops_per_sec = total_ns > 0 ? total_ops * 1e9 / total_ns : 0;
+    result->bytes_per_sec = result->ops_per_sec * result->bytes_per_op;
+    result->p50_ns = percentile(*samples, 0.5);
+    result->p90_ns = percentile(*samples, 0.9);
+    result->p99_ns = percentile(*samples, 0.99);
+    result->p999_ns = percentile(*samples, 0.999);
+    result->min_ns = samples->empty() ? 0 : samples->front();
+    result->max_ns = samples->empty() ? 0 : samples->back();
+}
+
+/**
+ * @brief 运行一项测试
+ * 先倍增批量大小直到一批的耗时超过 min_batch_ns（摊薄计时开销），
+ * 再反复运行直到总耗时超过 min_time_ms，每批的平均耗时作为一个样本
+ *
+ * @tparam F 形如 void()，执行一次被测操作
+ * @param name
+ * @param params
+ * @param bytes_per_op
+ * @param min_time_ms
+ * @param op
+ * @return BENCH_RESULT
+ */
+template <class F>
+BENCH_RESULT run_bench(const std::string& name, const std::string& params, uint64_t bytes_per_op,
+    uint32_t min_time_ms, F&& op) {
+    const uint64_t min_batch_ns = 2000;
+    uint64_t batch = 1;
+    for (;;) {
+        uint64_t begin_ns = now_ns();
+        for (uint64_t i = 0; i < batch; ++i) {
+            op();
+        }
+        if (now_ns() - begin_ns >= min_batch_ns || batch >= (1ULL << 20)) {
+            break;
+        }
+        batch *= 2;
+    }
+    std::vector<double> samples;
+    uint64_t total_ops = 0;
+    uint64_t total_ns = 0;
+    uint64_t deadline_ns = now_ns() + static_cast<uint64_t>(min_time_ms) * 1000000;
+    while (now_ns() < deadline_ns || samples.empty()) {
+        uint64_t begin_ns = now_ns();
+        for (uint64_t i = 0; i < batch; ++i) {
+            op();
+        }
+        uint64_t cost_ns = now_ns() - begin_ns;
+        samples.push_back(static_cast<double>(cost_ns) / batch);
+        total_ops += batch;
+        total_ns += cost_ns;
+    }
+    BENCH_RESULT result;
+    result.name = name;
+    result.params = params;
+    result.bytes_per_op = bytes_per_op;
+    fill_result(&samples, total_ops, total_ns, &result);
+    return result;
+}
+
+/**
+ * @brief HDR 风格的对数线性直方图，每个 2 的幂区间再等分为 SUB_BUCKETS 个桶，相对误差不超过 1/SUB_BUCKETS
+ * 结构体是 POD，可以直接放在进程间共享的内存中
+ *
+ */
+struct LATENCY_HISTOGRAM {
+    static const uint32_t SUB_BITS = 6;
+    static const uint32_t SUB_BUCKETS = 1 << SUB_BITS;
+    // 覆盖到 2^40 纳秒（约 18 分钟）
+    static const uint32_t MAX_EXPONENT = 40;
+    static const uint32_t BUCKETS = (MAX_EXPONENT - SUB_BITS + 1) * SUB_BUCKETS;
+
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+
+    void reset() {
+        memset(this, 0, sizeof(*this));
+        min = UINT64_MAX;
+    }
+
+    static uint32_t bucket_of(uint64_t val) {
+        if (val < SUB_BUCKETS) {
+            return static_cast<uint32_t>(val);
+        }
+        uint32_t exponent = 63 - __builtin_clzll(val);
+        if (exponent >= MAX_EXPONENT) {
+            return BUCKETS - 1;
+        }
+        uint32_t sub = static_cast<uint32_t>(val >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // 桶内最大值
+    static uint64_t bucket_upper(uint32_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        uint32_t exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+        uint64_t sub = bucket % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (exponent - SUB_BITS)) - 1;
+    }
+
+    void record(uint64_t val) {
+        ++counts[bucket_of(val)];
+        ++total;
+        sum += val;
+        min = val < min ? val : min;
+        max = val > max ? val : max;
+    }
+
+    void merge(const LATENCY_HISTOGRAM& other) {
+        for (uint32_t i = 0; i < BUCKETS; ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        min = other.min < min ? other.min : min;
+        max = other.max > max ? other.max : max;
+    }
+
+    uint64_t percentile(double quantile) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t target = static_cast<uint64_t>(quantile * total);
+        uint64_t acc = 0;
+        for (uint32_t i = 0; i < BUCKETS; ++i) {
+            acc += counts[i];
+            if (acc > target) {
+                uint64_t upper = bucket_upper(i);
+                return upper < max ? upper : max;
+            }
+        }
+        return max;
+    }
+
+    double mean() const {
+        return total > 0 ? static_cast<double>(sum) / total : 0;
+    }
+};
+
+/**
+ * @brief 结果输出
+ *
+ */
+class CBenchReporter {
+public:
+    explicit CBenchReporter(bool json) : json_(json) {}
+
+    /**
+     * @brief 输出一项结果，JSON 模式下每项结果输出一行（JSON Lines）
+     *
+     * @param result
+     */
+    void report(const BENCH_RESULT& result) {
+        if (json_) {
+            printf("{\"name\":\"%s\",\"params\":\"%s\",\"ops\":%lu,\"ns_per_op\":%.3f,\"ops_per_sec\":%.1f,"
+                "\"bytes_per_sec\":%.1f,\"p50_ns\":%.1f,\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"p999_ns\":%.1f,"
+                "\"min_ns\":%.1f,\"max_ns\":%.1f}\n",
+                result.name.c_str(), result.params.c_str(), result.ops, result.ns_per_op, result.ops_per_sec,
+                result.bytes_per_sec, result.p50_ns, result.p90_ns, result.p99_ns, result.p999_ns,
+                result.min_ns, result.max_ns);
+        } else {
+            if (!header_printed_) {
+                printf("%-22s %-32s %12s %14s %12s %10s %10s %10s %10s\n", "NAME", "PARAMS", "NS/OP", "OPS/S",
+                    "MB/S", "P50", "P90", "P99", "MAX");
+                header_printed_ = true;
+            }
+            printf("%-22s %-32s %12.2f %14.0f %12.1f %10.1f %10.1f %10.1f %10.1f\n", result.name.c_str(),
+                result.params.c_str(), result.ns_per_op, result.ops_per_sec, result.bytes_per_sec / 1e6,
+                result.p50_ns, result.p90_ns, result.p99_ns, result.max_ns);
+        }
+        fflush(stdout);
+    }
+
+private:
+    bool json_{false};
+    bool header_printed_{false};
+};
+
+}  // namespace shm_bench
@@ -0,0 +1,264 @@
+/**
+ * @file malloc_hook_bench.cpp
+ * @author noahyzhang
+ * @brief 分配器接入的开销测试
+ * 对不同大小的 malloc/free 以及多线程并发分配计时。指定 -l 时分别以不加载和通过 LD_PRELOAD 加载
+ * libzy_malloc_hook.so 的方式重新执行自身，对比两次的结果，并检查共享内存中发布的线程统计
+ * @version 0.1
+ * @date 2023-06-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "zy_array_shm.h"
+#include "zy_malloc_hook.h"
+#include "bench_utils.h"
+
+using thread_mem_shm_sdk::ARRAY_SHM_HEADER;
+using thread_mem_shm_sdk::CArrayShm;
+using thread_mem_shm_sdk::THREAD_MEM_NODE;
+using shm_bench::BENCH_RESULT;
+using shm_bench::CBenchReporter;
+using shm_bench::do_not_optimize;
+using shm_bench::fill_result;
+using shm_bench::now_ns;
+using shm_bench::run_bench;
+
+static const size_t BENCH_SHM_KEY = 0x5e7f0000;
+
+struct BENCH_ARGS {
+    uint32_t min_time_ms = 200;
+    std::vector<uint32_t> threads{1, 4};
+    // libzy_malloc_hook.so 的路径，为空时只运行当前进程
+    std::string hook_path;
+    // 当前进程的模式，由父进程传入
+    std::string mode;
+    bool json = false;
+};
+
+/**
+ * @brief 分配后写一个字节再释放，避免编译器消除成对的 malloc/free
+ *
+ * @param size
+ */
+inline void malloc_free(size_t size) {
+    char* ptr = static_cast<char*>(malloc(size));
+    ptr[0] = 1;
+    do_not_optimize(ptr);
+    free(ptr);
+}
+
+/**
+ * @brief 单线程分配不同大小的内存
+ *
+ * @param args
+ * @param reporter
+ */
+void bench_single(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    for (size_t size : {16, 256, 4096, 65536}) {
+        std::string params = "mode=" + args.mode + ",size=" + std::to_string(size);
+        reporter->report(run_bench("malloc_free", params, 0, args.min_time_ms, [size]() { malloc_free(size); }));
+    }
+}
+
+/**
+ * @brief 多线程并发分配，每个线程交替分配多个大小并保留一部分，接近业务中的分配模式
+ *
+ * @param args
+ * @param reporter
+ * @param thread_count
+ */
+void bench_threads(const BENCH_ARGS& args, CBenchReporter* reporter, uint32_t thread_count) {
+    const uint64_t batch = 1024;
+    std::vector<std::vector<double>> thread_samples(thread_count);
+    std::vector<uint64_t> thread_ops(thread_count, 0);
+    std::vector<std::thread> threads;
+    uint64_t begin_ns = now_ns();
+    uint64_t deadline_ns = begin_ns + static_cast<uint64_t>(args.min_time_ms) * 1000000;
+    for (uint32_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            void* kept[64] = {nullptr};
+            size_t sizes[] = {24, 72, 200, 520, 1500, 4000};
+            uint64_t ops = 0;
+            while (now_ns() < deadline_ns) {
+                uint64_t batch_begin_ns = now_ns();
+                for (uint64_t i = 0; i < batch; ++i) {
+                    size_t slot = (ops + i) % 64;
+                    free(kept[slot]);
+                    kept[slot] = malloc(sizes[(ops + i) % 6]);
+                    do_not_optimize(kept[slot]);
+                }
+                thread_samples[t].push_back(static_cast<double>(now_ns() - batch_begin_ns) / batch);
+                ops += batch;
+            }
+            for (void* ptr : kept) {
+                free(ptr);
+            }
+            thread_ops[t] = ops;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    uint64_t total_ns = now_ns() - begin_ns;
+    std::vector<double> samples;
+    uint64_t total_ops = 0;
+    for (uint32_t t = 0; t < thread_count; ++t) {
+        samples.insert(samples.end(), thread_samples[t].begin(), thread_samples[t].end());
+        total_ops += thread_ops[t];
+    }
+    BENCH_RESULT result;
+    result.name = "malloc_free_mt";
+    result.params = "mode=" + args.mode + ",threads=" + std::to_string(thread_count);
+    // 按每个线程的平均耗时计算
+    fill_result(&samples, total_ops, total_ns * thread_count, &result);
+    reporter->report(result);
+}
+
+/**
+ * @brief 重新执行自身，hooked 为 true 时通过 LD_PRELOAD 加载接入库
+ *
+ * @param argv
+ * @param args
+ * @param hooked
+ * @return int 子进程的退出码
+ */
+int run_child(char* argv[], const BENCH_ARGS& args, bool hooked) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        std::vector<std::string> child_args{argv[0], "-t", std::to_string(args.min_time_ms), "-m",
+            hooked ? "hooked" : "baseline"};
+        for (uint32_t thread_count : args.threads) {
+            child_args.push_back("-T");
+            child_args.push_back(std::to_string(thread_count));
+        }
+        if (args.json) {
+            child_args.push_back("-j");
+        }
+        std::vector<char*> child_argv;
+        for (auto& arg : child_args) {
+            child_argv.push_back(&arg[0]);
+        }
+        child_argv.push_back(nullptr);
+        if (hooked) {
+            setenv("LD_PRELOAD", args.hook_path.c_str(), 1);
+            setenv("ZY_MEM_HOOK_SHM_KEY", std::to_string(BENCH_SHM_KEY).c_str(), 1);
+            setenv("ZY_MEM_HOOK_INTERVAL_MS", "10", 1);
+        }
+        execv(argv[0], child_argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * @brief 检查接入库退出前发布的线程统计
+ *
+ */
+void check_published() {
+    CArrayShm<THREAD_MEM_NODE> array_shm;
+    if (!array_shm.init(BENCH_SHM_KEY)) {
+        fprintf(stderr, "attach published shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+        return;
+    }
+    ARRAY_SHM_HEADER header;
+    std::vector<THREAD_MEM_NODE> nodes;
+    if (!array_shm.snapshot(&header, &nodes)) {
+        fprintf(stderr, "snapshot published shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+        return;
+    }
+    uint64_t allocated_kb = 0;
+    uint64_t deallocated_kb = 0;
+    for (const THREAD_MEM_NODE& node : nodes) {
+        allocated_kb += node.allocated_kb;
+        deallocated_kb += node.deallocated_kb;
+    }
+    fprintf(stderr, "published: generation: %lu, threads: %zu, allocated_kb: %lu, deallocated_kb: %lu\n",
+        header.generation, nodes.size(), allocated_kb, deallocated_kb);
+}
+
+/**
+ * @brief 删除测试创建的共享内存
+ *
+ * @param key
+ */
+void remove_shm(size_t key) {
+    int shm_id = shmget(key, 0, 0);
+    if (shm_id >= 0) {
+        shmctl(shm_id, IPC_RMID, nullptr);
+    }
+}
+
+void usage(const char* name) {
+    printf("usage: %s [-t min_time_ms] [-T threads]... [-l hook_library] [-j]\n"
+        "  -t  minimum running time of each benchmark in milliseconds, default 200\n"
+        "  -T  thread count of the concurrent benchmark, can be repeated, default 1 and 4\n"
+        "  -l  path of libzy_malloc_hook.so, run once without and once with LD_PRELOAD\n"
+        "  -j  output JSON Lines instead of a table\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    BENCH_ARGS args;
+    std::vector<uint32_t> threads;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "t:T:l:m:jh")) != -1) {
+        switch (opt) {
+        case 't':
+            args.min_time_ms = strtoul(optarg, nullptr, 0);
+            break;
+        case 'T':
+            threads.push_back(strtoul(optarg, nullptr, 0));
+            break;
+        case 'l':
+            args.hook_path = optarg;
+            break;
+        case 'm':
+            args.mode = optarg;
+            break;
+        case 'j':
+            args.json = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (!threads.empty()) {
+        args.threads = threads;
+    }
+    if (!args.hook_path.empty()) {
+        remove_shm(BENCH_SHM_KEY);
+        if (run_child(argv, args, false) != 0 || run_child(argv, args, true) != 0) {
+            fprintf(stderr, "run benchmark failed\n");
+            remove_shm(BENCH_SHM_KEY);
+            return -1;
+        }
+        check_published();
+        remove_shm(BENCH_SHM_KEY);
+        return 0;
+    }
+    if (args.mode.empty()) {
+        args.mode = getenv("LD_PRELOAD") != nullptr ? "preload" : "baseline";
+    }
+    CBenchReporter reporter(args.json);
+    bench_single(args, &reporter);
+    for (uint32_t thread_count : args.threads) {
+        bench_threads(args, &reporter, thread_count);
+    }
+    return 0;
+}
@@ -0,0 +1,394 @@
+/**
+ * @file multi_process_bench.cpp
+ * @author noahyzhang
+ * @brief 多进程延迟及扩展性测试
+ * fork 出 N 个写进程和 M 个读进程操作同一个 CArrayShm，统计发布到被读者观察到的延迟（HDR 风格直方图）、
+ * 写者发布吞吐以及读者读取吞吐，最后输出汇总报告
+ * @version 0.1
+ * @date 2023-05-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include "zy_array_shm.h"
+#include "zy_semaphore.h"
+#include "bench_utils.h"
+
+using thread_mem_shm_sdk::ARRAY_SHM_HEADER;
+using thread_mem_shm_sdk::CArrayShm;
+using thread_mem_shm_sdk::CSemaphore;
+using shm_bench::LATENCY_HISTOGRAM;
+using shm_bench::now_ns;
+
+static const size_t BENCH_SHM_KEY = 0x5d7e0001;
+static const int32_t BENCH_SEM_KEY = 0x5d7e0002;
+
+// 同步方式
+enum SYNC_MODE {
+    // 读写都持有 CSemaphore
+    SYNC_MODE_SEM = 0,
+    // 不加锁，读者依赖头部 CRC 校验，并检查节点是否被撕裂
+    SYNC_MODE_NONE = 1,
+};
+
+// 测试节点，每个节点都带有发布时间，读者据此计算延迟并检查撕裂
+struct LatencyNode {
+    uint64_t publish_ns;
+    uint32_t writer_id;
+    uint32_t seq;
+    uint8_t payload[48];
+};
+
+struct HARNESS_ARGS {
+    uint32_t writers = 1;
+    uint32_t readers = 1;
+    uint32_t duration_ms = 3000;
+    uint32_t node_count = 64;
+    uint32_t publish_interval_us = 0;
+    SYNC_MODE mode = SYNC_MODE_SEM;
+    std::vector<int> cpus;
+    bool json = false;
+};
+
+// 单个子进程的结果
+struct CHILD_RESULT {
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t failed;
+    uint64_t torn;
+    uint64_t elapsed_ns;
+    LATENCY_HISTOGRAM latency;
+};
+
+// 父子进程共享的控制区，其后紧跟每个子进程的 CHILD_RESULT
+struct HARNESS_CONTROL {
+    std::atomic<uint32_t> ready;
+    std::atomic<uint32_t> start;
+    std::atomic<uint32_t> stop;
+};
+
+/**
+ * @brief 绑定 CPU，cpus 为空时不绑定
+ *
+ * @param args
+ * @param child_idx
+ */
+void pin_cpu(const HARNESS_ARGS& args, uint32_t child_idx) {
+    if (args.cpus.empty()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(args.cpus[child_idx % args.cpus.size()], &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        fprintf(stderr, "child %u: sched_setaffinity failed\n", child_idx);
+    }
+}
+
+/**
+ * @brief 等待父进程发出开始信号
+ *
+ * @param control
+ */
+void wait_start(HARNESS_CONTROL* control) {
+    control->ready.fetch_add(1);
+    while (control->start.load(std::memory_order_acquire) == 0) {
+        sched_yield();
+    }
+}
+
+void run_writer(const HARNESS_ARGS& args, HARNESS_CONTROL* control, uint32_t writer_id, CHILD_RESULT* result) {
+    CArrayShm<LatencyNode> array_shm;
+    if (!array_shm.init(BENCH_SHM_KEY, args.node_count, true)) {
+        fprintf(stderr, "writer %u: init shm failed, err: %s\n", writer_id, array_shm.get_err_msg().c_str());
+        wait_start(control);
+        return;
+    }
+    CSemaphore sem;
+    if (args.mode == SYNC_MODE_SEM && !sem.create(BENCH_SEM_KEY)) {
+        fprintf(stderr, "writer %u: create sem failed, err: %s\n", writer_id, sem.get_err_msg());
+    }
+    std::vector<LatencyNode> node_vec(args.node_count);
+    memset(node_vec.data(), 0, node_vec.size() * sizeof(LatencyNode));
+    wait_start(control);
+
+    uint64_t begin_ns = now_ns();
+    uint32_t seq = 0;
+    while (control->stop.load(std::memory_order_relaxed) == 0) {
+        ++seq;
+        if (args.mode == SYNC_MODE_SEM) {
+            sem.lock();
+        }
+        // 时间戳在拿到锁之后打，延迟中不包含写者自己的等锁时间
+        uint64_t publish_ns = now_ns();
+        for (auto& node : node_vec) {
+            node.publish_ns = publish_ns;
+            node.writer_id = writer_id;
+            node.seq = seq;
+        }
+        int count = array_shm.insert(node_vec);
+        if (args.mode == SYNC_MODE_SEM) {
+            sem.unlock();
+        }
+        if (count < 0) {
+            ++result->failed;
+        } else {
+            ++result->ops;
+            result->bytes += count * sizeof(LatencyNode);
+            result->latency.record(now_ns() - publish_ns);
+        }
+        if (args.publish_interval_us > 0) {
+            usleep(args.publish_interval_us);
+        }
+    }
+    result->elapsed_ns = now_ns() - begin_ns;
+}
+
+void run_reader(const HARNESS_ARGS& args, HARNESS_CONTROL* control, uint32_t reader_id, CHILD_RESULT* result) {
+    CArrayShm<LatencyNode> array_shm;
+    if (!array_shm.init(BENCH_SHM_KEY)) {
+        fprintf(stderr, "reader %u: init shm failed, err: %s\n", reader_id, array_shm.get_err_msg().c_str());
+        wait_start(control);
+        return;
+    }
+    CSemaphore sem;
+    if (args.mode == SYNC_MODE_SEM && !sem.create(BENCH_SEM_KEY)) {
+        fprintf(stderr, "reader %u: create sem failed, err: %s\n", reader_id, sem.get_err_msg());
+    }
+    ARRAY_SHM_HEADER header;
+    std::vector<LatencyNode> node_vec;
+    uint64_t last_publish_ns = 0;
+    wait_start(control);
+
+    uint64_t begin_ns = now_ns();
+    while (control->stop.load(std::memory_order_relaxed) == 0) {
+        if (args.mode == SYNC_MODE_SEM) {
+            sem.lock();
+        }
+        bool ret = array_shm.snapshot(&header, &node_vec);
+        if (args.mode == SYNC_MODE_SEM) {
+            sem.unlock();
+        }
+        uint64_t observe_ns = now_ns();
+        if (!ret) {
+            ++result->failed;
+            continue;
+        }
+        ++result->ops;
+        result->bytes += node_vec.size() * sizeof(LatencyNode);
+        if (node_vec.empty() || node_vec[0].publish_ns == last_publish_ns) {
+            continue;
+        }
+        // 首尾节点不属于同一次发布，说明读到了正在写的数据
+        const LatencyNode& first = node_vec.front();
+        const LatencyNode& last = node_vec.back();
+        if (first.publish_ns != last.publish_ns || first.writer_id != last.writer_id || first.seq != last.seq) {
+            ++result->torn;
+            continue;
+        }
+        last_publish_ns = first.publish_ns;
+        result->latency.record(observe_ns > first.publish_ns ? observe_ns - first.publish_ns : 0);
+    }
+    result->elapsed_ns = now_ns() - begin_ns;
+}
+
+/**
+ * @brief 汇总同一角色的结果并输出
+ *
+ * @param args
+ * @param role
+ * @param results
+ * @param count
+ * @param latency_name
+ */
+void report(const HARNESS_ARGS& args, const char* role, const CHILD_RESULT* results, uint32_t count,
+    const char* latency_name) {
+    CHILD_RESULT total;
+    memset(&total, 0, sizeof(total));
+    total.latency.reset();
+    double ops_per_sec = 0;
+    double bytes_per_sec = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        total.ops += results[i].ops;
+        total.bytes += results[i].bytes;
+        total.failed += results[i].failed;
+        total.torn += results[i].torn;
+        total.latency.merge(results[i].latency);
+        if (results[i].elapsed_ns > 0) {
+            ops_per_sec += results[i].ops * 1e9 / results[i].elapsed_ns;
+            bytes_per_sec += results[i].bytes * 1e9 / results[i].elapsed_ns;
+        }
+    }
+    const LATENCY_HISTOGRAM& hist = total.latency;
+    const char* mode = (args.mode == SYNC_MODE_SEM) ? "sem" : "none";
+    if (args.json) {
+        printf("{\"role\":\"%s\",\"mode\":\"%s\",\"writers\":%u,\"readers\":%u,\"node_count\":%u,"
+            "\"processes\":%u,\"ops\":%lu,\"ops_per_sec\":%.1f,\"bytes_per_sec\":%.1f,\"failed\":%lu,\"torn\":%lu,"
+            "\"latency\":\"%s\",\"samples\":%lu,\"mean_ns\":%.1f,\"min_ns\":%lu,\"p50_ns\":%lu,\"p90_ns\":%lu,"
+            "\"p99_ns\":%lu,\"p999_ns\":%lu,\"p9999_ns\":%lu,\"max_ns\":%lu}\n",
+            role, mode, args.writers, args.readers, args.node_count, count, total.ops, ops_per_sec, bytes_per_sec,
+            total.failed, total.torn, latency_name, hist.total, hist.mean(), hist.total > 0 ? hist.min : 0,
+            hist.percentile(0.5), hist.percentile(0.9), hist.percentile(0.99), hist.percentile(0.999),
+            hist.percentile(0.9999), hist.max);
+        return;
+    }
+    printf("[%s] processes: %u, ops: %lu, ops/s: %.1f, MB/s: %.1f, failed: %lu, torn: %lu\n",
+        role, count, total.ops, ops_per_sec, bytes_per_sec / 1e6, total.failed, total.torn);
+    printf("[%s] %s latency(ns) samples: %lu, mean: %.1f, min: %lu, p50: %lu, p90: %lu, p99: %lu, "
+        "p99.9: %lu, p99.99: %lu, max: %lu\n", role, latency_name, hist.total, hist.mean(),
+        hist.total > 0 ? hist.min : 0, hist.percentile(0.5), hist.percentile(0.9), hist.percentile(0.99),
+        hist.percentile(0.999), hist.percentile(0.9999), hist.max);
+}
+
+/**
+ * @brief 解析逗号分隔的 CPU 列表
+ *
+ * @param str
+ * @param cpus
+ */
+void parse_cpus(const std::string& str, std::vector<int>* cpus) {
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t next = str.find(',', pos);
+        if (next == std::string::npos) {
+            next = str.size();
+        }
+        cpus->push_back(atoi(str.substr(pos, next - pos).c_str()));
+        pos = next + 1;
+    }
+}
+
+void usage(const char* name) {
+    printf("usage: %s [-w writers] [-r readers] [-d duration_ms] [-n node_count] [-i publish_interval_us]\n"
+        "          [-m sem|none] [-c cpu_list] [-j]\n"
+        "  -w  writer process count, default 1\n"
+        "  -r  reader process count, default 1\n"
+        "  -d  duration in milliseconds, default 3000\n"
+        "  -n  node count of each publish, default 64\n"
+        "  -i  sleep between two publishes of a writer in microseconds, default 0\n"
+        "  -m  sync mode, sem: CSemaphore around insert/snapshot, none: lock free readers, default sem\n"
+        "  -c  comma separated cpu list, writers then readers are pinned round robin\n"
+        "  -j  output JSON Lines\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    HARNESS_ARGS args;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "w:r:d:n:i:m:c:jh")) != -1) {
+        switch (opt) {
+        case 'w':
+            args.writers = strtoul(optarg, nullptr, 0);
+            break;
+        case 'r':
+            args.readers = strtoul(optarg, nullptr, 0);
+            break;
+        case 'd':
+            args.duration_ms = strtoul(optarg, nullptr, 0);
+            break;
+        case 'n':
+            args.node_count = strtoul(optarg, nullptr, 0);
+            break;
+        case 'i':
+            args.publish_interval_us = strtoul(optarg, nullptr, 0);
+            break;
+        case 'm':
+            args.mode = (std::string(optarg) == "none") ? SYNC_MODE_NONE : SYNC_MODE_SEM;
+            break;
+        case 'c':
+            parse_cpus(optarg, &args.cpus);
+            break;
+        case 'j':
+            args.json = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (args.writers == 0 || args.node_count == 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    uint32_t children = args.writers + args.readers;
+    size_t control_size = sizeof(HARNESS_CONTROL) + children * sizeof(CHILD_RESULT);
+    void* p_control = mmap(nullptr, control_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p_control == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    HARNESS_CONTROL* control = new (p_control) HARNESS_CONTROL();
+    CHILD_RESULT* results = reinterpret_cast<CHILD_RESULT*>(control + 1);
+    for (uint32_t i = 0; i < children; ++i) {
+        results[i].latency.reset();
+    }
+    // 清理上次异常退出遗留的共享内存，再由父进程创建，避免多个写者同时创建
+    int shm_id = shmget(BENCH_SHM_KEY, 0, 0);
+    if (shm_id >= 0) {
+        shmctl(shm_id, IPC_RMID, nullptr);
+    }
+    CArrayShm<LatencyNode> array_shm;
+    if (!array_shm.init(BENCH_SHM_KEY, args.node_count, true)) {
+        fprintf(stderr, "init shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+        return -1;
+    }
+
+    std::vector<pid_t> pids;
+    for (uint32_t i = 0; i < children; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            control->start.store(1);
+            control->stop.store(1);
+            break;
+        }
+        if (pid == 0) {
+            pin_cpu(args, i);
+            if (i < args.writers) {
+                run_writer(args, control, i, &results[i]);
+            } else {
+                run_reader(args, control, i - args.writers, &results[i]);
+            }
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    while (control->ready.load() < pids.size()) {
+        usleep(1000);
+    }
+    control->start.store(1, std::memory_order_release);
+    usleep(args.duration_ms * 1000);
+    control->stop.store(1);
+    for (pid_t pid : pids) {
+        waitpid(pid, nullptr, 0);
+    }
+
+    report(args, "writer", results, args.writers, "publish");
+    report(args, "reader", results + args.writers, args.readers, "publish_to_observe");
+
+    shm_id = shmget(BENCH_SHM_KEY, 0, 0);
+    if (shm_id >= 0) {
+        shmctl(shm_id, IPC_RMID, nullptr);
+    }
+    if (args.mode == SYNC_MODE_SEM) {
+        CSemaphore sem;
+        if (sem.create(BENCH_SEM_KEY)) {
+            sem.destroy();
+        }
+    }
+    munmap(p_control, control_size);
+    return 0;
+}
@@ -0,0 +1,692 @@
+/**
+ * @file shm_benchmark.cpp
+ * @author noahyzhang
+ * @brief SDK 热路径的基准测试：insert、traverse、整段发布、注册表打开、有序索引查询、分组一致性读取、批量异步发布、init/attach、CRC、时钟源以及信号量加解锁
+ * 输出每次操作耗时、吞吐以及分位数，使用 -j 输出 JSON Lines 便于跟踪性能回退
+ * @version 0.1
+ * @date 2023-05-12
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "zy_array_shm.h"
+#include "zy_batch_publisher.h"
+#include "zy_semaphore.h"
+#include "zy_shm_group.h"
+#include "zy_shm_registry.h"
+#include "zy_utils.h"
+#include "bench_utils.h"
+
+using thread_mem_shm_sdk::ARRAY_SHM_HEADER;
+using thread_mem_shm_sdk::ARRAY_SHM_OPTIONS;
+using thread_mem_shm_sdk::BATCH_PUBLISHER_OPTIONS;
+using thread_mem_shm_sdk::CArrayShm;
+using thread_mem_shm_sdk::CBatchPublisher;
+using thread_mem_shm_sdk::CShmClock;
+using thread_mem_shm_sdk::CSemaphore;
+using thread_mem_shm_sdk::CShmGroup;
+using thread_mem_shm_sdk::CShmRegistry;
+using thread_mem_shm_sdk::SHM_CLOCK_TYPE;
+using thread_mem_shm_sdk::calc_crc_val;
+using shm_bench::BENCH_RESULT;
+using shm_bench::CBenchReporter;
+using shm_bench::do_not_optimize;
+using shm_bench::run_bench;
+
+// 测试使用的共享内存及信号量 key 的起始值
+static const size_t BENCH_SHM_KEY_BASE = 0x5d7f0000;
+static const int32_t BENCH_SEM_KEY = 0x5d7fffff;
+
+template <size_t N>
+struct BenchNode {
+    uint8_t data[N];
+};
+
+struct BENCH_ARGS {
+    uint32_t min_time_ms = 200;
+    bool json = false;
+    std::string filter;
+};
+
+static uint64_t g_sink = 0;
+static size_t g_next_key = BENCH_SHM_KEY_BASE;
+
+/**
+ * @brief 删除测试创建的共享内存
+ *
+ * @param key
+ */
+void remove_shm(size_t key) {
+    int shm_id = shmget(key, 0, 0);
+    if (shm_id >= 0) {
+        shmctl(shm_id, IPC_RMID, nullptr);
+    }
+}
+
+/**
+ * @brief 按名称前缀过滤
+ *
+ * @param args
+ * @param name
+ * @return true
+ * @return false
+ */
+bool selected(const BENCH_ARGS& args, const std::string& name) {
+    return args.filter.empty() || name.compare(0, args.filter.size(), args.filter) == 0;
+}
+
+template <size_t N>
+bool sum_node(BenchNode<N>* node) {
+    g_sink += node->data[0];
+    return true;
+}
+
+template <size_t N>
+void bench_array(const BENCH_ARGS& args, CBenchReporter* reporter, size_t node_count, bool enable_stats) {
+    std::string suffix = enable_stats ? "_stats" : "";
+    if (!selected(args, "insert" + suffix) && !selected(args, "traverse" + suffix)) {
+        return;
+    }
+    size_t key = g_next_key++;
+    remove_shm(key);
+    CArrayShm<BenchNode<N>> array_shm;
+    ARRAY_SHM_OPTIONS options;
+    options.enable_stats = enable_stats;
+    if (!array_shm.init(key, node_count, true, options)) {
+        fprintf(stderr, "init shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+        return;
+    }
+    std::vector<BenchNode<N>> node_vec(node_count);
+    for (size_t i = 0; i < node_count; ++i) {
+        memset(node_vec[i].data, static_cast<int>(i), N);
+    }
+    std::string params = "node_size=" + std::to_string(N) + ",node_count=" + std::to_string(node_count);
+    if (selected(args, "insert" + suffix)) {
+        reporter->report(run_bench("insert" + suffix, params, N * node_count, args.min_time_ms, [&]() {
+            do_not_optimize(array_shm.insert(node_vec));
+        }));
+    }
+    if (selected(args, "traverse" + suffix)) {
+        array_shm.insert(node_vec);
+        reporter->report(run_bench("traverse" + suffix, params, N * node_count, args.min_time_ms, [&]() {
+            do_not_optimize(array_shm.traverse(sum_node<N>));
+        }));
+    }
+    remove_shm(key);
+}
+
+template <size_t N>
+void bench_node_size(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    const size_t node_counts[] = {1, 16, 256, 4096};
+    for (size_t node_count : node_counts) {
+        bench_array<N>(args, reporter, node_count, false);
+    }
+}
+
+/**
+ * @brief 大段发布：逐节点拷贝（旧实现）、整段拷贝、非临时存储，以及普通遍历和预取遍历
+ * 数据量从 L1 覆盖到超出 LLC
+ *
+ * @param args
+ * @param reporter
+ */
+void bench_bulk(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    const char* names[] = {"bulk_copy_loop", "bulk_insert", "bulk_insert_nt", "bulk_traverse",
+        "bulk_traverse_prefetch"};
+    if (std::none_of(std::begin(names), std::end(names), [&](const char* name) { return selected(args, name); })) {
+        return;
+    }
+    using Node = BenchNode<64>;
+    const size_t lengths[] = {16UL << 10, 256UL << 10, 4UL << 20, 64UL << 20};
+    for (size_t length : lengths) {
+        size_t node_count = length / sizeof(Node);
+        size_t key = g_next_key++;
+        remove_shm(key);
+        CArrayShm<Node> array_shm;
+        ARRAY_SHM_OPTIONS options;
+        options.nt_store_threshold = SIZE_MAX;
+        CArrayShm<Node> nt_shm;
+        ARRAY_SHM_OPTIONS nt_options;
+        nt_options.nt_store_threshold = 0;
+        if (!array_shm.init(key, node_count, true, options) || !nt_shm.init(key, node_count, true, nt_options)) {
+            fprintf(stderr, "init shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+            remove_shm(key);
+            return;
+        }
+        std::vector<Node> node_vec(node_count);
+        for (size_t i = 0; i < node_count; ++i) {
+            memset(node_vec[i].data, static_cast<int>(i), sizeof(Node));
+        }
+        // 旧实现：逐节点拷贝到共享内存
+        int shm_id = shmget(key, 0, 0);
+        Node* body = reinterpret_cast<Node*>(reinterpret_cast<char*>(shmat(shm_id, nullptr, 0))
+            + sizeof(ARRAY_SHM_HEADER));
+        std::string params = "length_kb=" + std::to_string(length >> 10);
+        if (selected(args, "bulk_copy_loop")) {
+            reporter->report(run_bench("bulk_copy_loop", params, length, args.min_time_ms, [&]() {
+                for (size_t i = 0; i < node_count; ++i) {
+                    memcpy(body + i, &node_vec[i], sizeof(Node));
+                }
+                do_not_optimize(body);
+            }));
+        }
+        if (selected(args, "bulk_insert")) {
+            reporter->report(run_bench("bulk_insert", params, length, args.min_time_ms, [&]() {
+                do_not_optimize(array_shm.insert(node_vec.data(), node_count));
+            }));
+        }
+        if (selected(args, "bulk_insert_nt")) {
+            reporter->report(run_bench("bulk_insert_nt", params, length, args.min_time_ms, [&]() {
+                do_not_optimize(nt_shm.insert(node_vec.data(), node_count));
+            }));
+        }
+        array_shm.insert(node_vec);
+        if (selected(args, "bulk_traverse")) {
+            reporter->report(run_bench("bulk_traverse", params, length, args.min_time_ms, [&]() {
+                do_not_optimize(array_shm.traverse(sum_node<64>));
+            }));
+        }
+        if (selected(args, "bulk_traverse_prefetch")) {
+            reporter->report(run_bench("bulk_traverse_prefetch", params, length, args.min_time_ms, [&]() {
+                do_not_optimize(array_shm.traverse_prefetch(sum_node<64>));
+            }));
+        }
+        shmdt(reinterpret_cast<char*>(body) - sizeof(ARRAY_SHM_HEADER));
+        remove_shm(key);
+    }
+}
+
+void bench_attach(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "attach")) {
+        return;
+    }
+    size_t key = g_next_key++;
+    remove_shm(key);
+    CArrayShm<BenchNode<16>> creator;
+    if (!creator.init(key, 4096, true)) {
+        fprintf(stderr, "init shm failed, err: %s\n", creator.get_err_msg().c_str());
+        return;
+    }
+    // 每次操作包含 shmget + shmat 头部 + 校验头部 + shmat 全部 + 析构时 shmdt
+    reporter->report(run_bench("attach", "node_size=16,node_count=4096", 0, args.min_time_ms, [&]() {
+        CArrayShm<BenchNode<16>> reader;
+        do_not_optimize(reader.init(key));
+    }));
+    remove_shm(key);
+}
+
+void bench_registry(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "registry")) {
+        return;
+    }
+    const size_t array_count = 32;
+    size_t key = g_next_key++;
+    remove_shm(key);
+    CShmRegistry creator;
+    if (!creator.init(key, array_count, 8UL << 20, true)) {
+        fprintf(stderr, "init registry failed, err: %s\n", creator.get_err_msg().c_str());
+        return;
+    }
+    std::vector<std::string> names;
+    for (size_t i = 0; i < array_count; ++i) {
+        names.push_back("array_" + std::to_string(i));
+        CArrayShm<BenchNode<16>> array_shm;
+        if (!creator.create_array(names.back().c_str(), 4096, &array_shm)) {
+            fprintf(stderr, "create array failed, err: %s\n", creator.get_err_msg().c_str());
+            remove_shm(key);
+            return;
+        }
+    }
+    std::string params = "arrays=" + std::to_string(array_count) + ",node_size=16,node_count=4096";
+    // 每次操作挂载注册表一次并打开所有数组，与逐个 attach 独立共享内存对比
+    if (selected(args, "registry_open_all")) {
+        reporter->report(run_bench("registry_open_all", params, 0, args.min_time_ms, [&]() {
+            CShmRegistry registry;
+            do_not_optimize(registry.init(key));
+            for (const std::string& name : names) {
+                CArrayShm<BenchNode<16>> reader;
+                do_not_optimize(registry.open_array(name.c_str(), &reader));
+            }
+        }));
+    }
+    if (selected(args, "registry_open_one")) {
+        CShmRegistry registry;
+        registry.init(key);
+        reporter->report(run_bench("registry_open_one", params, 0, args.min_time_ms, [&]() {
+            CArrayShm<BenchNode<16>> reader;
+            do_not_optimize(registry.open_array(names.back().c_str(), &reader));
+        }));
+    }
+    remove_shm(key);
+}
+
+void bench_create(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "create")) {
+        return;
+    }
+    size_t key = g_next_key++;
+    remove_shm(key);
+    reporter->report(run_bench("create", "node_size=16,node_count=4096", 0, args.min_time_ms, [&]() {
+        CArrayShm<BenchNode<16>> creator;
+        do_not_optimize(creator.init(key, 4096, true));
+        remove_shm(key);
+    }));
+}
+
+void bench_crc(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "crc")) {
+        return;
+    }
+    const size_t lengths[] = {sizeof(ARRAY_SHM_HEADER), 256, 4096};
+    for (size_t length : lengths) {
+        std::vector<uint8_t> buf(length, 0x5a);
+        reporter->report(run_bench("crc", "length=" + std::to_string(length), length, args.min_time_ms, [&]() {
+            do_not_optimize(calc_crc_val(buf.data(), buf.size()));
+        }));
+    }
+}
+
+void bench_clock(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    const struct {
+        SHM_CLOCK_TYPE type;
+        const char* name;
+    } clocks[] = {
+        {thread_mem_shm_sdk::SHM_CLOCK_REALTIME, "realtime"},
+        {thread_mem_shm_sdk::SHM_CLOCK_MONOTONIC, "monotonic"},
+        {thread_mem_shm_sdk::SHM_CLOCK_MONOTONIC_COARSE, "monotonic_coarse"},
+        {thread_mem_shm_sdk::SHM_CLOCK_TSC, "tsc"},
+    };
+    for (const auto& clock : clocks) {
+        std::string params = std::string("clock=") + clock.name;
+        if (selected(args, "clock_now")) {
+            CShmClock shm_clock;
+            shm_clock.init(clock.type);
+            if (shm_clock.get_type() != clock.type) {
+                params += "(fallback)";
+            }
+            reporter->report(run_bench("clock_now", params, 0, args.min_time_ms, [&]() {
+                do_not_optimize(shm_clock.now());
+            }));
+        }
+        if (selected(args, "insert_clock")) {
+            size_t key = g_next_key++;
+            remove_shm(key);
+            CArrayShm<BenchNode<16>> array_shm;
+            ARRAY_SHM_OPTIONS options;
+            options.clock_type = clock.type;
+            if (!array_shm.init(key, 1, true, options)) {
+                fprintf(stderr, "init shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+                return;
+            }
+            std::vector<BenchNode<16>> node_vec(1);
+            reporter->report(run_bench("insert_clock", params + ",node_count=1", 16, args.min_time_ms, [&]() {
+                do_not_optimize(array_shm.insert(node_vec));
+            }));
+            remove_shm(key);
+        }
+    }
+}
+
+void bench_semaphore(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "sem")) {
+        return;
+    }
+    CSemaphore sem;
+    if (!sem.create(BENCH_SEM_KEY)) {
+        fprintf(stderr, "create sem failed, err: %s\n", sem.get_err_msg());
+        return;
+    }
+    reporter->report(run_bench("sem_lock_unlock", "contention=none", 0, args.min_time_ms, [&]() {
+        sem.lock();
+        sem.unlock();
+    }));
+    reporter->report(run_bench("sem_try_lock_unlock", "contention=none", 0, args.min_time_ms, [&]() {
+        if (sem.lock(false)) {
+            sem.unlock();
+        }
+    }));
+    // 不带 SEM_UNDO，内核不维护 undo 记录
+    sem.set_undo(false);
+    reporter->report(run_bench("sem_lock_unlock", "contention=none,undo=0", 0, args.min_time_ms, [&]() {
+        sem.lock();
+        sem.unlock();
+    }));
+    sem.set_undo(true);
+    // 统计加锁等待时间的额外开销
+    size_t key = g_next_key++;
+    remove_shm(key);
+    CArrayShm<BenchNode<16>> array_shm;
+    ARRAY_SHM_OPTIONS options;
+    options.enable_stats = true;
+    if (array_shm.init(key, 1, true, options)) {
+        sem.set_stats(array_shm.get_stats());
+        reporter->report(run_bench("sem_lock_unlock_stats", "contention=none", 0, args.min_time_ms, [&]() {
+            sem.lock();
+            sem.unlock();
+        }));
+        sem.set_stats(nullptr);
+    }
+    remove_shm(key);
+    sem.destroy();
+}
+
+/**
+ * @brief 有序索引：范围查询、top-K 与全量遍历过滤的对比，以及发布时维护索引的开销
+ *
+ * @param args
+ * @param reporter
+ */
+void bench_index(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "index")) {
+        return;
+    }
+    const size_t node_count = 65536;
+    size_t key = g_next_key++;
+    remove_shm(key);
+    CArrayShm<BenchNode<16>> array_shm;
+    ARRAY_SHM_OPTIONS options;
+    options.index_count = 1;
+    if (!array_shm.init(key, node_count, true, options)) {
+        fprintf(stderr, "init shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+        return;
+    }
+    array_shm.set_index_key(0, [](const BenchNode<16>& node) -> uint64_t { return node.data[0] | (node.data[1] << 8); });
+    std::vector<BenchNode<16>> node_vec(node_count);
+    unsigned int seed = 1;
+    for (auto& node : node_vec) {
+        node.data[0] = static_cast<uint8_t>(rand_r(&seed));
+        node.data[1] = static_cast<uint8_t>(rand_r(&seed));
+    }
+    array_shm.insert(node_vec);
+    std::string params = "node_count=" + std::to_string(node_count);
+    // 约 1/256 的节点命中
+    const uint64_t low = 1000;
+    const uint64_t high = 1255;
+    if (selected(args, "index_range")) {
+        reporter->report(run_bench("index_range", params + ",hit=1/256", 0, args.min_time_ms, [&]() {
+            do_not_optimize(array_shm.range_query(0, low, high, sum_node<16>));
+        }));
+    }
+    if (selected(args, "index_traverse_filter")) {
+        reporter->report(run_bench("index_traverse_filter", params + ",hit=1/256", 0, args.min_time_ms, [&]() {
+            do_not_optimize(array_shm.traverse([&](BenchNode<16>* node) {
+                uint64_t val = node->data[0] | (node->data[1] << 8);
+                return (val < low || val > high) || sum_node<16>(node);
+            }));
+        }));
+    }
+    if (selected(args, "index_top_k")) {
+        reporter->report(run_bench("index_top_k", params + ",k=10", 0, args.min_time_ms, [&]() {
+            do_not_optimize(array_shm.top_k(0, 10, sum_node<16>));
+        }));
+    }
+    // 每次发布改动少量节点，索引增量归并
+    if (selected(args, "index_insert")) {
+        size_t round = 0;
+        reporter->report(run_bench("index_insert", params + ",changed=16", 16 * node_count, args.min_time_ms, [&]() {
+            for (size_t i = 0; i < 16; ++i) {
+                node_vec[(round * 16 + i) * 977 % node_count].data[0] ^= 0x5a;
+            }
+            ++round;
+            do_not_optimize(array_shm.insert(node_vec));
+        }));
+    }
+    remove_shm(key);
+}
+
+/**
+ * @brief 分组提交与一致性读取：两个成员各自 snapshot，与不经过分组的读取对比
+ *
+ * @param args
+ * @param reporter
+ */
+void bench_group(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "group")) {
+        return;
+    }
+    const size_t node_count = 256;
+    size_t group_key = g_next_key++;
+    size_t thread_key = g_next_key++;
+    size_t arena_key = g_next_key++;
+    remove_shm(group_key);
+    remove_shm(thread_key);
+    remove_shm(arena_key);
+    CArrayShm<BenchNode<16>> thread_shm;
+    CArrayShm<BenchNode<64>> arena_shm;
+    CShmGroup group;
+    if (!thread_shm.init(thread_key, node_count, true) || !arena_shm.init(arena_key, node_count, true)
+        || !group.init(group_key, {thread_key, arena_key}, true)) {
+        fprintf(stderr, "init group failed, err: %s\n", group.get_err_msg().c_str());
+        return;
+    }
+    std::vector<BenchNode<16>> thread_vec(node_count);
+    std::vector<BenchNode<64>> arena_vec(node_count);
+    std::string params = "members=2,node_count=" + std::to_string(node_count);
+    if (selected(args, "group_commit")) {
+        reporter->report(run_bench("group_commit", params, 80 * node_count, args.min_time_ms, [&]() {
+            do_not_optimize(group.commit([&]() {
+                return thread_shm.insert(thread_vec) >= 0 && arena_shm.insert(arena_vec) >= 0;
+            }));
+        }));
+    }
+    group.commit([&]() { return thread_shm.insert(thread_vec) >= 0 && arena_shm.insert(arena_vec) >= 0; });
+    ARRAY_SHM_HEADER thread_header;
+    ARRAY_SHM_HEADER arena_header;
+    if (selected(args, "group_read")) {
+        reporter->report(run_bench("group_read", params, 80 * node_count, args.min_time_ms, [&]() {
+            do_not_optimize(group.read([&]() {
+                return thread_shm.snapshot(&thread_header, &thread_vec) && arena_shm.snapshot(&arena_header, &arena_vec);
+            }));
+        }));
+    }
+    if (selected(args, "group_read_nogroup")) {
+        reporter->report(run_bench("group_read_nogroup", params, 80 * node_count, args.min_time_ms, [&]() {
+            do_not_optimize(thread_shm.snapshot(&thread_header, &thread_vec)
+                && arena_shm.snapshot(&arena_header, &arena_vec));
+        }));
+    }
+    remove_shm(group_key);
+    remove_shm(thread_key);
+    remove_shm(arena_key);
+}
+
+/**
+ * @brief 多缓冲区发布与遍历，与单缓冲区对比
+ *
+ * @param args
+ * @param reporter
+ */
+void bench_buffer(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "buffer")) {
+        return;
+    }
+    const size_t node_count = 256;
+    // 单缓冲、多缓冲以及崩溃安全发布（两份缓冲区加提交记录）
+    struct {
+        uint32_t buffer_count;
+        bool crash_safe;
+    } configs[] = {{1, false}, {3, false}, {2, true}};
+    for (const auto& config : configs) {
+        size_t key = g_next_key++;
+        remove_shm(key);
+        CArrayShm<BenchNode<64>> array_shm;
+        ARRAY_SHM_OPTIONS options;
+        options.buffer_count = config.buffer_count;
+        options.crash_safe = config.crash_safe;
+        if (!array_shm.init(key, node_count, true, options)) {
+            fprintf(stderr, "init shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+            return;
+        }
+        std::vector<BenchNode<64>> node_vec(node_count);
+        std::string params = "buffer_count=" + std::to_string(config.buffer_count)
+            + ",crash_safe=" + std::to_string(config.crash_safe ? 1 : 0) + ",node_count=" + std::to_string(node_count);
+        if (selected(args, "buffer_insert")) {
+            reporter->report(run_bench("buffer_insert", params, 64 * node_count, args.min_time_ms, [&]() {
+                do_not_optimize(array_shm.insert(node_vec));
+            }));
+        }
+        array_shm.insert(node_vec);
+        if (selected(args, "buffer_traverse")) {
+            reporter->report(run_bench("buffer_traverse", params, 64 * node_count, args.min_time_ms, [&]() {
+                do_not_optimize(array_shm.traverse([](BenchNode<64>* node) {
+                    g_sink += node->data[0];
+                    return true;
+                }));
+            }));
+        }
+        remove_shm(key);
+    }
+}
+
+/**
+ * @brief 占用读者槽位的遍历，与不占用槽位的读者对比
+ *
+ * @param args
+ * @param reporter
+ */
+void bench_reader(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "reader")) {
+        return;
+    }
+    const size_t node_count = 256;
+    size_t key = g_next_key++;
+    remove_shm(key);
+    CArrayShm<BenchNode<64>> writer;
+    ARRAY_SHM_OPTIONS options;
+    options.reader_count = 4;
+    if (!writer.init(key, node_count, true, options)) {
+        fprintf(stderr, "init shm failed, err: %s\n", writer.get_err_msg().c_str());
+        return;
+    }
+    std::vector<BenchNode<64>> node_vec(node_count);
+    writer.insert(node_vec);
+    for (bool register_reader : {false, true}) {
+        if (!selected(args, "reader_traverse")) {
+            break;
+        }
+        CArrayShm<BenchNode<64>> reader;
+        ARRAY_SHM_OPTIONS reader_options;
+        reader_options.register_reader = register_reader;
+        if (!reader.init(key, 0, false, reader_options)) {
+            fprintf(stderr, "init reader failed, err: %s\n", reader.get_err_msg().c_str());
+            break;
+        }
+        std::string params = std::string("register=") + (register_reader ? "1" : "0")
+            + ",node_count=" + std::to_string(node_count);
+        reporter->report(run_bench("reader_traverse", params, 64 * node_count, args.min_time_ms, [&]() {
+            do_not_optimize(reader.traverse([](BenchNode<64>* node) {
+                g_sink += node->data[0];
+                return true;
+            }));
+        }));
+    }
+    if (selected(args, "reader_oldest_epoch")) {
+        reporter->report(run_bench("reader_oldest_epoch", "reader_count=4", 0, args.min_time_ms, [&]() {
+            do_not_optimize(writer.get_oldest_reader_epoch());
+        }));
+    }
+    remove_shm(key);
+}
+
+void bench_publisher(const BENCH_ARGS& args, CBenchReporter* reporter) {
+    if (!selected(args, "publish")) {
+        return;
+    }
+    size_t key = g_next_key++;
+    remove_shm(key);
+    CArrayShm<BenchNode<16>> array_shm;
+    if (!array_shm.init(key, 256, true)) {
+        fprintf(stderr, "init shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+        return;
+    }
+    CSemaphore sem;
+    if (!sem.create(BENCH_SEM_KEY)) {
+        fprintf(stderr, "create sem failed, err: %s\n", sem.get_err_msg());
+        remove_shm(key);
+        return;
+    }
+    BenchNode<16> node{};
+    std::vector<BenchNode<16>> node_vec(1);
+    // 业务线程直接加锁发布
+    if (selected(args, "publish_direct")) {
+        reporter->report(run_bench("publish_direct", "node_count=1", 16, args.min_time_ms, [&]() {
+            sem.lock();
+            do_not_optimize(array_shm.insert(node_vec));
+            sem.unlock();
+        }));
+    }
+    // 业务线程只追加到线程局部缓冲区，由后台线程批量发布
+    if (selected(args, "publish_append")) {
+        CBatchPublisher<BenchNode<16>> publisher;
+        BATCH_PUBLISHER_OPTIONS options;
+        options.flush_interval_ms = 1;
+        options.ring_capacity = 1 << 16;
+        if (publisher.init(&array_shm, &sem, options) && publisher.start()) {
+            reporter->report(run_bench("publish_append", "flush_interval_ms=1", 16, args.min_time_ms, [&]() {
+                do_not_optimize(publisher.append(node));
+            }));
+            publisher.stop();
+        }
+    }
+    sem.destroy();
+    remove_shm(key);
+}
+
+void usage(const char* name) {
+    printf("usage: %s [-t min_time_ms] [-f name_prefix] [-j]\n"
+        "  -t  minimum running time of each benchmark in milliseconds, default 200\n"
+        "  -f  only run benchmarks whose name starts with name_prefix\n"
+        "     (insert, traverse, insert_stats, traverse_stats, bulk, attach, registry, create, crc,\n"
+        "     clock_now, insert_clock, index, group, buffer, reader, publish, sem)\n"
+        "  -j  output JSON Lines instead of a table\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    BENCH_ARGS args;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "t:f:jh")) != -1) {
+        switch (opt) {
+        case 't':
+            args.min_time_ms = strtoul(optarg, nullptr, 0);
+            break;
+        case 'f':
+            args.filter = optarg;
+            break;
+        case 'j':
+            args.json = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    CBenchReporter reporter(args.json);
+    bench_node_size<16>(args, &reporter);
+    bench_node_size<64>(args, &reporter);
+    bench_node_size<256>(args, &reporter);
+    bench_node_size<1024>(args, &reporter);
+    bench_array<16>(args, &reporter, 256, true);
+    bench_bulk(args, &reporter);
+    bench_attach(args, &reporter);
+    bench_registry(args, &reporter);
+    bench_create(args, &reporter);
+    bench_crc(args, &reporter);
+    bench_clock(args, &reporter);
+    bench_index(args, &reporter);
+    bench_group(args, &reporter);
+    bench_buffer(args, &reporter);
+    bench_reader(args, &reporter);
+    bench_publisher(args, &reporter);
+    bench_semaphore(args, &reporter);
+    do_not_optimize(g_sink);
+    return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file startup_bench.cpp
+ * @author noahyzhang
+ * @brief 创建共享内存的启动耗时测试
+ * 对不同大小的共享内存，比较各种预分配方式和线程数下的创建耗时，以及创建后第一次整段写入的耗时
+ * （未预分配时缺页发生在这里）
+ * @version 0.1
+ * @date 2023-05-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "zy_array_shm.h"
+#include "bench_utils.h"
+
+using thread_mem_shm_sdk::ARRAY_SHM_OPTIONS;
+using thread_mem_shm_sdk::CArrayShm;
+using thread_mem_shm_sdk::SHM_CREATE_TIMING;
+using thread_mem_shm_sdk::SHM_PREFAULT_MODE;
+using shm_bench::BENCH_RESULT;
+using shm_bench::CBenchReporter;
+using shm_bench::fill_result;
+using shm_bench::now_ns;
+
+static const size_t BENCH_SHM_KEY = 0x5d7e0000;
+
+// 以页为节点，节点个数即页数
+struct PageNode {
+    uint8_t data[4096];
+};
+
+struct BENCH_ARGS {
+    std::vector<int> sizes_mb{64, 256, 1024};
+    std::vector<int> threads{1, 4};
+    uint32_t repeat = 3;
+    bool json = false;
+};
+
+/**
+ * @brief 删除测试创建的共享内存
+ *
+ * @param key
+ */
+void remove_shm(size_t key) {
+    int shm_id = shmget(key, 0, 0);
+    if (shm_id >= 0) {
+        shmctl(shm_id, IPC_RMID, nullptr);
+    }
+}
+
+/**
+ * @brief 从另一个挂载点逐页写一次，模拟写者第一次整段发布
+ *
+ * @param key
+ * @param length
+ * @return uint64_t 耗时（纳秒）
+ */
+uint64_t first_write_ns(size_t key, size_t length) {
+    int shm_id = shmget(key, 0, 0);
+    if (shm_id < 0) {
+        return 0;
+    }
+    void* addr = shmat(shm_id, nullptr, 0);
+    if (addr == reinterpret_cast<void*>(-1)) {
+        return 0;
+    }
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    volatile uint8_t* base = reinterpret_cast<volatile uint8_t*>(addr);
+    uint64_t begin_ns = now_ns();
+    for (size_t offset = 0; offset < length; offset += page_size) {
+        base[offset] = 1;
+    }
+    uint64_t cost_ns = now_ns() - begin_ns;
+    shmdt(addr);
+    return cost_ns;
+}
+
+/**
+ * @brief 测试一种配置
+ *
+ * @param args
+ * @param reporter
+ * @param size_mb
+ * @param mode
+ * @param mode_name
+ * @param threads
+ */
+void bench_startup(const BENCH_ARGS& args, CBenchReporter* reporter, int size_mb, SHM_PREFAULT_MODE mode,
+    const char* mode_name, uint32_t threads) {
+    size_t node_count = (static_cast<size_t>(size_mb) << 20) / sizeof(PageNode);
+    size_t length = node_count * sizeof(PageNode);
+    std::vector<double> create_samples;
+    std::vector<double> prefault_samples;
+    std::vector<double> write_samples;
+    uint64_t create_total = 0;
+    uint64_t prefault_total = 0;
+    uint64_t write_total = 0;
+    SHM_CREATE_TIMING timing{};
+    for (uint32_t i = 0; i < args.repeat; ++i) {
+        remove_shm(BENCH_SHM_KEY);
+        {
+            CArrayShm<PageNode> array_shm;
+            ARRAY_SHM_OPTIONS options;
+            options.prefault = mode;
+            options.prefault_threads = threads;
+            if (!array_shm.init(BENCH_SHM_KEY, node_count, true, options)) {
+                fprintf(stderr, "init shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+                remove_shm(BENCH_SHM_KEY);
+                return;
+            }
+            timing = array_shm.get_create_timing();
+        }
+        uint64_t write_ns = first_write_ns(BENCH_SHM_KEY, length);
+        remove_shm(BENCH_SHM_KEY);
+        create_samples.push_back(timing.total_ns);
+        prefault_samples.push_back(timing.prefault_ns);
+        write_samples.push_back(write_ns);
+        create_total += timing.total_ns;
+        prefault_total += timing.prefault_ns;
+        write_total += write_ns;
+    }
+    std::string params = "size_mb=" + std::to_string(size_mb) + ",mode=" + mode_name
+        + ",threads=" + std::to_string(timing.prefault_threads);
+    if (timing.prefault_mode != mode) {
+        params += "(fallback)";
+    }
+    BENCH_RESULT result;
+    result.name = "create";
+    result.params = params;
+    result.bytes_per_op = length;
+    fill_result(&create_samples, args.repeat, create_total, &result);
+    reporter->report(result);
+
+    BENCH_RESULT prefault_result;
+    prefault_result.name = "prefault";
+    prefault_result.params = params;
+    prefault_result.bytes_per_op = length;
+    fill_result(&prefault_samples, args.repeat, prefault_total, &prefault_result);
+    reporter->report(prefault_result);
+
+    BENCH_RESULT write_result;
+    write_result.name = "first_write";
+    write_result.params = params;
+    write_result.bytes_per_op = length;
+    fill_result(&write_samples, args.repeat, write_total, &write_result);
+    reporter->report(write_result);
+}
+
+/**
+ * @brief 解析逗号分隔的整数列表
+ *
+ * @param str
+ * @return std::vector<int>
+ */
+std::vector<int> parse_list(const char* str) {
+    std::vector<int> vals;
+    const char* p = str;
+    while (*p != '\0') {
+        char* end = nullptr;
+        long val = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        if (val > 0) {
+            vals.push_back(static_cast<int>(val));
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return vals;
+}
+
+void usage(const char* name) {
+    printf("usage: %s [-s sizes_mb] [-T threads] [-r repeat] [-j]\n"
+        "  -s  comma separated segment sizes in MB, default 64,256,1024\n"
+        "  -T  comma separated prefault thread counts for touch/madvise, default 1,4\n"
+        "  -r  repeat count of each configuration, default 3\n"
+        "  -j  output JSON Lines instead of a table\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    BENCH_ARGS args;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "s:T:r:jh")) != -1) {
+        switch (opt) {
+        case 's':
+            args.sizes_mb = parse_list(optarg);
+            break;
+        case 'T':
+            args.threads = parse_list(optarg);
+            break;
+        case 'r':
+            args.repeat = strtoul(optarg, nullptr, 0);
+            break;
+        case 'j':
+            args.json = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (args.sizes_mb.empty() || args.threads.empty() || args.repeat == 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    CBenchReporter reporter(args.json);
+    for (int size_mb : args.sizes_mb) {
+        bench_startup(args, &reporter, size_mb, thread_mem_shm_sdk::SHM_PREFAULT_NONE, "none", 1);
+        bench_startup(args, &reporter, size_mb, thread_mem_shm_sdk::SHM_PREFAULT_MEMSET, "memset", 1);
+        for (int threads : args.threads) {
+            bench_startup(args, &reporter, size_mb, thread_mem_shm_sdk::SHM_PREFAULT_TOUCH, "touch", threads);
+            bench_startup(args, &reporter, size_mb, thread_mem_shm_sdk::SHM_PREFAULT_MADVISE, "madvise", threads);
+        }
+    }
+    return 0;
+}
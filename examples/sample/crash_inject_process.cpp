@@ -0,0 +1,329 @@
+/**
+ * @file crash_inject_process.cpp
+ * @author noahyzhang
+ * @brief 写者崩溃的故障注入
+ * 反复 fork 写进程不停发布，在随机时刻 SIGKILL，之后重启写者继续发布；读进程全程不停读取并校验每个节点。
+ * safe 模式使用崩溃安全发布（读者不加锁），legacy 模式为单缓冲加 SEM_UNDO 信号量（读写都加锁），
+ * 每次杀死写者后再校验一次共享内存中的数据，读到写了一半的发布时以非 0 退出
+ * @version 0.1
+ * @date 2023-06-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/sem.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "zy_array_shm.h"
+#include "zy_semaphore.h"
+
+using thread_mem_shm_sdk::ARRAY_SHM_HEADER;
+using thread_mem_shm_sdk::ARRAY_SHM_OPTIONS;
+using thread_mem_shm_sdk::CArrayShm;
+using thread_mem_shm_sdk::CSemaphore;
+
+static const size_t CRASH_SHM_KEY = 0x5e7f0100;
+static const int32_t CRASH_SEM_KEY = 0x5e7f0101;
+
+// 同一次发布的所有节点 id 相同，check 由 id 和位置计算，读到混合了两次发布的数据时校验失败
+struct CRASH_NODE {
+    uint64_t id;
+    uint64_t pos;
+    uint64_t check;
+};
+
+struct CRASH_ARGS {
+    uint32_t rounds = 300;
+    uint32_t node_count = 4096;
+    uint32_t reader_count = 2;
+    // 启动写者后到杀死写者的最长时间
+    uint32_t max_delay_us = 3000;
+    // safe：崩溃安全发布，legacy：单缓冲加信号量
+    std::string mode = "safe";
+    uint32_t seed = 0;
+};
+
+// 各进程共享的计数，fork 之前通过匿名共享映射分配
+struct CRASH_RESULT {
+    std::atomic<uint32_t> stop;
+    std::atomic<uint64_t> reads;
+    std::atomic<uint64_t> read_torn;
+    std::atomic<uint64_t> read_err;
+    std::atomic<uint64_t> generation_regress;
+    std::atomic<uint64_t> publishes;
+    std::atomic<uint64_t> recovered;
+    std::atomic<uint64_t> crash_checks;
+    std::atomic<uint64_t> crash_torn;
+    std::atomic<uint64_t> crash_err;
+};
+
+inline uint64_t calc_check(uint64_t id, uint64_t pos) {
+    uint64_t x = id ^ (pos * 0x9E3779B97F4A7C15ULL);
+    x ^= x >> 31;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    return x ^ (x >> 29);
+}
+
+/**
+ * @brief 校验一次读取的节点，尚未发布过时节点个数为 0
+ *
+ * @param nodes
+ * @param node_count
+ * @return true
+ * @return false
+ */
+bool check_nodes(const std::vector<CRASH_NODE>& nodes, size_t node_count) {
+    if (nodes.empty()) {
+        return true;
+    }
+    if (nodes.size() != node_count) {
+        return false;
+    }
+    uint64_t id = nodes[0].id;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].id != id || nodes[i].pos != i || nodes[i].check != calc_check(id, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ARRAY_SHM_OPTIONS make_options(const CRASH_ARGS& args) {
+    ARRAY_SHM_OPTIONS options;
+    options.crash_safe = args.mode == "safe";
+    return options;
+}
+
+/**
+ * @brief 写进程：挂载（重启后为恢复）后不停发布，直到被杀死
+ *
+ * @param args
+ * @param result
+ */
+void run_writer(const CRASH_ARGS& args, CRASH_RESULT* result) {
+    CArrayShm<CRASH_NODE> array_shm;
+    if (!array_shm.init(CRASH_SHM_KEY, args.node_count, true, make_options(args))) {
+        fprintf(stderr, "writer init failed, err: %s\n", array_shm.get_err_msg().c_str());
+        _exit(1);
+    }
+    if (array_shm.is_recovered()) {
+        result->recovered.fetch_add(1, std::memory_order_relaxed);
+    }
+    CSemaphore sem;
+    bool use_sem = args.mode != "safe";
+    if (use_sem && !sem.create(CRASH_SEM_KEY)) {
+        fprintf(stderr, "writer create sem failed, err: %s\n", sem.get_err_msg());
+        _exit(1);
+    }
+    std::vector<CRASH_NODE> nodes(args.node_count);
+    uint64_t seq = 0;
+    for (;;) {
+        uint64_t id = (static_cast<uint64_t>(getpid()) << 32) | ++seq;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            nodes[i].id = id;
+            nodes[i].pos = i;
+            nodes[i].check = calc_check(id, i);
+        }
+        if (use_sem) {
+            sem.lock();
+        }
+        array_shm.insert(nodes);
+        if (use_sem) {
+            sem.unlock();
+        }
+        result->publishes.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief 读进程：不停读取并校验，发布代数不应回退
+ *
+ * @param args
+ * @param result
+ */
+void run_reader(const CRASH_ARGS& args, CRASH_RESULT* result) {
+    CArrayShm<CRASH_NODE> array_shm;
+    if (!array_shm.init(CRASH_SHM_KEY)) {
+        fprintf(stderr, "reader init failed, err: %s\n", array_shm.get_err_msg().c_str());
+        _exit(1);
+    }
+    CSemaphore sem;
+    bool use_sem = args.mode != "safe";
+    if (use_sem && !sem.create(CRASH_SEM_KEY)) {
+        fprintf(stderr, "reader create sem failed, err: %s\n", sem.get_err_msg());
+        _exit(1);
+    }
+    ARRAY_SHM_HEADER header;
+    std::vector<CRASH_NODE> nodes;
+    uint64_t last_generation = 0;
+    while (result->stop.load(std::memory_order_relaxed) == 0) {
+        if (use_sem) {
+            sem.lock();
+        }
+        bool res = array_shm.snapshot(&header, &nodes);
+        if (use_sem) {
+            sem.unlock();
+        }
+        result->reads.fetch_add(1, std::memory_order_relaxed);
+        if (!res) {
+            result->read_err.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (!check_nodes(nodes, args.node_count)) {
+            result->read_torn.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (header.generation < last_generation) {
+            result->generation_regress.fetch_add(1, std::memory_order_relaxed);
+        }
+        last_generation = header.generation;
+    }
+    _exit(0);
+}
+
+/**
+ * @brief 写者被杀死后校验共享内存中的数据
+ *
+ * @param args
+ * @param array_shm
+ * @param result
+ */
+void check_after_crash(const CRASH_ARGS& args, CArrayShm<CRASH_NODE>* array_shm, CRASH_RESULT* result) {
+    ARRAY_SHM_HEADER header;
+    std::vector<CRASH_NODE> nodes;
+    result->crash_checks.fetch_add(1, std::memory_order_relaxed);
+    if (!array_shm->snapshot(&header, &nodes)) {
+        result->crash_err.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (!check_nodes(nodes, args.node_count)) {
+        result->crash_torn.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief 删除测试创建的共享内存和信号量
+ *
+ */
+void remove_ipc() {
+    int shm_id = shmget(CRASH_SHM_KEY, 0, 0);
+    if (shm_id >= 0) {
+        shmctl(shm_id, IPC_RMID, nullptr);
+    }
+    int sem_id = semget(CRASH_SEM_KEY, 0, 0);
+    if (sem_id >= 0) {
+        semctl(sem_id, 0, IPC_RMID);
+    }
+}
+
+void usage(const char* name) {
+    printf("usage: %s [-r rounds] [-n node_count] [-R readers] [-d max_delay_us] [-m safe|legacy] [-s seed]\n"
+        "  -r  times to kill and restart the writer, default 300\n"
+        "  -n  node count of each publish, default 4096\n"
+        "  -R  reader process count, default 2\n"
+        "  -d  maximum time between starting and killing the writer in microseconds, default 3000\n"
+        "  -m  safe: crash safe publishing, lock free readers; legacy: single buffer with SEM_UNDO semaphore\n"
+        "  -s  random seed, default current time\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    CRASH_ARGS args;
+    args.seed = static_cast<uint32_t>(time(nullptr));
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "r:n:R:d:m:s:h")) != -1) {
+        switch (opt) {
+        case 'r':
+            args.rounds = strtoul(optarg, nullptr, 0);
+            break;
+        case 'n':
+            args.node_count = strtoul(optarg, nullptr, 0);
+            break;
+        case 'R':
+            args.reader_count = strtoul(optarg, nullptr, 0);
+            break;
+        case 'd':
+            args.max_delay_us = strtoul(optarg, nullptr, 0);
+            break;
+        case 'm':
+            args.mode = optarg;
+            break;
+        case 's':
+            args.seed = strtoul(optarg, nullptr, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if ((args.mode != "safe" && args.mode != "legacy") || args.node_count == 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    void* addr = mmap(nullptr, sizeof(CRASH_RESULT), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    // 匿名映射已清零，计数全部为 0
+    CRASH_RESULT* result = static_cast<CRASH_RESULT*>(addr);
+    remove_ipc();
+    {
+        // 先创建共享内存，之后的写者都是挂载已存在的共享内存
+        CArrayShm<CRASH_NODE> array_shm;
+        if (!array_shm.init(CRASH_SHM_KEY, args.node_count, true, make_options(args))) {
+            fprintf(stderr, "create shm failed, err: %s\n", array_shm.get_err_msg().c_str());
+            return -1;
+        }
+    }
+    std::vector<pid_t> readers;
+    for (uint32_t i = 0; i < args.reader_count; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_reader(args, result);
+        }
+        readers.push_back(pid);
+    }
+    CArrayShm<CRASH_NODE> checker;
+    if (!checker.init(CRASH_SHM_KEY)) {
+        fprintf(stderr, "attach shm failed, err: %s\n", checker.get_err_msg().c_str());
+        return -1;
+    }
+    uint32_t seed = args.seed;
+    for (uint32_t round = 0; round < args.rounds; ++round) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_writer(args, result);
+        }
+        usleep(args.max_delay_us > 0 ? rand_r(&seed) % args.max_delay_us : 0);
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        check_after_crash(args, &checker, result);
+    }
+    result->stop.store(1, std::memory_order_relaxed);
+    for (pid_t pid : readers) {
+        waitpid(pid, nullptr, 0);
+    }
+    remove_ipc();
+
+    bool consistent = result->read_torn.load() == 0 && result->crash_torn.load() == 0
+        && result->generation_regress.load() == 0;
+    printf("mode: %s, seed: %u, rounds: %u, publishes: %lu, recovered: %lu\n", args.mode.c_str(), args.seed,
+        args.rounds, result->publishes.load(), result->recovered.load());
+    printf("readers: reads: %lu, torn: %lu, errors: %lu, generation regress: %lu\n", result->reads.load(),
+        result->read_torn.load(), result->read_err.load(), result->generation_regress.load());
+    printf("after crash: checks: %lu, torn: %lu, errors: %lu\n", result->crash_checks.load(),
+        result->crash_torn.load(), result->crash_err.load());
+    munmap(addr, sizeof(CRASH_RESULT));
+    return consistent ? 0 : 1;
+}
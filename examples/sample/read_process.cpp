@@ -36,8 +36,8 @@ int main() {
         sem.lock();
         array_shm.get_header(&header);
         std::cout << "header info, version: " << header.version << ", cur_node_count: " << header.cur_node_count
-            << ", max_node_count: " << header.max_node_count << ", time_ns: " << header.time_ns
-            << ", crc: " << header.header_crc_val << std::endl;
+            << ", max_node_count: " << header.max_node_count << ", time_ns: " << thread_mem_shm_sdk::array_shm_wall_time_ns(header)
+            << ", generation: " << header.generation << ", crc: " << header.header_crc_val << std::endl;
         bool ret = array_shm.traverse([](DataNode* node) ->bool {
             std::cout << "tid: " << node->tid << ", arena_id: " << node->arena_id
                 << ", allocated_kb: " << node->allocated_kb
@@ -0,0 +1,110 @@
+#include <signal.h>
+#include <string.h>
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <string>
+#include "zy_array_shm.h"
+#include "zy_semaphore.h"
+#include "zy_snapshot_exporter.h"
+#include "zy_snapshot_reader.h"
+#include "rw_process.h"
+
+struct DataNode {
+    uint32_t tid;
+    uint32_t arena_id;
+    uint32_t allocated_kb;
+    uint32_t deallocated_kb;
+};
+
+using thread_mem_shm_sdk::CArrayShm;
+using thread_mem_shm_sdk::CSemaphore;
+using thread_mem_shm_sdk::CSnapshotExporter;
+using thread_mem_shm_sdk::CSnapshotReader;
+
+// 收到 SIGINT/SIGTERM 后退出导出循环
+static volatile sig_atomic_t g_stop = 0;
+
+static void handle_stop_signal(int) {
+    g_stop = 1;
+}
+
+int export_snapshot(const std::string& path) {
+    CArrayShm<DataNode> array_shm;
+    bool res = array_shm.init(SHM_KEY);
+    if (!res) {
+        std::cout << "init array_shm failed, err: " << array_shm.get_err_msg() << std::endl;
+        return -1;
+    }
+    CSemaphore sem;
+    res = sem.create(SEM_KEY);
+    if (!res) {
+        std::cout << "init sem failed, err: " << sem.get_err_msg() << std::endl;
+        return -2;
+    }
+    CSnapshotExporter<DataNode> exporter;
+    res = exporter.open(path, &array_shm);
+    if (!res) {
+        std::cout << "open exporter failed, err: " << exporter.get_err_msg() << std::endl;
+        return -3;
+    }
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handle_stop_signal;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGINT, &act, nullptr);
+    sigaction(SIGTERM, &act, nullptr);
+    while (!g_stop) {
+        int ret = exporter.poll(&sem);
+        if (ret < 0) {
+            std::cout << "poll failed, err: " << exporter.get_err_msg() << std::endl;
+        } else if (ret > 0) {
+            std::cout << "captured new generation, file size: " << exporter.get_file_size() << std::endl;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    // 写入暂存的数据并把文件截断到实际长度
+    uint64_t skipped = exporter.get_skipped_generations();
+    if (!exporter.close()) {
+        std::cout << "close exporter failed, err: " << exporter.get_err_msg() << std::endl;
+        return -4;
+    }
+    std::cout << "exporter closed, skipped generations: " << skipped << std::endl;
+    return 0;
+}
+
+int dump_snapshot(const std::string& path) {
+    CSnapshotReader<DataNode> reader;
+    bool res = reader.open(path);
+    if (!res) {
+        std::cout << "open reader failed, err: " << reader.get_err_msg() << std::endl;
+        return -1;
+    }
+    std::cout << "block count: " << reader.get_index().size()
+        << ", skipped generations: " << reader.get_skipped_generations() << std::endl;
+    res = reader.scan([](uint64_t time_ns, uint64_t generation, const DataNode* nodes, size_t count) -> bool {
+        std::cout << "generation: " << generation << ", time_ns: " << time_ns << ", node count: " << count << std::endl;
+        for (size_t i = 0; i < count; ++i) {
+            std::cout << "tid: " << nodes[i].tid << ", arena_id: " << nodes[i].arena_id
+                << ", allocated_kb: " << nodes[i].allocated_kb
+                << ", deallocated_kb: " << nodes[i].deallocated_kb << std::endl;
+        }
+        return true;
+    });
+    if (!res) {
+        std::cout << "scan failed, err: " << reader.get_err_msg() << std::endl;
+        return -2;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3 || (std::string(argv[1]) != "export" && std::string(argv[1]) != "dump")) {
+        std::cout << "usage: " << argv[0] << " export|dump <snapshot file>" << std::endl;
+        return -1;
+    }
+    if (std::string(argv[1]) == "export") {
+        return export_snapshot(argv[2]);
+    }
+    return dump_snapshot(argv[2]);
+}
@@ -30,9 +30,14 @@ const std::vector<DataNode>& gen_random_arr(size_t arr_len) {
 int main() {
     using thread_mem_shm_sdk::CArrayShm;
     using thread_mem_shm_sdk::CSemaphore;
+    using thread_mem_shm_sdk::ARRAY_SHM_OPTIONS;
 
     CArrayShm<DataNode> array_shm;
-    bool res = array_shm.init(SHM_KEY, MAX_SHM_ARR_COUNT, true);
+    ARRAY_SHM_OPTIONS options;
+    options.enable_stats = true;
+    // 发布时间使用 TSC，读者按头部中的换算参数得到系统时间
+    options.clock_type = thread_mem_shm_sdk::SHM_CLOCK_TSC;
+    bool res = array_shm.init(SHM_KEY, MAX_SHM_ARR_COUNT, true, options);
     if (!res) {
         std::cout << "init shm failed, err: " << array_shm.get_err_msg() << std::endl;
         return -1;
@@ -44,6 +49,8 @@ int main() {
         std::cout << "init sem failed, err: " << sem.get_err_msg() << std::endl;
         return -2;
     }
+    // 加锁等待时间记录到共享内存的统计块中
+    sem.set_stats(array_shm.get_stats());
 
     for (;;) {
         std::vector<DataNode> arr = gen_random_arr(20);
@@ -0,0 +1,639 @@
+/**
+ * @file zy_malloc_hook.cpp
+ * @author noahyzhang
+ * @brief 分配器接入的实现
+ * 每个线程第一次分配时占用一个全局槽位（不分配内存），线程局部变量指向该槽位，之后只累加槽位中的计数；
+ * 线程退出时计数并入合并节点并释放槽位。后台线程按周期无锁汇总所有槽位（期间有线程退出则重试），整段发布到共享内存。
+ * 定义 ZY_MEM_HOOK_NO_INTERPOSE 时不拦截 malloc/free，只提供计数和发布接口
+ * @version 0.1
+ * @date 2023-06-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "zy_array_shm.h"
+#include "zy_malloc_hook.h"
+
+namespace thread_mem_shm_sdk {
+
+namespace {
+
+// 槽位状态
+const uint32_t SLOT_FREE = 0;
+const uint32_t SLOT_INIT = 1;
+const uint32_t SLOT_ACTIVE = 2;
+
+// 线程的计数槽位，各占一个缓存行，计数只由所属线程写入，发布线程读取
+struct alignas(64) THREAD_SLOT {
+    uint32_t state;
+    uint32_t tid;
+    uint32_t arena_id;
+    uint64_t allocated;
+    uint64_t deallocated;
+};
+
+THREAD_SLOT g_slots[g_mem_hook_max_threads];
+// 曾经占用过的最大槽位编号加一，发布时只扫描这一段
+uint32_t g_slot_end = 0;
+// 已退出及超出上限的线程的合并计数
+uint64_t g_other_allocated = 0;
+uint64_t g_other_deallocated = 0;
+// 线程退出之间互斥
+pthread_mutex_t g_slot_lock = PTHREAD_MUTEX_INITIALIZER;
+// 线程退出的序号，计数从槽位移入合并计数期间为奇数；发布线程汇总前后序号一致且为偶数，才说明没有被重复或遗漏统计
+uint64_t g_exit_seq = 0;
+// 汇总时因线程退出重试的次数，超过后加锁汇总
+const uint32_t g_collect_retry = 4;
+pthread_key_t g_slot_key;
+bool g_slot_key_ready = false;
+
+// 当前线程的槽位，initial-exec 模型避免经过 __tls_get_addr
+__thread THREAD_SLOT* t_slot __attribute__((tls_model("initial-exec"))) = nullptr;
+// 当前线程已退出或没有空闲槽位，之后的计数并入合并计数
+__thread bool t_no_slot __attribute__((tls_model("initial-exec"))) = false;
+
+/**
+ * @brief 单写者的计数累加，读者是发布线程，不需要带锁前缀的原子加
+ *
+ * @param counter
+ * @param val
+ */
+inline void counter_add(uint64_t* counter, uint64_t val) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + val, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 线程退出时把计数并入合并计数并释放槽位
+ *
+ * @param arg
+ */
+void on_thread_exit(void* arg) {
+    THREAD_SLOT* slot = static_cast<THREAD_SLOT*>(arg);
+    t_no_slot = true;
+    t_slot = nullptr;
+    pthread_mutex_lock(&g_slot_lock);
+    uint64_t seq = __atomic_load_n(&g_exit_seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_exit_seq, seq + 1, __ATOMIC_RELAXED);
+    // 序号变为奇数先于移动计数可见
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_fetch_add(&g_other_allocated, __atomic_load_n(&slot->allocated, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_other_deallocated, __atomic_load_n(&slot->deallocated, __ATOMIC_RELAXED),
+        __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->allocated, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->deallocated, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->state, SLOT_FREE, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_exit_seq, seq + 2, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_slot_lock);
+}
+
+/**
+ * @brief 为当前线程占用槽位，没有空闲槽位时返回 nullptr
+ *
+ * @return THREAD_SLOT*
+ */
+THREAD_SLOT* register_thread() {
+    for (uint32_t i = 0; i < g_mem_hook_max_threads; ++i) {
+        uint32_t expected = SLOT_FREE;
+        if (__atomic_load_n(&g_slots[i].state, __ATOMIC_RELAXED) != SLOT_FREE
+            || !__atomic_compare_exchange_n(&g_slots[i].state, &expected, SLOT_INIT, false,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        THREAD_SLOT* slot = &g_slots[i];
+        slot->tid = static_cast<uint32_t>(syscall(SYS_gettid));
+        slot->arena_id = 0;
+        __atomic_store_n(&slot->state, SLOT_ACTIVE, __ATOMIC_RELEASE);
+        uint32_t end = __atomic_load_n(&g_slot_end, __ATOMIC_RELAXED);
+        while (end < i + 1 && !__atomic_compare_exchange_n(&g_slot_end, &end, i + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+        // 先设置线程局部变量，pthread_setspecific 内部的分配直接计入该槽位
+        t_slot = slot;
+        if (g_slot_key_ready) {
+            pthread_setspecific(g_slot_key, slot);
+        }
+        return slot;
+    }
+    t_no_slot = true;
+    return nullptr;
+}
+
+/**
+ * @brief 获取当前线程的槽位
+ *
+ * @return THREAD_SLOT*
+ */
+inline THREAD_SLOT* get_slot() {
+    THREAD_SLOT* slot = t_slot;
+    if (__builtin_expect(slot != nullptr, 1)) {
+        return slot;
+    }
+    return t_no_slot ? nullptr : register_thread();
+}
+
+/**
+ * @brief 计入一次分配或释放
+ *
+ * @param allocated
+ * @param deallocated
+ */
+inline void record(size_t allocated, size_t deallocated) {
+    THREAD_SLOT* slot = get_slot();
+    if (__builtin_expect(slot != nullptr, 1)) {
+        if (allocated > 0) {
+            counter_add(&slot->allocated, allocated);
+        }
+        if (deallocated > 0) {
+            counter_add(&slot->deallocated, deallocated);
+        }
+        return;
+    }
+    __atomic_fetch_add(&g_other_allocated, allocated, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_other_deallocated, deallocated, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 后台发布
+ *
+ */
+class CMemHookPublisher {
+public:
+    /**
+     * @brief 创建共享内存并启动发布线程
+     *
+     * @param options
+     * @return true
+     * @return false
+     */
+    bool start(const MEM_HOOK_OPTIONS& options) {
+        ARRAY_SHM_OPTIONS shm_options;
+        shm_options.enable_stats = options.enable_stats;
+        if (!array_shm_.init(options.shm_key, g_mem_hook_max_threads + 1, true, shm_options)) {
+            return false;
+        }
+        interval_ms_ = options.interval_ms > 0 ? options.interval_ms : g_mem_hook_interval_ms;
+        nodes_.reserve(g_mem_hook_max_threads + 1);
+        thread_ = std::thread([this]() { run(); });
+        return true;
+    }
+
+    /**
+     * @brief 停止发布线程，停止前发布一次
+     *
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_one();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        flush();
+    }
+
+    /**
+     * @brief 汇总所有槽位后整段发布
+     *
+     * @return int
+     */
+    int flush() {
+        std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+        uint64_t other_allocated = 0;
+        uint64_t other_deallocated = 0;
+        // 不持有 g_slot_lock 扫描，线程退出不需要等待整段扫描；期间有线程退出则重新汇总
+        bool consistent = false;
+        for (uint32_t retry = 0; retry < g_collect_retry && !consistent; ++retry) {
+            uint64_t seq = __atomic_load_n(&g_exit_seq, __ATOMIC_ACQUIRE);
+            if (seq % 2 != 0) {
+                continue;
+            }
+            collect(&other_allocated, &other_deallocated);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            consistent = __atomic_load_n(&g_exit_seq, __ATOMIC_RELAXED) == seq;
+        }
+        if (!consistent) {
+            // 线程频繁退出时加锁汇总，保证能完成
+            pthread_mutex_lock(&g_slot_lock);
+            collect(&other_allocated, &other_deallocated);
+            pthread_mutex_unlock(&g_slot_lock);
+        }
+        if (other_allocated > 0 || other_deallocated > 0) {
+            nodes_.push_back(THREAD_MEM_NODE{0, 0, static_cast<uint32_t>(other_allocated >> 10),
+                static_cast<uint32_t>(other_deallocated >> 10)});
+        }
+        return array_shm_.insert(nodes_);
+    }
+
+private:
+    /**
+     * @brief 汇总曾经占用过的槽位及合并计数
+     *
+     * @param other_allocated
+     * @param other_deallocated
+     */
+    void collect(uint64_t* other_allocated, uint64_t* other_deallocated) {
+        nodes_.clear();
+        uint32_t end = __atomic_load_n(&g_slot_end, __ATOMIC_RELAXED);
+        for (uint32_t i = 0; i < end; ++i) {
+            const THREAD_SLOT& slot = g_slots[i];
+            if (__atomic_load_n(&slot.state, __ATOMIC_ACQUIRE) != SLOT_ACTIVE) {
+                continue;
+            }
+            nodes_.push_back(THREAD_MEM_NODE{slot.tid, __atomic_load_n(&slot.arena_id, __ATOMIC_RELAXED),
+                static_cast<uint32_t>(__atomic_load_n(&slot.allocated, __ATOMIC_RELAXED) >> 10),
+                static_cast<uint32_t>(__atomic_load_n(&slot.deallocated, __ATOMIC_RELAXED) >> 10)});
+        }
+        *other_allocated = __atomic_load_n(&g_other_allocated, __ATOMIC_RELAXED);
+        *other_deallocated = __atomic_load_n(&g_other_deallocated, __ATOMIC_RELAXED);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            cond_.wait_for(lock, std::chrono::milliseconds(interval_ms_));
+            if (stop_) {
+                break;
+            }
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    }
+
+private:
+    CArrayShm<THREAD_MEM_NODE> array_shm_;
+    uint32_t interval_ms_{g_mem_hook_interval_ms};
+    std::vector<THREAD_MEM_NODE> nodes_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_{false};
+    // 发布线程与 mem_hook_flush 互斥
+    std::mutex flush_mutex_;
+};
+
+CMemHookPublisher* g_publisher = nullptr;
+std::mutex g_publisher_mutex;
+
+/**
+ * @brief fork 之前持有所有的锁，保证子进程继承的锁和槽位都处于一致的状态
+ * 加锁顺序与 mem_hook_flush 相同：先 g_publisher_mutex 后 g_slot_lock
+ *
+ */
+void on_fork_prepare() {
+    g_publisher_mutex.lock();
+    pthread_mutex_lock(&g_slot_lock);
+}
+
+/**
+ * @brief fork 之后父进程释放 on_fork_prepare 中加的锁
+ *
+ */
+void on_fork_parent() {
+    pthread_mutex_unlock(&g_slot_lock);
+    g_publisher_mutex.unlock();
+}
+
+/**
+ * @brief fork 之后子进程中只有调用 fork 的线程，其他线程的槽位作废，发布线程也不存在
+ * 子进程中停止发布：继承的发布器挂载的是父进程创建的共享内存，不能继续写入；
+ * 其发布线程不存在，不能 join 也不能析构，直接丢弃。子进程需要统计时以不同的 key 重新调用 mem_hook_start
+ *
+ */
+void on_fork_child() {
+    for (uint32_t i = 0; i < g_mem_hook_max_threads; ++i) {
+        if (&g_slots[i] != t_slot) {
+            g_slots[i].allocated = 0;
+            g_slots[i].deallocated = 0;
+            g_slots[i].state = SLOT_FREE;
+        }
+    }
+    // 锁由 on_fork_prepare 中的本线程持有，在子进程中由同一线程释放
+    pthread_mutex_unlock(&g_slot_lock);
+    g_publisher = nullptr;
+    g_publisher_mutex.unlock();
+}
+
+/**
+ * @brief 读取数值型的环境变量，支持 0x 前缀
+ *
+ * @param name
+ * @param val
+ * @return true
+ * @return false 未设置
+ */
+bool get_env_num(const char* name, uint64_t* val) {
+    const char* str = getenv(name);
+    if (str == nullptr || *str == '\0') {
+        return false;
+    }
+    *val = strtoull(str, nullptr, 0);
+    return true;
+}
+
+}  // namespace
+
+bool mem_hook_start(const MEM_HOOK_OPTIONS& options) {
+    std::lock_guard<std::mutex> lock(g_publisher_mutex);
+    if (g_publisher != nullptr) {
+        return false;
+    }
+    CMemHookPublisher* publisher = new CMemHookPublisher();
+    if (!publisher->start(options)) {
+        delete publisher;
+        return false;
+    }
+    g_publisher = publisher;
+    return true;
+}
+
+void mem_hook_stop() {
+    std::lock_guard<std::mutex> lock(g_publisher_mutex);
+    if (g_publisher != nullptr) {
+        g_publisher->stop();
+        delete g_publisher;
+        g_publisher = nullptr;
+    }
+}
+
+int mem_hook_flush() {
+    std::lock_guard<std::mutex> lock(g_publisher_mutex);
+    return g_publisher != nullptr ? g_publisher->flush() : -1;
+}
+
+void mem_hook_record_alloc(size_t size) {
+    record(size, 0);
+}
+
+void mem_hook_record_free(size_t size) {
+    record(0, size);
+}
+
+void mem_hook_set_arena(uint32_t arena_id) {
+    THREAD_SLOT* slot = get_slot();
+    if (slot != nullptr) {
+        __atomic_store_n(&slot->arena_id, arena_id, __ATOMIC_RELAXED);
+    }
+}
+
+}  // namespace thread_mem_shm_sdk
+
+namespace {
+
+using thread_mem_shm_sdk::MEM_HOOK_OPTIONS;
+
+#ifndef ZY_MEM_HOOK_NO_INTERPOSE
+
+// 下一个分配器的函数
+struct REAL_FUNCS {
+    void* (*malloc)(size_t);
+    void (*free)(void*);
+    void* (*calloc)(size_t, size_t);
+    void* (*realloc)(void*, size_t);
+    void* (*memalign)(size_t, size_t);
+    int (*posix_memalign)(void**, size_t, size_t);
+    void* (*aligned_alloc)(size_t, size_t);
+    void* (*valloc)(size_t);
+    void* (*pvalloc)(size_t);
+    size_t (*usable_size)(void*);
+};
+
+REAL_FUNCS g_real;
+bool g_real_ready = false;
+bool g_resolving = false;
+
+// dlsym 查找期间（分配器函数尚不可用）使用的静态内存，只分配不回收
+alignas(64) char g_boot_buf[64 * 1024];
+size_t g_boot_used = 0;
+
+/**
+ * @brief 从静态内存中分配
+ *
+ * @param size
+ * @return void*
+ */
+void* boot_alloc(size_t size) {
+    size = (size + 15) / 16 * 16;
+    size_t used = __atomic_fetch_add(&g_boot_used, size, __ATOMIC_RELAXED);
+    if (used + size > sizeof(g_boot_buf)) {
+        return nullptr;
+    }
+    return g_boot_buf + used;
+}
+
+inline bool is_boot_ptr(void* ptr) {
+    return ptr >= g_boot_buf && ptr < g_boot_buf + sizeof(g_boot_buf);
+}
+
+/**
+ * @brief 查找下一个分配器的函数，dlsym 内部的分配使用静态内存
+ *
+ */
+void resolve_real_funcs() {
+    if (g_real_ready || g_resolving) {
+        return;
+    }
+    g_resolving = true;
+    REAL_FUNCS real;
+    real.malloc = reinterpret_cast<void* (*)(size_t)>(dlsym(RTLD_NEXT, "malloc"));
+    real.free = reinterpret_cast<void (*)(void*)>(dlsym(RTLD_NEXT, "free"));
+    real.calloc = reinterpret_cast<void* (*)(size_t, size_t)>(dlsym(RTLD_NEXT, "calloc"));
+    real.realloc = reinterpret_cast<void* (*)(void*, size_t)>(dlsym(RTLD_NEXT, "realloc"));
+    real.memalign = reinterpret_cast<void* (*)(size_t, size_t)>(dlsym(RTLD_NEXT, "memalign"));
+    real.posix_memalign = reinterpret_cast<int (*)(void**, size_t, size_t)>(dlsym(RTLD_NEXT, "posix_memalign"));
+    real.aligned_alloc = reinterpret_cast<void* (*)(size_t, size_t)>(dlsym(RTLD_NEXT, "aligned_alloc"));
+    real.valloc = reinterpret_cast<void* (*)(size_t)>(dlsym(RTLD_NEXT, "valloc"));
+    real.pvalloc = reinterpret_cast<void* (*)(size_t)>(dlsym(RTLD_NEXT, "pvalloc"));
+    real.usable_size = reinterpret_cast<size_t (*)(void*)>(dlsym(RTLD_NEXT, "malloc_usable_size"));
+    g_real = real;
+    g_real_ready = true;
+    g_resolving = false;
+}
+
+/**
+ * @brief 计入一次分配
+ *
+ * @param ptr
+ */
+inline void on_alloc(void* ptr) {
+    if (ptr != nullptr && g_real.usable_size != nullptr) {
+        thread_mem_shm_sdk::record(g_real.usable_size(ptr), 0);
+    }
+}
+
+/**
+ * @brief 计入一次释放
+ *
+ * @param ptr
+ */
+inline void on_free(void* ptr) {
+    if (ptr != nullptr && g_real.usable_size != nullptr) {
+        thread_mem_shm_sdk::record(0, g_real.usable_size(ptr));
+    }
+}
+
+#define ZY_MEM_HOOK_RESOLVE(boot_expr)        \
+    if (__builtin_expect(!g_real_ready, 0)) { \
+        resolve_real_funcs();                 \
+        if (!g_real_ready) {                  \
+            return boot_expr;                 \
+        }                                     \
+    }
+
+#endif  // ZY_MEM_HOOK_NO_INTERPOSE
+
+/**
+ * @brief 加载时创建线程退出的回调，设置了环境变量时启动发布
+ *
+ */
+__attribute__((constructor)) void mem_hook_init() {
+#ifndef ZY_MEM_HOOK_NO_INTERPOSE
+    resolve_real_funcs();
+#endif
+    if (pthread_key_create(&thread_mem_shm_sdk::g_slot_key, thread_mem_shm_sdk::on_thread_exit) == 0) {
+        thread_mem_shm_sdk::g_slot_key_ready = true;
+    }
+    pthread_atfork(thread_mem_shm_sdk::on_fork_prepare, thread_mem_shm_sdk::on_fork_parent,
+        thread_mem_shm_sdk::on_fork_child);
+    uint64_t shm_key = 0;
+    if (!thread_mem_shm_sdk::get_env_num("ZY_MEM_HOOK_SHM_KEY", &shm_key)) {
+        return;
+    }
+    MEM_HOOK_OPTIONS options;
+    options.shm_key = shm_key;
+    uint64_t val = 0;
+    if (thread_mem_shm_sdk::get_env_num("ZY_MEM_HOOK_KEY_PER_PID", &val) && val != 0) {
+        options.shm_key += getpid();
+    }
+    if (thread_mem_shm_sdk::get_env_num("ZY_MEM_HOOK_INTERVAL_MS", &val)) {
+        options.interval_ms = static_cast<uint32_t>(val);
+    }
+    thread_mem_shm_sdk::mem_hook_start(options);
+}
+
+/**
+ * @brief 卸载时停止发布，最后发布一次
+ *
+ */
+__attribute__((destructor)) void mem_hook_fini() {
+    thread_mem_shm_sdk::mem_hook_stop();
+}
+
+}  // namespace
+
+#ifndef ZY_MEM_HOOK_NO_INTERPOSE
+
+extern "C" {
+
+void* malloc(size_t size) {
+    ZY_MEM_HOOK_RESOLVE(boot_alloc(size));
+    void* ptr = g_real.malloc(size);
+    on_alloc(ptr);
+    return ptr;
+}
+
+void free(void* ptr) {
+    if (ptr == nullptr || is_boot_ptr(ptr)) {
+        return;
+    }
+    ZY_MEM_HOOK_RESOLVE();
+    on_free(ptr);
+    g_real.free(ptr);
+}
+
+void* calloc(size_t count, size_t size) {
+    if (__builtin_expect(!g_real_ready, 0)) {
+        resolve_real_funcs();
+        if (!g_real_ready) {
+            // 静态内存本身为零
+            return size != 0 && count > SIZE_MAX / size ? nullptr : boot_alloc(count * size);
+        }
+    }
+    void* ptr = g_real.calloc(count, size);
+    on_alloc(ptr);
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    ZY_MEM_HOOK_RESOLVE(boot_alloc(size));
+    if (is_boot_ptr(ptr)) {
+        // 静态内存不知道原长度，按剩余空间拷贝
+        void* new_ptr = malloc(size);
+        if (new_ptr != nullptr) {
+            size_t avail = g_boot_buf + sizeof(g_boot_buf) - static_cast<char*>(ptr);
+            memcpy(new_ptr, ptr, size < avail ? size : avail);
+        }
+        return new_ptr;
+    }
+    size_t old_size = (ptr != nullptr && g_real.usable_size != nullptr) ? g_real.usable_size(ptr) : 0;
+    void* new_ptr = g_real.realloc(ptr, size);
+    // 失败时原内存不变；size 为 0 时原内存被释放
+    if (new_ptr != nullptr || size == 0) {
+        thread_mem_shm_sdk::record(0, old_size);
+        on_alloc(new_ptr);
+    }
+    return new_ptr;
+}
+
+void* reallocarray(void* ptr, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return realloc(ptr, count * size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    ZY_MEM_HOOK_RESOLVE(nullptr);
+    void* ptr = g_real.memalign(alignment, size);
+    on_alloc(ptr);
+    return ptr;
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    ZY_MEM_HOOK_RESOLVE(ENOMEM);
+    int res = g_real.posix_memalign(ptr, alignment, size);
+    if (res == 0) {
+        on_alloc(*ptr);
+    }
+    return res;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    ZY_MEM_HOOK_RESOLVE(nullptr);
+    void* ptr = g_real.aligned_alloc(alignment, size);
+    on_alloc(ptr);
+    return ptr;
+}
+
+void* valloc(size_t size) {
+    ZY_MEM_HOOK_RESOLVE(nullptr);
+    void* ptr = g_real.valloc(size);
+    on_alloc(ptr);
+    return ptr;
+}
+
+void* pvalloc(size_t size) {
+    ZY_MEM_HOOK_RESOLVE(nullptr);
+    void* ptr = g_real.pvalloc(size);
+    on_alloc(ptr);
+    return ptr;
+}
+
+}  // extern "C"
+
+#endif  // ZY_MEM_HOOK_NO_INTERPOSE
@@ -10,15 +10,26 @@
 
 #pragma once
 
+#include <sched.h>
 #include <stdint.h>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include "zy_base_shm.h"
+#include "zy_shm_clock.h"
+#include "zy_shm_copy.h"
+#include "zy_shm_index.h"
+#include "zy_shm_readers.h"
+#include "zy_shm_stats.h"
 #include "zy_utils.h"
 
 namespace thread_mem_shm_sdk {
 
-// 全局的内存格式版本
-const uint32_t g_shm_version = 0xFFFFFF01;
+// 全局的内存格式版本，和节点、头部的布局一起生成布局指纹，作为共享内存头部中的 version
+const uint32_t g_shm_version = 0xFFFFFF0A;
+// 布局指纹的高 8 位固定为魔数，观察工具据此识别 SDK 的共享内存
+const uint32_t g_shm_version_magic = 0xFF000000;
+const uint32_t g_shm_version_magic_mask = 0xFF000000;
 
 // 内存头数组
 struct ARRAY_SHM_HEADER {
@@ -26,24 +37,448 @@ struct ARRAY_SHM_HEADER {
     uint32_t cur_node_count;
     uint32_t max_node_count;
     uint32_t header_crc_val;
+    // 发布时间，时钟源的原始读数，按 clock 换算为系统时间
     uint64_t time_ns;
+    // 发布代数，每次 insert 加一，用于识别新的一次发布
+    uint64_t generation;
+    // 特性标记，见 ARRAY_SHM_FLAG_*
+    uint32_t flags;
+    // 单个节点的大小，不知道节点类型的观察工具据此计算内存布局
+    uint32_t node_size;
+    // 发布时间的时钟源及换算参数
+    SHM_CLOCK_CALIB clock;
+    // 多缓冲模式下当前发布的缓冲区
+    uint32_t active_buffer;
+    uint32_t reserved;
+};
+
+// 共享内存尾部带有统计块 SHM_STATS
+const uint32_t ARRAY_SHM_FLAG_STATS = 0x1;
+// 崩溃安全发布，多缓冲之后带有提交字和两份头部记录
+const uint32_t ARRAY_SHM_FLAG_CRASH_SAFE = 0x2;
+// flags 中记录有序索引个数的位，索引位于统计块之后
+const uint32_t ARRAY_SHM_INDEX_SHIFT = 8;
+const uint32_t ARRAY_SHM_INDEX_MASK = 0xF00;
+// flags 中记录缓冲区个数的位，为 0 或 1 表示单缓冲
+const uint32_t ARRAY_SHM_BUFFER_SHIFT = 12;
+const uint32_t ARRAY_SHM_BUFFER_MASK = 0xF000;
+// flags 中记录读者槽位个数的位，读者表位于共享内存的最后
+const uint32_t ARRAY_SHM_READER_SHIFT = 16;
+const uint32_t ARRAY_SHM_READER_MASK = 0xFF0000;
+
+// 最多支持的缓冲区个数
+const uint32_t g_shm_max_buffer_count = 8;
+// 所有缓冲区都被读者占用时，写者等待的最长时间
+const uint64_t g_shm_buffer_wait_timeout_ns = 1000000000ULL;
+// 读者占用缓冲区时因并发发布而重试的最多次数
+const uint32_t g_shm_buffer_max_retry = 1000;
+// 多缓冲时未指定读者槽位个数的默认值
+const uint32_t g_shm_buffer_reader_count = 16;
+
+// 多缓冲模式下每个缓冲区的读者计数，各占一个缓存行，只通过原子操作访问
+struct alignas(64) SHM_BUFFER_PIN {
+    uint32_t pin_count;
+};
+
+// 崩溃安全模式下的提交字，其后是按发布代数奇偶交替写入的两份头部记录
+struct alignas(64) SHM_COMMIT_WORD {
+    // 高 32 位为发布代数的低 32 位，低 32 位为该代头部记录的 CRC，写者以一次原子存储提交
+    uint64_t commit;
+};
+
+// 数组共享内存的可选项
+struct ARRAY_SHM_OPTIONS : public SHM_OPTIONS {
+    // 创建时在共享内存尾部附加统计块，要求头部有 flags 字段
+    bool enable_stats = false;
+    // 发布时间的时钟源，非 SHM_CLOCK_REALTIME 时要求头部有 clock 字段，
+    // 每个写者按自己的选项设置，不受已存在共享内存的影响
+    SHM_CLOCK_TYPE clock_type = SHM_CLOCK_REALTIME;
+    // clock_type 为 SHM_CLOCK_USER 时的时钟
+    SHM_CLOCK_FUNC clock_func = nullptr;
+    // 发布的数据不小于该长度时使用非临时存储，SIZE_MAX 表示从不使用
+    size_t nt_store_threshold = g_shm_nt_store_threshold;
+    // 有序索引个数，最多 g_shm_max_index_count 个，要求头部有 flags 字段，
+    // 写者通过 CArrayShm::set_index_key 设置每个索引的 key
+    uint32_t index_count = 0;
+    // 缓冲区个数，最多 g_shm_max_buffer_count 个，大于 1 时写者写入未发布的缓冲区后切换 active_buffer，
+    // 读者遍历期间占用所在的缓冲区，不需要加锁；要求头部有 flags、active_buffer、crc、generation 字段，
+    // 不能和有序索引同时使用。占用记录在读者槽位中，退出的读者占用的缓冲区由回收归还，
+    // 因此总是带读者表（未指定 reader_count 时为 g_shm_buffer_reader_count 个槽位），
+    // 读者必须占用槽位（忽略 register_reader），也不能以只读方式挂载
+    uint32_t buffer_count = 1;
+    // 读者槽位个数，最多 g_shm_max_reader_count 个，要求头部有 flags、generation 字段；
+    // 非创建的挂载在 init 时占用一个槽位并在遍历时记录读取的发布代数，不能以只读方式挂载
+    uint32_t reader_count = 0;
+    // 挂载带读者表的共享内存时是否占用槽位，只看头部和读者状态的观察者设置为 false；多缓冲时忽略，读者总是占用槽位
+    bool register_reader = true;
+    // 崩溃安全发布，缓冲区个数至少为 2，要求头部有 flags、active_buffer、crc、generation 字段：
+    // 写者写完未发布的缓冲区和头部记录后，以一次原子存储提交（代数，头部 CRC），读者只认提交字指向的记录，
+    // 写者在任意位置退出都不会让读者看到写了一半的数据，也不需要信号量的 SEM_UNDO
+    bool crash_safe = false;
 };
 
 /**
- * @brief 数组格式的共享内存
+ * 头部策略：CArrayShm 的头部类型可以由使用者自定义，只需要包含 uint32_t 的
+ * version、cur_node_count、max_node_count 三个字段，其余字段按需选择，编译期检测，
+ * 没有的字段不会产生任何开销：
+ * header_crc_val（头部 CRC 校验）、time_ns（发布时间）、generation（发布代数）、
+ * flags（特性标记，统计块等依赖此字段）、node_size（节点大小）、
+ * clock（时钟换算参数，没有该字段时 time_ns 为系统时间）、active_buffer（多缓冲模式下当前发布的缓冲区）
+ */
+template <class TH, class = void>
+struct header_has_crc : std::false_type {};
+template <class TH>
+struct header_has_crc<TH, decltype(void(std::declval<TH&>().header_crc_val))> : std::true_type {};
+
+template <class TH, class = void>
+struct header_has_time : std::false_type {};
+template <class TH>
+struct header_has_time<TH, decltype(void(std::declval<TH&>().time_ns))> : std::true_type {};
+
+template <class TH, class = void>
+struct header_has_generation : std::false_type {};
+template <class TH>
+struct header_has_generation<TH, decltype(void(std::declval<TH&>().generation))> : std::true_type {};
+
+template <class TH, class = void>
+struct header_has_flags : std::false_type {};
+template <class TH>
+struct header_has_flags<TH, decltype(void(std::declval<TH&>().flags))> : std::true_type {};
+
+template <class TH, class = void>
+struct header_has_node_size : std::false_type {};
+template <class TH>
+struct header_has_node_size<TH, decltype(void(std::declval<TH&>().node_size))> : std::true_type {};
+
+template <class TH, class = void>
+struct header_has_clock : std::false_type {};
+template <class TH>
+struct header_has_clock<TH, decltype(void(std::declval<TH&>().clock))> : std::true_type {};
+
+template <class TH, class = void>
+struct header_has_active_buffer : std::false_type {};
+template <class TH>
+struct header_has_active_buffer<TH, decltype(void(std::declval<TH&>().active_buffer))> : std::true_type {};
+
+/**
+ * @brief 头部中发布时间对应的系统时间（纳秒）
+ * 
+ * @tparam TH 
+ * @param header 
+ * @return uint64_t 
+ */
+template <class TH>
+inline uint64_t array_shm_wall_time_ns(const TH& header) {
+    if constexpr (header_has_clock<TH>::value) {
+        return shm_clock_to_wall_ns(header.clock, header.time_ns);
+    } else {
+        return header.time_ns;
+    }
+}
+
+/**
+ * @brief 头部中的发布时间距今的时间（纳秒）
+ * 
+ * @tparam TH 
+ * @param header 
+ * @return uint64_t 
+ */
+template <class TH>
+inline uint64_t array_shm_age_ns(const TH& header) {
+    if constexpr (header_has_clock<TH>::value) {
+        return shm_clock_age_ns(header.clock, header.time_ns);
+    } else {
+        uint64_t now_ns = get_now_system_time_ns();
+        return now_ns > header.time_ns ? now_ns - header.time_ns : 0;
+    }
+}
+
+/**
+ * @brief 布局指纹的哈希（FNV-1a），编译期计算
+ * 
+ * @param hash 
+ * @param val 
+ * @return uint32_t 
+ */
+constexpr uint32_t layout_hash(uint32_t hash, uint64_t val) {
+    for (int i = 0; i < 8; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(val >> (i * 8))) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief 布局指纹，由格式版本、节点及头部的大小和对齐、头部包含的可选字段生成
+ * 写者和读者的布局不一致时挂载会因 version 校验失败而拒绝
  * 
  * @tparam T 
+ * @tparam TH 
+ * @return uint32_t 
+ */
+template <class T, class TH>
+constexpr uint32_t array_shm_layout_version() {
+    uint32_t hash = 2166136261u;
+    hash = layout_hash(hash, g_shm_version);
+    hash = layout_hash(hash, sizeof(T));
+    hash = layout_hash(hash, alignof(T));
+    hash = layout_hash(hash, sizeof(TH));
+    hash = layout_hash(hash, alignof(TH));
+    hash = layout_hash(hash, (header_has_crc<TH>::value ? 0x1 : 0) | (header_has_time<TH>::value ? 0x2 : 0)
+        | (header_has_generation<TH>::value ? 0x4 : 0) | (header_has_flags<TH>::value ? 0x8 : 0)
+        | (header_has_node_size<TH>::value ? 0x10 : 0) | (header_has_clock<TH>::value ? 0x20 : 0)
+        | (header_has_active_buffer<TH>::value ? 0x40 : 0));
+    return g_shm_version_magic | (hash & ~g_shm_version_magic_mask);
+}
+
+/**
+ * @brief 获取 flags 中记录的缓冲区个数，未开启多缓冲时为 1
+ * 
+ * @param flags 
+ * @return uint32_t 
+ */
+inline uint32_t array_shm_buffer_count(uint32_t flags) {
+    uint32_t buffer_count = (flags & ARRAY_SHM_BUFFER_MASK) >> ARRAY_SHM_BUFFER_SHIFT;
+    return buffer_count > 1 ? buffer_count : 1;
+}
+
+/**
+ * @brief 获取 flags 中记录的有序索引个数
+ * 
+ * @param flags 
+ * @return uint32_t 
+ */
+inline uint32_t array_shm_index_count(uint32_t flags) {
+    return (flags & ARRAY_SHM_INDEX_MASK) >> ARRAY_SHM_INDEX_SHIFT;
+}
+
+/**
+ * @brief 获取 flags 中记录的读者槽位个数
+ * 
+ * @param flags 
+ * @return uint32_t 
+ */
+inline uint32_t array_shm_reader_count(uint32_t flags) {
+    return (flags & ARRAY_SHM_READER_MASK) >> ARRAY_SHM_READER_SHIFT;
+}
+
+/**
+ * @brief 计算多缓冲读者计数相对共享内存起始的偏移，位于所有缓冲区之后
+ * 
+ * @tparam TH 
+ * @param max_node_count 
+ * @param node_size 
+ * @param flags 
+ * @return size_t 
+ */
+template <class TH>
+inline size_t array_shm_pin_offset(size_t max_node_count, size_t node_size, uint32_t flags) {
+    size_t offset = sizeof(TH) + array_shm_buffer_count(flags) * max_node_count * node_size;
+    return (offset + alignof(SHM_BUFFER_PIN) - 1) / alignof(SHM_BUFFER_PIN) * alignof(SHM_BUFFER_PIN);
+}
+
+/**
+ * @brief 计算崩溃安全模式下提交字相对共享内存起始的偏移，位于多缓冲读者计数之后
+ * 
+ * @tparam TH 
+ * @param max_node_count 
+ * @param node_size 
+ * @param flags 
+ * @return size_t 
  */
-template <class T>
-class CArrayShm : public CShm<T, ARRAY_SHM_HEADER> {
+template <class TH>
+inline size_t array_shm_commit_offset(size_t max_node_count, size_t node_size, uint32_t flags) {
+    return array_shm_pin_offset<TH>(max_node_count, node_size, flags)
+        + array_shm_buffer_count(flags) * sizeof(SHM_BUFFER_PIN);
+}
+
+/**
+ * @brief 计算所有缓冲区（及多缓冲读者计数、提交记录）结束的偏移
+ * 
+ * @tparam TH 
+ * @param max_node_count 
+ * @param node_size 
+ * @param flags 
+ * @return size_t 
+ */
+template <class TH>
+inline size_t array_shm_body_end(size_t max_node_count, size_t node_size, uint32_t flags) {
+    uint32_t buffer_count = array_shm_buffer_count(flags);
+    if (flags & ARRAY_SHM_FLAG_CRASH_SAFE) {
+        return array_shm_commit_offset<TH>(max_node_count, node_size, flags) + sizeof(SHM_COMMIT_WORD)
+            + 2 * sizeof(TH);
+    }
+    if (buffer_count > 1) {
+        return array_shm_pin_offset<TH>(max_node_count, node_size, flags) + buffer_count * sizeof(SHM_BUFFER_PIN);
+    }
+    return sizeof(TH) + max_node_count * node_size;
+}
+
+/**
+ * @brief 计算统计块相对共享内存起始的偏移
+ * 
+ * @tparam TH 
+ * @param max_node_count 
+ * @param node_size 
+ * @param flags 
+ * @return size_t 
+ */
+template <class TH>
+inline size_t array_shm_stats_offset(size_t max_node_count, size_t node_size, uint32_t flags) {
+    size_t offset = array_shm_body_end<TH>(max_node_count, node_size, flags);
+    return (offset + alignof(SHM_STATS) - 1) / alignof(SHM_STATS) * alignof(SHM_STATS);
+}
+
+/**
+ * @brief 计算第一个有序索引相对共享内存起始的偏移
+ * 
+ * @tparam TH 
+ * @param max_node_count 
+ * @param node_size 
+ * @param flags 
+ * @return size_t 
+ */
+template <class TH>
+inline size_t array_shm_index_offset(size_t max_node_count, size_t node_size, uint32_t flags) {
+    size_t offset = array_shm_body_end<TH>(max_node_count, node_size, flags);
+    if (flags & ARRAY_SHM_FLAG_STATS) {
+        offset = array_shm_stats_offset<TH>(max_node_count, node_size, flags) + sizeof(SHM_STATS);
+    }
+    return (offset + alignof(SHM_INDEX_HEADER) - 1) / alignof(SHM_INDEX_HEADER) * alignof(SHM_INDEX_HEADER);
+}
+
+/**
+ * @brief 计算节点、统计块和有序索引结束的偏移
+ * 
+ * @tparam TH 
+ * @param max_node_count 
+ * @param node_size 
+ * @param flags 
+ * @return size_t 
+ */
+template <class TH>
+inline size_t array_shm_data_end(size_t max_node_count, size_t node_size, uint32_t flags) {
+    uint32_t index_count = array_shm_index_count(flags);
+    if (index_count > 0) {
+        return array_shm_index_offset<TH>(max_node_count, node_size, flags)
+            + index_count * shm_index_length(max_node_count);
+    }
+    if (flags & ARRAY_SHM_FLAG_STATS) {
+        return array_shm_stats_offset<TH>(max_node_count, node_size, flags) + sizeof(SHM_STATS);
+    }
+    return array_shm_body_end<TH>(max_node_count, node_size, flags);
+}
+
+/**
+ * @brief 计算读者表相对共享内存起始的偏移
+ * 
+ * @tparam TH 
+ * @param max_node_count 
+ * @param node_size 
+ * @param flags 
+ * @return size_t 
+ */
+template <class TH>
+inline size_t array_shm_reader_offset(size_t max_node_count, size_t node_size, uint32_t flags) {
+    size_t offset = array_shm_data_end<TH>(max_node_count, node_size, flags);
+    return (offset + alignof(SHM_READER_SLOT) - 1) / alignof(SHM_READER_SLOT) * alignof(SHM_READER_SLOT);
+}
+
+/**
+ * @brief 计算整个共享内存的长度
+ * 
+ * @tparam TH 
+ * @param max_node_count 
+ * @param node_size 
+ * @param flags 
+ * @return size_t 
+ */
+template <class TH>
+inline size_t array_shm_length(size_t max_node_count, size_t node_size, uint32_t flags) {
+    uint32_t reader_count = array_shm_reader_count(flags);
+    if (reader_count > 0) {
+        return array_shm_reader_offset<TH>(max_node_count, node_size, flags) + reader_count * sizeof(SHM_READER_SLOT);
+    }
+    return array_shm_data_end<TH>(max_node_count, node_size, flags);
+}
+
+/**
+ * @brief 根据默认头部计算统计块相对共享内存起始的偏移
+ * 
+ * @param header 
+ * @return size_t 
+ */
+inline size_t array_shm_stats_offset(const ARRAY_SHM_HEADER& header) {
+    return array_shm_stats_offset<ARRAY_SHM_HEADER>(header.max_node_count, header.node_size, header.flags);
+}
+
+/**
+ * @brief 根据默认头部计算读者表相对共享内存起始的偏移
+ * 
+ * @param header 
+ * @return size_t 
+ */
+inline size_t array_shm_reader_offset(const ARRAY_SHM_HEADER& header) {
+    return array_shm_reader_offset<ARRAY_SHM_HEADER>(header.max_node_count, header.node_size, header.flags);
+}
+
+/**
+ * @brief 根据默认头部计算整个共享内存的长度
+ * 
+ * @param header 
+ * @return size_t 
+ */
+inline size_t array_shm_length(const ARRAY_SHM_HEADER& header) {
+    return array_shm_length<ARRAY_SHM_HEADER>(header.max_node_count, header.node_size, header.flags);
+}
+
+/**
+ * @brief 校验默认头部的魔数和 CRC，不关心节点类型
+ * 
+ * @param header 
+ * @return true 
+ * @return false 
+ */
+inline bool array_shm_check_header(const ARRAY_SHM_HEADER& header) {
+    if ((header.version & g_shm_version_magic_mask) != g_shm_version_magic) {
+        return false;
+    }
+    ARRAY_SHM_HEADER tmp;
+    memcpy(&tmp, &header, sizeof(ARRAY_SHM_HEADER));
+    tmp.header_crc_val = 0;
+    return calc_crc_val(reinterpret_cast<const uint8_t*>(&tmp), sizeof(ARRAY_SHM_HEADER)) == header.header_crc_val;
+}
+
+/**
+ * @brief 数组格式的共享内存
+ * 
+ * @tparam T 节点类型，必须可平凡拷贝
+ * @tparam TH 头部类型，见上方头部策略说明
+ */
+template <class T, class TH = ARRAY_SHM_HEADER>
+class CArrayShm : public CShm<T, TH, CArrayShm<T, TH>> {
+    using BASE = CShm<T, TH, CArrayShm<T, TH>>;
+    friend BASE;
+
+    static_assert(std::is_same<decltype(TH::version), uint32_t>::value
+        && std::is_same<decltype(TH::cur_node_count), uint32_t>::value
+        && std::is_same<decltype(TH::max_node_count), uint32_t>::value,
+        "header type must have uint32_t version, cur_node_count and max_node_count");
+    static_assert(sizeof(TH) % alignof(T) == 0, "nodes following the header must be suitably aligned");
+
 public:
-    using TRAVERSE_METHOD_FUNC = typename CShm<T, ARRAY_SHM_HEADER>::TRAVERSE_METHOD_FUNC;
+    using TRAVERSE_METHOD_FUNC = typename BASE::TRAVERSE_METHOD_FUNC;
+    // 布局指纹
+    static constexpr uint32_t LAYOUT_VERSION = array_shm_layout_version<T, TH>();
+    // 有序索引的 key
+    using INDEX_KEY_FUNC = uint64_t (*)(const T& node);
 
 public:
     CArrayShm() {
-        memset(&array_header_, 0, sizeof(ARRAY_SHM_HEADER));
+        memset(&array_header_, 0, sizeof(TH));
+    }
+    ~CArrayShm() {
+        unregister_reader();
     }
-    ~CArrayShm() = default;
     CArrayShm(const CArrayShm&) = delete;
     CArrayShm& operator=(const CArrayShm&) = delete;
     CArrayShm(CArrayShm&&) = delete;
@@ -56,188 +491,1404 @@ public:
      * 1. 创建时，init(shm_key, node_count, true) ==> 如果存在该内存会优先选择 attach，没有才会 create
      * 2. 挂载时，init(shm_key)
      * 
-     * @param shm_key 
-     * @param node_count 
-     * @param is_create 
-     * @return true 
-     * @return false 
+     * @param shm_key 
+     * @param node_count 
+     * @param is_create 
+     * @param options 仅在创建时生效，挂载时以共享内存头部中的记录为准
+     * @return true 
+     * @return false 
+     */
+    bool init(size_t shm_key, size_t node_count = 0, bool is_create = false,
+        const ARRAY_SHM_OPTIONS& options = ARRAY_SHM_OPTIONS());
+
+    /**
+     * @brief 在一段已挂载的内存上初始化，不调用 shmget/shmat，用于注册表中分配的数组
+     * 
+     * @param addr 
+     * @param capacity 这段内存的长度，创建时不能小于 calc_length
+     * @param node_count 
+     * @param is_create 
+     * @param options 
+     * @return true 
+     * @return false 
+     */
+    bool init_in_place(void* addr, size_t capacity, size_t node_count = 0, bool is_create = false,
+        const ARRAY_SHM_OPTIONS& options = ARRAY_SHM_OPTIONS());
+
+    /**
+     * @brief 写者重启后在一段已初始化的内存上重新挂载，不改写头部，不占用读者槽位
+     * 与 init 以 is_create=true 挂载已存在的共享内存相同，崩溃安全模式下会丢弃上一个写者未提交的发布
+     * 
+     * @param addr 
+     * @param capacity 这段内存的长度
+     * @param options 
+     * @return true 
+     * @return false 
+     */
+    bool reopen_in_place(void* addr, size_t capacity, const ARRAY_SHM_OPTIONS& options = ARRAY_SHM_OPTIONS());
+
+    /**
+     * @brief 按选项计算整个共享内存的长度
+     * 
+     * @param max_node_count 
+     * @param options 
+     * @return size_t 
+     */
+    static size_t calc_length(size_t max_node_count, const ARRAY_SHM_OPTIONS& options = ARRAY_SHM_OPTIONS());
+
+    /**
+     * @brief 获取布局指纹，即头部中的 version
+     * 
+     * @return uint32_t 
+     */
+    static constexpr uint32_t get_layout_version() { return LAYOUT_VERSION; }
+
+    /**
+     * @brief 顺序插入节点
+     * 
+     * @param node_vec 
+     * @return int 写入的节点个数，出错返回 -1
+     */
+    int insert(const std::vector<T>& node_vec) {
+        return insert(node_vec.data(), node_vec.size());
+    }
+
+    /**
+     * @brief 整段插入连续的节点，超过 max_node_count 的部分被丢弃
+     * 长度达到 ARRAY_SHM_OPTIONS::nt_store_threshold 时使用非临时存储，不污染写者的缓存
+     * 
+     * @param nodes 
+     * @param count 
+     * @return int 写入的节点个数，出错返回 -1
+     */
+    int insert(const T* nodes, size_t count);
+
+    /**
+     * @brief 遍历共享内存，对每个节点调用回调函数处理
+     * 回调可以是函数指针或任意可调用对象（lambda 可以捕获），编译期展开，可以内联
+     * 
+     * @tparam F 形如 bool(T* node)
+     * @param node_func 
+     * @return true 
+     * @return false 
+     */
+    template <class F>
+    bool traverse(F&& node_func);
+
+    /**
+     * @brief 遍历共享内存，同时预取后续节点，适合节点较多、超出缓存的场景
+     * 
+     * @tparam F 形如 bool(T* node)
+     * @param node_func 
+     * @return true 
+     * @return false 
+     */
+    template <class F>
+    bool traverse_prefetch(F&& node_func) {
+        return do_traverse<true>(std::forward<F>(node_func));
+    }
+
+    /**
+     * @brief 获取头部数据
+     * 
+     * @param header 
+     * @return true 
+     * @return false 
+     */
+    bool get_header(TH* header);
+
+    /**
+     * @brief 拷贝一份当前的快照（头部 + 所有有效节点），节点按连续内存整体拷贝
+     * 
+     * @param header 
+     * @param node_vec 
+     * @return true 
+     * @return false 
+     */
+    bool snapshot(TH* header, std::vector<T>* node_vec);
+
+    /**
+     * @brief 获取共享内存中的统计块，未开启统计时返回 nullptr
+     * 其他进程挂载后即可无锁读取，也可以将其设置给 CSemaphore 以统计加锁等待
+     * 
+     * @return SHM_STATS* 
+     */
+    SHM_STATS* get_stats() const { return p_stats_; }
+
+    /**
+     * @brief 获取写入发布时间使用的时钟源（TSC 不可用时退化为 SHM_CLOCK_MONOTONIC）
+     * 
+     * @return SHM_CLOCK_TYPE 
+     */
+    SHM_CLOCK_TYPE get_clock_type() const { return clock_.get_type(); }
+
+    /**
+     * @brief 获取最多能容纳的节点个数
+     * 
+     * @return size_t 
+     */
+    size_t get_max_node_count() const { return array_header_.max_node_count; }
+
+    /**
+     * @brief 设置有序索引的 key，写者在 init 之后、第一次 insert 之前设置，未设置的索引不可用
+     * 
+     * @param index_id 
+     * @param key_func 
+     * @return true 
+     * @return false 
+     */
+    bool set_index_key(uint32_t index_id, INDEX_KEY_FUNC key_func);
+
+    /**
+     * @brief 获取有序索引的个数
+     * 
+     * @return uint32_t 
+     */
+    uint32_t get_index_count() const { return array_shm_index_count(get_flags(array_header_)); }
+
+    /**
+     * @brief 获取缓冲区个数，单缓冲为 1
+     * 
+     * @return uint32_t 
+     */
+    uint32_t get_buffer_count() const { return buffer_count_; }
+
+    /**
+     * @brief 崩溃安全模式下，写者挂载时是否发现并丢弃了上一个写者在发布途中退出时留下的未提交发布
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool is_recovered() const { return recovered_; }
+
+    /**
+     * @brief 获取读者槽位个数，没有读者表时为 0
+     * 
+     * @return uint32_t 
+     */
+    uint32_t get_reader_count() const { return reader_count_; }
+
+    /**
+     * @brief 获取本实例占用的读者槽位，没有占用时返回 -1
+     * 
+     * @return int 
+     */
+    int get_reader_slot() const {
+        return p_reader_slot_ != nullptr ? static_cast<int>(p_reader_slot_ - p_readers_) : -1;
+    }
+
+    /**
+     * @brief 读者长时间不遍历时主动更新心跳
+     * 
+     * @return true 
+     * @return false 没有占用读者槽位
+     */
+    bool heartbeat();
+
+    /**
+     * @brief 写者获取仍在读取的最旧发布代数，代数小于返回值的版本没有读者在读取，可以回收
+     * 需要在 insert 之后调用，没有读者表或没有读者在读取时返回当前发布的代数
+     * 
+     * @return uint64_t 
+     */
+    uint64_t get_oldest_reader_epoch() const;
+
+    /**
+     * @brief 回收已退出进程占用的读者槽位，同时归还其占用的缓冲区；
+     * 读者槽位用尽、所有缓冲区都被占用时会自动回收
+     * 
+     * @return uint32_t 回收的槽位个数
+     */
+    uint32_t reap_readers();
+
+    /**
+     * @brief 获取所有读者的状态，包括落后于当前发布的代数
+     * 
+     * @param infos 
+     * @return true 
+     * @return false 
+     */
+    bool get_readers(std::vector<SHM_READER_INFO>* infos);
+
+    /**
+     * @brief 范围查询，按 key 升序对 key 在 [low, high] 内的节点调用回调函数，只访问命中的节点；
+     * 查询期间有新的发布时返回 SHM_ERR_INDEX，此时回调已处理的节点可能混有两次发布的数据，应丢弃后重试
+     * 
+     * @tparam F 形如 bool(T* node)
+     * @param index_id 
+     * @param low 
+     * @param high 
+     * @param node_func 
+     * @return true 
+     * @return false 
+     */
+    template <class F>
+    bool range_query(uint32_t index_id, uint64_t low, uint64_t high, F&& node_func);
+
+    /**
+     * @brief 按 key 降序对 key 最大的 k 个节点调用回调函数，查询期间有新的发布时同 range_query 返回 SHM_ERR_INDEX
+     * 
+     * @tparam F 形如 bool(T* node)
+     * @param index_id 
+     * @param k 
+     * @param node_func 
+     * @return true 
+     * @return false 
+     */
+    template <class F>
+    bool top_k(uint32_t index_id, size_t k, F&& node_func);
+
+private:
+    /**
+     * @brief 初始化前按选项准备头部
+     * 
+     * @param max_node_count 
+     * @param options 
+     * @return true 
+     * @return false 
+     */
+    bool prepare_init(size_t max_node_count, const ARRAY_SHM_OPTIONS& options);
+
+    /**
+     * @brief 挂载后定位统计块、读者计数和读者表，准备索引，读者占用槽位
+     * 
+     * @param is_create 
+     * @return true 
+     * @return false 需要修改共享内存的读者以只读方式挂载，或读者槽位用尽
+     */
+    bool finish_init(bool is_create);
+
+    /**
+     * @brief 释放占用的读者槽位，fork 出的子进程析构继承的实例时槽位仍属于父进程，不释放
+     * 
+     */
+    void unregister_reader() {
+        if (p_reader_slot_ != nullptr) {
+            if (reader_pid_ == static_cast<uint32_t>(getpid())) {
+                shm_reader_release(p_reader_slot_);
+            }
+            p_reader_slot_ = nullptr;
+        }
+    }
+
+    /**
+     * @brief 占用的读者槽位是否是 fork 前从父进程继承的，子进程不能改写父进程的槽位
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool is_inherited_reader() const {
+        return p_reader_slot_ != nullptr && reader_pid_ != shm_current_pid();
+    }
+
+    /**
+     * @brief 设置头部
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool set_header();
+
+    /**
+     * @brief 解析头部
+     * 
+     * @param header 
+     * @return size_t 整个共享内存的长度，出错返回 0
+     */
+    size_t parse_header(const TH& header);
+
+    /**
+     * @brief 遍历的实现
+     * 
+     * @tparam PREFETCH 是否预取
+     * @tparam F 
+     * @param node_func 
+     * @return true 
+     * @return false 
+     */
+    template <bool PREFETCH, class F>
+    bool do_traverse(F&& node_func);
+
+    /**
+     * @brief 第 index_id 个有序索引
+     * 
+     * @param index_id 
+     * @return SHM_INDEX_VIEW 
+     */
+    SHM_INDEX_VIEW get_index(uint32_t index_id) const {
+        return SHM_INDEX_VIEW(this->get_shm_addr()
+            + array_shm_index_offset<TH>(array_header_.max_node_count, sizeof(T), get_flags(array_header_))
+            + index_id * shm_index_length(array_header_.max_node_count), array_header_.max_node_count);
+    }
+
+    /**
+     * @brief 读取头部并取得与之一致的有序索引
+     * 
+     * @param index_id 
+     * @param where 
+     * @param view 
+     * @param generation 索引对应的发布代数，查询结束后据此校验
+     * @return T* 第一个节点，出错返回 nullptr
+     */
+    T* load_index(uint32_t index_id, const char* where, SHM_INDEX_VIEW* view, uint64_t* generation);
+
+    /**
+     * @brief 查询结束后确认索引和头部仍是查询开始时的发布，单缓冲下写者原地改写节点和索引
+     * 
+     * @param view 
+     * @param index_id 
+     * @param generation 
+     * @param where 
+     * @return true 
+     * @return false 查询期间有新的发布
+     */
+    bool check_index(const SHM_INDEX_VIEW& view, uint32_t index_id, uint64_t generation, const char* where);
+
+    /**
+     * @brief 发布前把所有有序索引置为无效，正在查询的读者据此发现并发发布
+     * 
+     */
+    void invalidate_index();
+
+    /**
+     * @brief 发布时更新所有有序索引
+     * 
+     * @param nodes 
+     * @param count 
+     */
+    void update_index(const T* nodes, size_t count);
+
+    /**
+     * @brief 获取头部中的特性标记，头部没有 flags 字段时为 0
+     * 
+     * @param header 
+     * @return uint32_t 
+     */
+    static uint32_t get_flags(const TH& header) {
+        if constexpr (header_has_flags<TH>::value) {
+            return header.flags;
+        } else {
+            return 0;
+        }
+    }
+
+    /**
+     * @brief 按选项计算缓冲区个数，崩溃安全模式至少为 2
+     * 
+     * @param options 
+     * @return uint32_t 
+     */
+    static uint32_t calc_buffer_count(const ARRAY_SHM_OPTIONS& options) {
+        return (options.crash_safe && options.buffer_count < 2) ? 2 : options.buffer_count;
+    }
+
+    /**
+     * @brief 按选项计算读者槽位个数，多缓冲时至少为 g_shm_buffer_reader_count
+     * 
+     * @param options 
+     * @return uint32_t 
+     */
+    static uint32_t calc_reader_count(const ARRAY_SHM_OPTIONS& options) {
+        return (calc_buffer_count(options) > 1 && options.reader_count == 0) ? g_shm_buffer_reader_count
+            : options.reader_count;
+    }
+
+    /**
+     * @brief 按选项计算特性标记
+     * 
+     * @param options 
+     * @return uint32_t 
+     */
+    static uint32_t calc_flags(const ARRAY_SHM_OPTIONS& options) {
+        uint32_t buffer_count = calc_buffer_count(options);
+        return (options.enable_stats ? ARRAY_SHM_FLAG_STATS : 0) | (options.crash_safe ? ARRAY_SHM_FLAG_CRASH_SAFE : 0)
+            | (options.index_count << ARRAY_SHM_INDEX_SHIFT)
+            | (buffer_count > 1 ? buffer_count << ARRAY_SHM_BUFFER_SHIFT : 0)
+            | (calc_reader_count(options) << ARRAY_SHM_READER_SHIFT);
+    }
+
+    /**
+     * @brief 获取头部中的发布代数，头部没有 generation 字段时为 0
+     * 
+     * @param header 
+     * @return uint64_t 
+     */
+    static uint64_t get_generation(const TH& header) {
+        if constexpr (header_has_generation<TH>::value) {
+            return header.generation;
+        } else {
+            return 0;
+        }
+    }
+
+    /**
+     * @brief 获取头部中当前发布的缓冲区，头部没有 active_buffer 字段时为 0
+     * 
+     * @param header 
+     * @return uint32_t 
+     */
+    static uint32_t get_active_buffer(const TH& header) {
+        if constexpr (header_has_active_buffer<TH>::value) {
+            return header.active_buffer;
+        } else {
+            return 0;
+        }
+    }
+
+    /**
+     * @brief 第 buffer 个缓冲区的第一个节点
+     * 
+     * @param buffer 
+     * @return T* 
+     */
+    T* get_buffer_nodes(uint32_t buffer) const {
+        return this->get_node_by_pos(static_cast<size_t>(buffer) * array_header_.max_node_count);
+    }
+
+    /**
+     * @brief 写者选择没有读者占用的非当前缓冲区，全部被占用时等待
+     * 
+     * @param buffer 
+     * @return true 
+     * @return false 等待超时
+     */
+    bool pick_buffer(uint32_t* buffer);
+
+    /**
+     * @brief 读者读取头部并占用当前发布的缓冲区，单缓冲时只读取头部；占用读者槽位时同时记录正在读取的发布代数
+     * 
+     * @param header 
+     * @param where 
+     * @param buffer 
+     * @return true 
+     * @return false 
+     */
+    bool acquire_buffer(TH* header, const char* where, uint32_t* buffer);
+
+    /**
+     * @brief 读取头部并占用当前发布的缓冲区的实现
+     * 
+     * @param header 
+     * @param where 
+     * @param buffer 
+     * @return true 
+     * @return false 
+     */
+    bool pin_buffer(TH* header, const char* where, uint32_t* buffer);
+
+    /**
+     * @brief 崩溃安全模式下定位提交字和头部记录
+     * 
+     */
+    void locate_commit() {
+        char* addr = this->get_shm_addr()
+            + array_shm_commit_offset<TH>(array_header_.max_node_count, sizeof(T), get_flags(array_header_));
+        p_commit_ = reinterpret_cast<SHM_COMMIT_WORD*>(addr);
+        p_commit_records_ = reinterpret_cast<TH*>(addr + sizeof(SHM_COMMIT_WORD));
+    }
+
+    /**
+     * @brief 写者开始发布前在未提交的头部记录中留下标记（version 为 0，generation 为即将发布的代数），
+     * 重启的写者据此发现上一个写者在发布途中退出
+     * 
+     */
+    void begin_commit();
+
+    /**
+     * @brief 写者写入头部记录后提交，提交之前读者看到的一直是上一次提交的记录
+     * 
      */
-    bool init(size_t shm_key, size_t node_count = 0, bool is_create = false);
+    void commit_header();
 
     /**
-     * @brief 顺序插入节点
+     * @brief 读取提交字指向的头部记录，并校验记录与提交字中的代数、CRC 一致
      * 
-     * @param node_vec 
+     * @param header 
+     * @param commit 读取到的提交字
      * @return true 
-     * @return false 
+     * @return false 记录正在被改写或已损坏
      */
-    int insert(const std::vector<T>& node_vec);
+    bool load_commit(TH* header, uint64_t* commit);
 
     /**
-     * @brief 遍历共享内存，对每个节点调用回调函数处理
+     * @brief 读取已提交的头部，记录正在被改写时重试
      * 
-     * @param node_func 
-     * @param user_info 
+     * @param header 
+     * @param where 
      * @return true 
      * @return false 
      */
-    bool traverse(TRAVERSE_METHOD_FUNC node_func) override;
+    bool read_commit(TH* header, const char* where);
 
     /**
-     * @brief 获取头部数据
+     * @brief 崩溃安全模式下读取已提交的头部并占用其缓冲区
      * 
      * @param header 
+     * @param where 
+     * @param buffer 
      * @return true 
      * @return false 
      */
-    bool get_header(ARRAY_SHM_HEADER* header);
+    bool pin_commit(TH* header, const char* where, uint32_t* buffer);
 
-private:
     /**
-     * @brief 设置头部
+     * @brief 读者释放占用的缓冲区，并记录读完的发布代数
      * 
-     * @return true 
-     * @return false 
+     * @param buffer 
      */
-    bool set_header() override;
+    void release_buffer(uint32_t buffer) {
+        unpin_buffer(buffer);
+        if (p_reader_slot_ != nullptr) {
+            p_reader_slot_->last_epoch.store(get_generation(array_header_), std::memory_order_relaxed);
+            p_reader_slot_->heartbeat_ns.store(get_now_monotonic_time_ns(), std::memory_order_relaxed);
+            p_reader_slot_->read_count.fetch_add(1, std::memory_order_relaxed);
+            p_reader_slot_->epoch.store(g_shm_reader_idle_epoch, std::memory_order_release);
+        }
+    }
 
     /**
-     * @brief 解析头部
+     * @brief 占用多缓冲的缓冲区，只有占用读者槽位的读者才计数；
+     * 先在槽位中记录再计数，读者在任意位置退出后回收者都能据此归还，不会留下无人归还的计数
      * 
-     * @param header 
-     * @return uint32_t 
+     * @param buffer 
+     */
+    void pin(uint32_t buffer) {
+        p_reader_slot_->pinned_buffer.store(buffer + 1, std::memory_order_seq_cst);
+        __atomic_fetch_add(&p_pins_[buffer].pin_count, 1, __ATOMIC_SEQ_CST);
+    }
+
+    /**
+     * @brief 归还多缓冲的读者计数，与 pin 相反，先归还计数再清除槽位中的记录
+     * 
+     * @param buffer 
      */
-    uint32_t parse_header(const ARRAY_SHM_HEADER& header) override;
+    void unpin_buffer(uint32_t buffer) {
+        if (buffer_count_ > 1 && p_reader_slot_ != nullptr) {
+            __atomic_fetch_sub(&p_pins_[buffer].pin_count, 1, __ATOMIC_RELEASE);
+            p_reader_slot_->pinned_buffer.store(0, std::memory_order_relaxed);
+        }
+    }
 
 private:
     bool is_init_{false};
-    ARRAY_SHM_HEADER array_header_;
+    TH array_header_;
+    SHM_STATS* p_stats_{nullptr};
+    // 只读挂载时不能更新统计
+    bool record_stats_{false};
+    // 发布时间的时钟源
+    CShmClock clock_;
+    // 使用非临时存储的长度阈值
+    size_t nt_store_threshold_{g_shm_nt_store_threshold};
+    // 缓冲区个数及多缓冲的读者计数
+    uint32_t buffer_count_{1};
+    SHM_BUFFER_PIN* p_pins_{nullptr};
+    // 崩溃安全模式下的提交字及两份头部记录
+    SHM_COMMIT_WORD* p_commit_{nullptr};
+    TH* p_commit_records_{nullptr};
+    bool recovered_{false};
+    // 读者表及本实例占用的槽位
+    uint32_t reader_count_{0};
+    SHM_READER_SLOT* p_readers_{nullptr};
+    SHM_READER_SLOT* p_reader_slot_{nullptr};
+    // 占用槽位的进程号
+    uint32_t reader_pid_{0};
+    bool register_reader_{true};
+    // 写者维护的有序索引
+    std::vector<INDEX_KEY_FUNC> index_keys_;
+    std::vector<CShmIndexBuilder> index_builders_;
 };
 
-template <class T>
-bool CArrayShm<T>::init(size_t shm_key, size_t max_node_count, bool is_create) {
+template <class T, class TH>
+bool CArrayShm<T, TH>::init(size_t shm_key, size_t max_node_count, bool is_create, const ARRAY_SHM_OPTIONS& options) {
+    if (!prepare_init(max_node_count, options)) {
+        return false;
+    }
+    size_t body_size = array_shm_length<TH>(max_node_count, sizeof(T), get_flags(array_header_)) - sizeof(TH);
+    if (!BASE::init(shm_key, max_node_count > 0 ? body_size : 0, is_create, options)) {
+        return false;
+    }
+    return finish_init(is_create);
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::init_in_place(void* addr, size_t capacity, size_t max_node_count, bool is_create,
+    const ARRAY_SHM_OPTIONS& options) {
+    if (!prepare_init(max_node_count, options)) {
+        return false;
+    }
+    size_t body_size = array_shm_length<TH>(max_node_count, sizeof(T), get_flags(array_header_)) - sizeof(TH);
+    if (!BASE::init_in_place(addr, capacity, max_node_count > 0 ? body_size : 0, is_create, options)) {
+        return false;
+    }
+    return finish_init(is_create);
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::reopen_in_place(void* addr, size_t capacity, const ARRAY_SHM_OPTIONS& options) {
+    if (options.read_only) {
+        this->set_err(SHM_ERR_READ_ONLY, "CArrayShm::reopen_in_place");
+        return false;
+    }
+    if (!prepare_init(0, options) || !BASE::init_in_place(addr, capacity, 0, false, options)) {
+        return false;
+    }
+    return finish_init(true);
+}
+
+template <class T, class TH>
+size_t CArrayShm<T, TH>::calc_length(size_t max_node_count, const ARRAY_SHM_OPTIONS& options) {
+    uint32_t flags = 0;
+    if constexpr (header_has_flags<TH>::value) {
+        flags = calc_flags(options);
+    }
+    return array_shm_length<TH>(max_node_count, sizeof(T), flags);
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::prepare_init(size_t max_node_count, const ARRAY_SHM_OPTIONS& options) {
     if (is_init_) {
-        this->set_err_msg("[CArrayShm::init] Already initialized, can't reinitialized");
+        this->set_err(SHM_ERR_ALREADY_INIT, "CArrayShm::init");
         return false;
     }
-    array_header_.version = g_shm_version;
+    array_header_.version = LAYOUT_VERSION;
     array_header_.max_node_count = max_node_count;
     array_header_.cur_node_count = 0;
-
-    bool res = CShm<T, ARRAY_SHM_HEADER>::init(shm_key, max_node_count * this->get_node_size(), is_create);
-    if (!res) {
+    uint32_t buffer_count = calc_buffer_count(options);
+    if (options.index_count > g_shm_max_index_count || buffer_count > g_shm_max_buffer_count
+        || (buffer_count > 1 && options.index_count > 0) || options.reader_count > g_shm_max_reader_count) {
+        this->set_err(SHM_ERR_INVALID_PARAM, "CArrayShm::init");
+        return false;
+    }
+    if constexpr (header_has_flags<TH>::value && header_has_active_buffer<TH>::value && header_has_crc<TH>::value) {
+        array_header_.active_buffer = 0;
+    } else {
+        if (buffer_count > 1) {
+            this->set_err(SHM_ERR_HEADER_FIELD, "CArrayShm::init");
+            return false;
+        }
+    }
+    if constexpr (header_has_generation<TH>::value) {
+        array_header_.generation = 0;
+    } else {
+        if (calc_reader_count(options) > 0) {
+            this->set_err(SHM_ERR_HEADER_FIELD, "CArrayShm::init");
+            return false;
+        }
+    }
+    if constexpr (header_has_flags<TH>::value) {
+        array_header_.flags = calc_flags(options);
+    } else {
+        if (options.enable_stats || options.index_count > 0 || calc_reader_count(options) > 0) {
+            this->set_err(SHM_ERR_HEADER_FIELD, "CArrayShm::init");
+            return false;
+        }
+    }
+    if constexpr (header_has_node_size<TH>::value) {
+        array_header_.node_size = sizeof(T);
+    }
+    if constexpr (!header_has_clock<TH>::value) {
+        if (options.clock_type != SHM_CLOCK_REALTIME) {
+            this->set_err(SHM_ERR_HEADER_FIELD, "CArrayShm::init");
+            return false;
+        }
+    }
+    nt_store_threshold_ = options.nt_store_threshold;
+    register_reader_ = options.register_reader;
+    if (!options.read_only && !clock_.init(options.clock_type, options.clock_func)) {
+        this->set_err(SHM_ERR_INVALID_PARAM, "CArrayShm::init");
         return false;
     }
+    return true;
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::finish_init(bool is_create) {
+    // 挂载已存在的共享内存时，array_header_ 已在 parse_header 中更新为共享内存中的头部
+    if (get_flags(array_header_) & ARRAY_SHM_FLAG_STATS) {
+        p_stats_ = reinterpret_cast<SHM_STATS*>(this->get_shm_addr()
+            + array_shm_stats_offset<TH>(array_header_.max_node_count, sizeof(T), get_flags(array_header_)));
+        record_stats_ = !this->is_read_only();
+    }
+    buffer_count_ = array_shm_buffer_count(get_flags(array_header_));
+    if (buffer_count_ > 1) {
+        // 读者需要修改缓冲区的读者计数
+        if (this->is_read_only()) {
+            this->set_err(SHM_ERR_READ_ONLY, "CArrayShm::init", buffer_count_);
+            return false;
+        }
+        p_pins_ = reinterpret_cast<SHM_BUFFER_PIN*>(this->get_shm_addr()
+            + array_shm_pin_offset<TH>(array_header_.max_node_count, sizeof(T), get_flags(array_header_)));
+    }
+    if (get_flags(array_header_) & ARRAY_SHM_FLAG_CRASH_SAFE) {
+        locate_commit();
+        // 以提交记录为准，头部镜像可能是上一个写者退出时写了一半或没有提交的
+        TH committed;
+        if (!read_commit(&committed, "CArrayShm::init")) {
+            return false;
+        }
+        if (is_create) {
+            // 另一份记录带有开始发布的标记，或头部镜像与提交记录不一致，说明上一个写者在发布途中退出；
+            // 丢弃未提交的发布并恢复头部镜像，下一次发布从已提交的代数继续
+            TH mirror;
+            this->do_get_header(&mirror);
+            const TH& pending = p_commit_records_[static_cast<uint32_t>(get_generation(committed) + 1) % 2];
+            recovered_ = (pending.version == 0 && get_generation(pending) == get_generation(committed) + 1)
+                || memcmp(&mirror, &committed, sizeof(TH)) != 0;
+            if (recovered_) {
+                this->do_set_header(committed);
+            }
+        }
+    }
+    reader_count_ = array_shm_reader_count(get_flags(array_header_));
+    if (reader_count_ > 0) {
+        p_readers_ = reinterpret_cast<SHM_READER_SLOT*>(this->get_shm_addr()
+            + array_shm_reader_offset<TH>(array_header_.max_node_count, sizeof(T), get_flags(array_header_)));
+    }
+    // 多缓冲的读者必须占用槽位，占用的缓冲区才能在退出后被回收
+    if (reader_count_ > 0 && !is_create && (register_reader_ || buffer_count_ > 1)) {
+        if (this->is_read_only()) {
+            this->set_err(SHM_ERR_READ_ONLY, "CArrayShm::init", reader_count_);
+            return false;
+        }
+        uint32_t pid = static_cast<uint32_t>(getpid());
+        int slot = shm_reader_claim(p_readers_, reader_count_, pid);
+        if (slot < 0 && reap_readers() > 0) {
+            slot = shm_reader_claim(p_readers_, reader_count_, pid);
+        }
+        if (slot < 0) {
+            this->set_err(SHM_ERR_READER_FULL, "CArrayShm::init", reader_count_);
+            return false;
+        }
+        p_reader_slot_ = p_readers_ + slot;
+        reader_pid_ = pid;
+    }
+    if (!this->is_read_only()) {
+        index_keys_.assign(get_index_count(), nullptr);
+        index_builders_.assign(get_index_count(), CShmIndexBuilder());
+    }
     is_init_ = true;
     return true;
 }
 
-template <class T>
-int CArrayShm<T>::insert(const std::vector<T>& node_vec) {
+template <class T, class TH>
+int CArrayShm<T, TH>::insert(const T* nodes, size_t count) {
     if (!is_init_) {
-        this->set_err_msg("[CArrayShm:insert] init might be mistaken");
+        this->set_err(SHM_ERR_NOT_INIT, "CArrayShm::insert");
         return -1;
     }
-    size_t cur_node_count = 0;
-    for (size_t i = 0; i < node_vec.size() && i < array_header_.max_node_count; ++i) {
-        T* p_node = this->get_node_by_pos(i);
-        if (p_node == nullptr) {
-            continue;
-        }
-        memcpy(p_node, &node_vec[i], sizeof(T));
-        ++cur_node_count;
+    if (this->is_read_only()) {
+        this->set_err(SHM_ERR_READ_ONLY, "CArrayShm::insert");
+        return -1;
+    }
+    uint64_t begin_ns = record_stats_ ? get_now_monotonic_time_ns() : 0;
+    size_t cur_node_count = (count < array_header_.max_node_count) ? count : array_header_.max_node_count;
+    if (cur_node_count > 0 && nodes == nullptr) {
+        this->set_err(SHM_ERR_INVALID_PARAM, "CArrayShm::insert");
+        return -1;
+    }
+    // 多缓冲时写入没有读者占用的非当前缓冲区
+    uint32_t buffer = 0;
+    if (buffer_count_ > 1 && !pick_buffer(&buffer)) {
+        return -1;
+    }
+    T* p_node = get_buffer_nodes(buffer);
+    if (p_node == nullptr) {
+        this->set_err(SHM_ERR_NOT_ATTACH, "CArrayShm::insert");
+        return -1;
+    }
+    if (p_commit_ != nullptr) {
+        begin_commit();
+    }
+    if (!index_builders_.empty()) {
+        invalidate_index();
+    }
+    if (cur_node_count > 0) {
+        // 非临时存储结束时已 sfence，头部不会先于节点可见
+        shm_copy(p_node, nodes, cur_node_count * sizeof(T), nt_store_threshold_);
     }
     array_header_.cur_node_count = cur_node_count;
+    if constexpr (header_has_active_buffer<TH>::value) {
+        array_header_.active_buffer = buffer;
+    }
+    if constexpr (header_has_generation<TH>::value) {
+        ++array_header_.generation;
+    }
+    if (!index_builders_.empty()) {
+        update_index(nodes, cur_node_count);
+    }
     this->set_header();
+    if (buffer_count_ > 1 || reader_count_ > 0) {
+        // 与读者占用缓冲区、记录 epoch 时的写入配对，之后选择缓冲区、计算最旧代数时能看到在切换之前开始读取的读者
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    if (record_stats_) {
+        uint64_t latency_ns = get_now_monotonic_time_ns() - begin_ns;
+        shm_stats_add(&p_stats_->insert_count);
+        shm_stats_add(&p_stats_->insert_node_count, cur_node_count);
+        shm_stats_set(&p_stats_->last_publish_latency_ns, latency_ns);
+        shm_stats_max(&p_stats_->max_publish_latency_ns, latency_ns);
+        if constexpr (header_has_time<TH>::value) {
+            shm_stats_set(&p_stats_->last_publish_time_ns, array_shm_wall_time_ns(array_header_));
+        }
+    }
     return cur_node_count;
 }
 
-template <class T>
-bool CArrayShm<T>::set_header() {
+template <class T, class TH>
+bool CArrayShm<T, TH>::set_header() {
     if (array_header_.max_node_count == 0) {
-        this->set_err_msg("[CArrayShm::set_header] input max_node_count invalid");
+        this->set_err(SHM_ERR_INVALID_PARAM, "CArrayShm::set_header");
         return false;
     }
-    array_header_.header_crc_val = 0;
-    array_header_.time_ns = get_now_system_time_ns();
-    uint32_t crc = calc_crc_val((unsigned char*)&array_header_, sizeof(ARRAY_SHM_HEADER));
-    array_header_.header_crc_val = crc;
-    // 设置 header
+    if constexpr (header_has_time<TH>::value) {
+        array_header_.time_ns = clock_.now();
+    }
+    if constexpr (header_has_clock<TH>::value) {
+        array_header_.clock = clock_.get_calib();
+    }
+    if constexpr (header_has_crc<TH>::value) {
+        array_header_.header_crc_val = 0;
+        uint32_t crc = calc_crc_val((unsigned char*)&array_header_, sizeof(TH));
+        array_header_.header_crc_val = crc;
+    }
+    if (get_flags(array_header_) & ARRAY_SHM_FLAG_CRASH_SAFE) {
+        commit_header();
+    }
+    // 设置 header，崩溃安全模式下只是供观察工具读取的镜像
     this->do_set_header(array_header_);
     return true;
 }
 
-template <class T>
-uint32_t CArrayShm<T>::parse_header(const ARRAY_SHM_HEADER& p_header) {
+template <class T, class TH>
+void CArrayShm<T, TH>::begin_commit() {
+    if constexpr (header_has_generation<TH>::value) {
+        // 另一份记录是上上次发布的，只有落后两代的读者在读取，校验失败后会重试
+        TH* record = p_commit_records_ + static_cast<uint32_t>(array_header_.generation + 1) % 2;
+        __atomic_store_n(&record->version, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&record->generation, array_header_.generation + 1, __ATOMIC_RELAXED);
+    }
+}
+
+template <class T, class TH>
+void CArrayShm<T, TH>::commit_header() {
+    if constexpr (header_has_generation<TH>::value && header_has_crc<TH>::value) {
+        if (p_commit_ == nullptr) {
+            // 创建时在 finish_init 之前发布第一次
+            locate_commit();
+        }
+        uint32_t generation = static_cast<uint32_t>(array_header_.generation);
+        memcpy(p_commit_records_ + generation % 2, &array_header_, sizeof(TH));
+        // 节点和头部记录都写完后才提交，之前退出时提交字仍指向上一次发布，另一份记录不会被改写
+        __atomic_store_n(&p_commit_->commit, (static_cast<uint64_t>(generation) << 32) | array_header_.header_crc_val,
+            __ATOMIC_RELEASE);
+    }
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::load_commit(TH* header, uint64_t* commit) {
+    if constexpr (header_has_generation<TH>::value && header_has_crc<TH>::value) {
+        *commit = __atomic_load_n(&p_commit_->commit, __ATOMIC_ACQUIRE);
+        uint32_t generation = static_cast<uint32_t>(*commit >> 32);
+        memcpy(header, p_commit_records_ + generation % 2, sizeof(TH));
+        if (parse_header(*header) == 0) {
+            return false;
+        }
+        // 记录自身的 CRC 正确，但已被之后的发布改写
+        if (static_cast<uint32_t>(header->generation) != generation
+            || header->header_crc_val != static_cast<uint32_t>(*commit)) {
+            this->set_err(SHM_ERR_CRC, "CArrayShm::load_commit", header->header_crc_val,
+                static_cast<uint32_t>(*commit));
+            return false;
+        }
+        return true;
+    } else {
+        this->set_err(SHM_ERR_HEADER_FIELD, "CArrayShm::load_commit");
+        return false;
+    }
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::read_commit(TH* header, const char* where) {
+    uint64_t commit = 0;
+    for (uint32_t retry = 0; retry < g_shm_buffer_max_retry; ++retry) {
+        if (load_commit(header, &commit)) {
+            return true;
+        }
+        if (this->get_err_code() != SHM_ERR_CRC) {
+            break;
+        }
+    }
+    this->wrap_err(where);
+    return false;
+}
+
+template <class T, class TH>
+size_t CArrayShm<T, TH>::parse_header(const TH& p_header) {
     uint32_t version = p_header.version;
-    if (version != g_shm_version) {
-        char buf[1024] = {0};
-        snprintf(buf, sizeof(buf), "[CArrayShm::parse_header] version check error, head info,"
-            "version: %d, curNodeCount: %d, maxNodeCount: %d, headerCRCVal: %d, timeNs: %ld",
-            p_header.version, p_header.cur_node_count, p_header.max_node_count,
-            p_header.header_crc_val, p_header.time_ns);
-        this->set_err_msg(buf);
+    if (version != LAYOUT_VERSION) {
+        this->set_err(SHM_ERR_VERSION, "CArrayShm::parse_header", version, LAYOUT_VERSION);
+        if (record_stats_) {
+            shm_stats_add(&p_stats_->version_err_count);
+        }
         return 0;
     }
+    memcpy(&array_header_, &p_header, sizeof(TH));
     // CRC 校验
-    memcpy(&array_header_, &p_header, sizeof(ARRAY_SHM_HEADER));
-    array_header_.header_crc_val = 0;
-    uint32_t crc = calc_crc_val((unsigned char*)&array_header_, sizeof(ARRAY_SHM_HEADER));
-    array_header_.header_crc_val = p_header.header_crc_val;
-    if (crc != p_header.header_crc_val) {
-        this->set_err_msg("[CArrayShm::parse_header] CRC calibration error");
+    if constexpr (header_has_crc<TH>::value) {
+        array_header_.header_crc_val = 0;
+        uint32_t crc = calc_crc_val((unsigned char*)&array_header_, sizeof(TH));
+        array_header_.header_crc_val = p_header.header_crc_val;
+        if (crc != p_header.header_crc_val && this->get_shm_addr() == nullptr
+            && (get_flags(p_header) & ARRAY_SHM_FLAG_CRASH_SAFE)) {
+            // 挂载前解析的是头部镜像，写者崩溃时可能只写了一半；version、max_node_count、flags 每次发布都不变，
+            // 仍可据此计算长度，finish_init 中再以提交记录为准
+            return array_shm_length<TH>(array_header_.max_node_count, sizeof(T), get_flags(array_header_));
+        }
+        if (crc != p_header.header_crc_val) {
+            this->set_err(SHM_ERR_CRC, "CArrayShm::parse_header", p_header.header_crc_val, crc);
+            if (record_stats_) {
+                shm_stats_add(&p_stats_->crc_err_count);
+            }
+            return 0;
+        }
+    }
+    if (p_header.cur_node_count > p_header.max_node_count) {
+        this->set_err(SHM_ERR_NODE_COUNT, "CArrayShm::parse_header", p_header.cur_node_count,
+            p_header.max_node_count);
         return 0;
     }
     // 整个共享内存占用的长度
-    return (array_header_.max_node_count * sizeof(T) + sizeof(ARRAY_SHM_HEADER));
+    return array_shm_length<TH>(array_header_.max_node_count, sizeof(T), get_flags(array_header_));
 }
 
-template <class T>
-bool CArrayShm<T>::traverse(TRAVERSE_METHOD_FUNC node_func) {
+template <class T, class TH>
+template <class F>
+bool CArrayShm<T, TH>::traverse(F&& node_func) {
+    return do_traverse<false>(std::forward<F>(node_func));
+}
+
+template <class T, class TH>
+template <bool PREFETCH, class F>
+bool CArrayShm<T, TH>::do_traverse(F&& node_func) {
     if (!is_init_) {
-        this->set_err_msg("[CArrayShm::traverse] init might be mistaken");
+        this->set_err(SHM_ERR_NOT_INIT, "CArrayShm::traverse");
         return false;
     }
-    ARRAY_SHM_HEADER header;
-    if (!get_header(&header)) {
-        char buf[1024] = {0};
-        snprintf(buf, sizeof(buf), "[CArrayShm::traverse] get_header err: %s", this->get_err_msg().c_str());
-        this->set_err_msg(buf);
+    if (record_stats_) {
+        shm_stats_add(&p_stats_->traverse_count);
+    }
+    TH header;
+    uint32_t buffer = 0;
+    if (!acquire_buffer(&header, "CArrayShm::traverse", &buffer)) {
+        if (record_stats_) {
+            shm_stats_add(&p_stats_->traverse_fail_count);
+        }
         return false;
     }
-    if (parse_header(header) == 0) {
-        char buf[1024] = {0};
-        snprintf(buf, sizeof(buf), "[CArrayShm::traverse] parse_header err: %s", this->get_err_msg().c_str());
-        this->set_err_msg(buf);
+    if constexpr (header_has_time<TH>::value) {
+        if (record_stats_) {
+            // 读者看到的数据距离发布的时间
+            uint64_t age_ns = array_shm_age_ns(header);
+            shm_stats_set(&p_stats_->last_reader_age_ns, age_ns);
+            shm_stats_max(&p_stats_->max_reader_age_ns, age_ns);
+        }
+    }
+    // 多缓冲时遍历期间一直占用该缓冲区，写者不会改写
+    T* p_node = get_buffer_nodes(buffer);
+    size_t cur_node_count = array_header_.cur_node_count;
+    // 按缓存行分块，每块预取一次 g_shm_prefetch_distance 字节之后的数据，预取越界不会出错
+    constexpr size_t BLOCK = PREFETCH && sizeof(T) < g_shm_cache_line_size ? g_shm_cache_line_size / sizeof(T) : 1;
+    constexpr size_t LINES = (sizeof(T) * BLOCK + g_shm_cache_line_size - 1) / g_shm_cache_line_size;
+    for (size_t i = 0; i < cur_node_count; i += BLOCK) {
+        if constexpr (PREFETCH) {
+            const char* ahead = reinterpret_cast<const char*>(p_node + i) + g_shm_prefetch_distance;
+            for (size_t line = 0; line < LINES; ++line) {
+                __builtin_prefetch(ahead + line * g_shm_cache_line_size, 0, 3);
+            }
+        }
+        size_t block_end = (i + BLOCK < cur_node_count) ? i + BLOCK : cur_node_count;
+        for (size_t j = i; j < block_end; ++j) {
+            if (!node_func(p_node + j)) {
+                release_buffer(buffer);
+                this->set_err(SHM_ERR_CALLBACK, "CArrayShm::traverse", j);
+                return false;
+            }
+        }
+    }
+    release_buffer(buffer);
+    return true;
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::pick_buffer(uint32_t* buffer) {
+    uint32_t active = get_active_buffer(array_header_);
+    uint64_t begin_ns = 0;
+    for (;;) {
+        for (uint32_t i = 1; i < buffer_count_; ++i) {
+            uint32_t idx = (active + i) % buffer_count_;
+            if (__atomic_load_n(&p_pins_[idx].pin_count, __ATOMIC_SEQ_CST) == 0) {
+                *buffer = idx;
+                return true;
+            }
+        }
+        // 所有非当前缓冲区都被读者占用，先回收已退出的读者占用的缓冲区
+        uint64_t now_ns = get_now_monotonic_time_ns();
+        if (begin_ns == 0) {
+            begin_ns = now_ns;
+            if (reader_count_ > 0 && reap_readers() > 0) {
+                continue;
+            }
+        } else if (now_ns - begin_ns > g_shm_buffer_wait_timeout_ns) {
+            this->set_err(SHM_ERR_BUFFER_BUSY, "CArrayShm::insert", buffer_count_);
+            return false;
+        }
+        sched_yield();
+    }
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::acquire_buffer(TH* header, const char* where, uint32_t* buffer) {
+    *buffer = 0;
+    if (is_inherited_reader()) {
+        // 子进程需要重新 init 占用自己的槽位
+        this->set_err(SHM_ERR_NOT_INIT, where, reader_pid_);
         return false;
     }
-    T* p_node = nullptr;
-    for (size_t i = 0; i < array_header_.cur_node_count; i++) {
-        p_node = this->get_node_by_pos(i);
-        if (p_node == nullptr) {
-            this->set_err_msg("[CArrayShm::traverse] Failed to get node");
+    if (p_reader_slot_ != nullptr) {
+        // 先用上一次读到的代数占位，不大于即将读到的代数；与写者发布后的屏障配对，
+        // 写者计算最旧代数时要么看到占位，要么读者之后读到的是写者已经发布的版本
+        p_reader_slot_->epoch.store(get_generation(array_header_), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    bool res = pin_buffer(header, where, buffer);
+    if (p_reader_slot_ != nullptr) {
+        p_reader_slot_->epoch.store(res ? get_generation(*header) : g_shm_reader_idle_epoch,
+            std::memory_order_relaxed);
+    }
+    return res;
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::pin_buffer(TH* header, const char* where, uint32_t* buffer) {
+    if (p_commit_ != nullptr) {
+        return pin_commit(header, where, buffer);
+    }
+    if (buffer_count_ == 1) {
+        if (!get_header(header) || parse_header(*header) == 0) {
+            this->wrap_err(where);
+            return false;
+        }
+        return true;
+    }
+    for (uint32_t retry = 0; retry < g_shm_buffer_max_retry; ++retry) {
+        if (!get_header(header)) {
+            this->wrap_err(where);
             return false;
         }
-        bool ret = node_func(p_node);
-        if (!ret) {
-            this->set_err_msg("[CArrayShm::traverse] callback TRAVERSE_METHOD function return false");
+        uint32_t idx = get_active_buffer(*header);
+        if (idx >= buffer_count_) {
+            // 头部正在被改写
+            continue;
+        }
+        if (p_reader_slot_ == nullptr) {
+            // 写者自己的实例不占用缓冲区，遍历期间不会发布
+            if (parse_header(*header) == 0) {
+                this->wrap_err(where);
+                return false;
+            }
+            *buffer = idx;
+            return true;
+        }
+        pin(idx);
+        // 占用之后再读一次头部，确认该缓冲区仍是当前发布的，之后写者不会再选择它
+        if (get_header(header) && get_active_buffer(*header) == idx) {
+            if (parse_header(*header) != 0) {
+                *buffer = idx;
+                return true;
+            }
+            // CRC 不一致是读到了正在改写的头部，可以重试，其他错误直接返回
+            if (this->get_err_code() != SHM_ERR_CRC) {
+                unpin_buffer(idx);
+                this->wrap_err(where);
+                return false;
+            }
+        }
+        unpin_buffer(idx);
+    }
+    this->set_err(SHM_ERR_BUFFER_BUSY, where, buffer_count_);
+    return false;
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::pin_commit(TH* header, const char* where, uint32_t* buffer) {
+    uint64_t commit = 0;
+    for (uint32_t retry = 0; retry < g_shm_buffer_max_retry; ++retry) {
+        if (!load_commit(header, &commit)) {
+            // 只有记录正在被改写时重试，其他错误直接返回
+            if (this->get_err_code() != SHM_ERR_CRC) {
+                this->wrap_err(where);
+                return false;
+            }
+            continue;
+        }
+        uint32_t idx = get_active_buffer(*header);
+        if (idx >= buffer_count_) {
+            this->set_err(SHM_ERR_BUFFER_BUSY, where, buffer_count_);
+            return false;
+        }
+        if (p_reader_slot_ == nullptr) {
+            // 写者自己的实例不占用缓冲区，遍历期间不会发布
+            *buffer = idx;
+            return true;
+        }
+        pin(idx);
+        // 占用之后提交字仍未变化，写者之后不会再选择该缓冲区
+        if (__atomic_load_n(&p_commit_->commit, __ATOMIC_SEQ_CST) == commit) {
+            *buffer = idx;
+            return true;
+        }
+        unpin_buffer(idx);
+    }
+    this->set_err(SHM_ERR_BUFFER_BUSY, where, buffer_count_);
+    return false;
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::heartbeat() {
+    if (p_reader_slot_ == nullptr || is_inherited_reader()) {
+        this->set_err(SHM_ERR_NOT_INIT, "CArrayShm::heartbeat");
+        return false;
+    }
+    p_reader_slot_->heartbeat_ns.store(get_now_monotonic_time_ns(), std::memory_order_relaxed);
+    return true;
+}
+
+template <class T, class TH>
+uint64_t CArrayShm<T, TH>::get_oldest_reader_epoch() const {
+    uint64_t generation = get_generation(array_header_);
+    if (reader_count_ == 0) {
+        return generation;
+    }
+    return shm_reader_oldest_epoch(p_readers_, reader_count_, generation);
+}
+
+template <class T, class TH>
+uint32_t CArrayShm<T, TH>::reap_readers() {
+    if (reader_count_ == 0 || this->is_read_only()) {
+        return 0;
+    }
+    return shm_reader_reap(p_readers_, reader_count_, [this](uint32_t buffer) {
+        if (buffer >= buffer_count_) {
+            return;
+        }
+        // 读者在记录之后、计数之前退出时计数可能已为 0，不能归还到回绕
+        uint32_t pin_count = __atomic_load_n(&p_pins_[buffer].pin_count, __ATOMIC_RELAXED);
+        while (pin_count > 0 && !__atomic_compare_exchange_n(&p_pins_[buffer].pin_count, &pin_count, pin_count - 1,
+            false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    });
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::get_readers(std::vector<SHM_READER_INFO>* infos) {
+    if (infos == nullptr) {
+        this->set_err(SHM_ERR_INVALID_PARAM, "CArrayShm::get_readers");
+        return false;
+    }
+    if (!is_init_) {
+        this->set_err(SHM_ERR_NOT_INIT, "CArrayShm::get_readers");
+        return false;
+    }
+    // 以共享内存中最新的代数计算落后的代数
+    TH header;
+    if (p_commit_ != nullptr) {
+        if (!read_commit(&header, "CArrayShm::get_readers")) {
             return false;
         }
+    } else if (!get_header(&header) || parse_header(header) == 0) {
+        this->wrap_err("CArrayShm::get_readers");
+        return false;
     }
+    shm_reader_collect(p_readers_, reader_count_, get_generation(header), infos);
     return true;
 }
 
-template <class T>
-bool CArrayShm<T>::get_header(ARRAY_SHM_HEADER* header) {
+template <class T, class TH>
+bool CArrayShm<T, TH>::get_header(TH* header) {
     if (header == nullptr) {
-        this->set_err_msg("[CArrayShm::get_header] param header is null");
+        this->set_err(SHM_ERR_INVALID_PARAM, "CArrayShm::get_header");
         return false;
     }
     if (!is_init_) {
-        this->set_err_msg("[CArrayShm::get_header] init might be mistaken");
+        this->set_err(SHM_ERR_NOT_INIT, "CArrayShm::get_header");
         return false;
     }
     return this->do_get_header(header);
 }
 
+template <class T, class TH>
+bool CArrayShm<T, TH>::snapshot(TH* header, std::vector<T>* node_vec) {
+    if (header == nullptr || node_vec == nullptr) {
+        this->set_err(SHM_ERR_INVALID_PARAM, "CArrayShm::snapshot");
+        return false;
+    }
+    uint32_t buffer = 0;
+    if (!acquire_buffer(header, "CArrayShm::snapshot", &buffer)) {
+        return false;
+    }
+    node_vec->resize(header->cur_node_count);
+    if (header->cur_node_count > 0) {
+        memcpy(node_vec->data(), get_buffer_nodes(buffer), header->cur_node_count * sizeof(T));
+    }
+    release_buffer(buffer);
+    return true;
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::set_index_key(uint32_t index_id, INDEX_KEY_FUNC key_func) {
+    if (!is_init_) {
+        this->set_err(SHM_ERR_NOT_INIT, "CArrayShm::set_index_key");
+        return false;
+    }
+    if (this->is_read_only()) {
+        this->set_err(SHM_ERR_READ_ONLY, "CArrayShm::set_index_key");
+        return false;
+    }
+    if (index_id >= index_keys_.size() || key_func == nullptr) {
+        this->set_err(SHM_ERR_INDEX, "CArrayShm::set_index_key", index_id);
+        return false;
+    }
+    index_keys_[index_id] = key_func;
+    index_builders_[index_id] = CShmIndexBuilder();
+    return true;
+}
+
+template <class T, class TH>
+void CArrayShm<T, TH>::invalidate_index() {
+    for (uint32_t i = 0; i < index_builders_.size(); ++i) {
+        __atomic_store_n(&get_index(i).header->valid, 0, __ATOMIC_RELAXED);
+    }
+    // 置为无效先于改写节点和索引条目可见
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+template <class T, class TH>
+void CArrayShm<T, TH>::update_index(const T* nodes, size_t count) {
+    uint64_t generation = 0;
+    if constexpr (header_has_generation<TH>::value) {
+        generation = array_header_.generation;
+    }
+    for (uint32_t i = 0; i < index_builders_.size(); ++i) {
+        SHM_INDEX_VIEW view = get_index(i);
+        if (index_keys_[i] == nullptr) {
+            view.header->valid = 0;
+            continue;
+        }
+        size_t changed = index_builders_[i].update(nodes, count, index_keys_[i]);
+        index_builders_[i].write(view, generation, changed > 0);
+    }
+}
+
+template <class T, class TH>
+T* CArrayShm<T, TH>::load_index(uint32_t index_id, const char* where, SHM_INDEX_VIEW* view, uint64_t* generation) {
+    if (!is_init_) {
+        this->set_err(SHM_ERR_NOT_INIT, where);
+        return nullptr;
+    }
+    TH header;
+    if (!get_header(&header)) {
+        this->wrap_err(where);
+        return nullptr;
+    }
+    if (parse_header(header) == 0) {
+        this->wrap_err(where);
+        return nullptr;
+    }
+    if (index_id >= get_index_count()) {
+        this->set_err(SHM_ERR_INDEX, where, index_id);
+        return nullptr;
+    }
+    *view = get_index(index_id);
+    // 与写者置为有效时的 release 配对，之后读到的条目和节点不早于该次发布
+    bool match = __atomic_load_n(&view->header->valid, __ATOMIC_ACQUIRE) != 0
+        && view->header->count == header.cur_node_count;
+    *generation = get_generation(header);
+    match = match && view->header->generation == *generation;
+    if (!match) {
+        this->set_err(SHM_ERR_INDEX, where, index_id);
+        return nullptr;
+    }
+    T* p_node = this->get_node_by_pos(0);
+    if (p_node == nullptr) {
+        this->set_err(SHM_ERR_NOT_ATTACH, where);
+    }
+    return p_node;
+}
+
+template <class T, class TH>
+bool CArrayShm<T, TH>::check_index(const SHM_INDEX_VIEW& view, uint32_t index_id, uint64_t generation,
+    const char* where) {
+    // 与写者置为无效后的 release 屏障配对：查询期间读到了新发布写入的数据，则一定能看到置为无效或新的代数
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    TH header;
+    bool match = __atomic_load_n(&view.header->valid, __ATOMIC_RELAXED) != 0
+        && view.header->generation == generation && get_header(&header) && get_generation(header) == generation;
+    if (!match) {
+        this->set_err(SHM_ERR_INDEX, where, index_id);
+    }
+    return match;
+}
+
+template <class T, class TH>
+template <class F>
+bool CArrayShm<T, TH>::range_query(uint32_t index_id, uint64_t low, uint64_t high, F&& node_func) {
+    SHM_INDEX_VIEW view;
+    uint64_t generation = 0;
+    T* p_node = load_index(index_id, "CArrayShm::range_query", &view, &generation);
+    if (p_node == nullptr) {
+        return false;
+    }
+    if (low > high) {
+        return true;
+    }
+    size_t end = view.upper_bound(high);
+    for (size_t i = view.lower_bound(low); i < end; ++i) {
+        uint32_t pos = view.pos[i];
+        if (pos >= view.header->count) {
+            this->set_err(SHM_ERR_INDEX, "CArrayShm::range_query", index_id);
+            return false;
+        }
+        if (!node_func(p_node + pos)) {
+            this->set_err(SHM_ERR_CALLBACK, "CArrayShm::range_query", pos);
+            return false;
+        }
+    }
+    return check_index(view, index_id, generation, "CArrayShm::range_query");
+}
+
+template <class T, class TH>
+template <class F>
+bool CArrayShm<T, TH>::top_k(uint32_t index_id, size_t k, F&& node_func) {
+    SHM_INDEX_VIEW view;
+    uint64_t generation = 0;
+    T* p_node = load_index(index_id, "CArrayShm::top_k", &view, &generation);
+    if (p_node == nullptr) {
+        return false;
+    }
+    size_t count = view.header->count;
+    size_t begin = count > k ? count - k : 0;
+    for (size_t i = count; i > begin; --i) {
+        uint32_t pos = view.pos[i - 1];
+        if (pos >= count) {
+            this->set_err(SHM_ERR_INDEX, "CArrayShm::top_k", index_id);
+            return false;
+        }
+        if (!node_func(p_node + pos)) {
+            this->set_err(SHM_ERR_CALLBACK, "CArrayShm::top_k", pos);
+            return false;
+        }
+    }
+    return check_index(view, index_id, generation, "CArrayShm::top_k");
+}
+
 }  // namespace thread_mem_shm_sdk
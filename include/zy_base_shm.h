@@ -13,21 +13,53 @@
 
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <errno.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#include "zy_shm_error.h"
+#include "zy_shm_numa.h"
+#include "zy_shm_prefault.h"
+#include "zy_utils.h"
 
 namespace thread_mem_shm_sdk {
 
+// 共享内存的可选项
+struct SHM_OPTIONS {
+    // 只读挂载（SHM_RDONLY），用于旁路观察，不能和创建同时使用
+    bool read_only = false;
+    // 创建时的 NUMA 放置策略，在首次写入之前设置，挂载已存在的共享内存时不生效
+    SHM_NUMA_POLICY numa_policy = SHM_NUMA_DEFAULT;
+    // SHM_NUMA_BIND、SHM_NUMA_INTERLEAVE 使用的节点掩码，第 i 位表示节点 i
+    uint64_t numa_nodes = 0;
+    // SHM_NUMA_CPUS 使用的 CPU 列表
+    std::vector<int> numa_cpus;
+    // 创建时的预分配方式，新创建的共享内存已由内核清零，默认只逐页触发缺页而不再 memset
+    SHM_PREFAULT_MODE prefault = SHM_PREFAULT_TOUCH;
+    // 预分配的线程数，段较小时会自动减少
+    uint32_t prefault_threads = 1;
+};
+
 /**
  * @brief 共享内存封装
+ * 使用 CRTP 静态多态，派生类需要实现以下两个函数（可以是私有的，需将 CShm 声明为友元）：
+ * 1. bool set_header()：创建后设置内存头
+ * 2. size_t parse_header(const TH& header)：挂载时解析内存头，返回整个共享内存的长度，出错返回 0
  * 
- * @tparam T 
- * @tparam TH 
+ * @tparam T 节点类型
+ * @tparam TH 内存头类型
+ * @tparam TDerived 派生类
  */
-template <class T, class TH>
+template <class T, class TH, class TDerived>
 class CShm {
+    static_assert(std::is_trivially_copyable<T>::value, "node type must be trivially copyable");
+    static_assert(std::is_trivially_copyable<TH>::value, "header type must be trivially copyable");
+
 public:
     // (address, length)
     using SHM_TYPE = std::pair<void*, size_t>;
@@ -35,7 +67,11 @@ public:
 
 public:
     CShm() = default;
-    ~CShm() = default;
+    ~CShm() {
+        if (is_attach_) {
+            detach();
+        }
+    }
     CShm(const CShm&) = delete;
     CShm& operator=(const CShm&) = delete;
     CShm(CShm&&) = delete;
@@ -48,10 +84,27 @@ public:
      * @param shm_key 
      * @param shm_body_size 
      * @param is_create 
+     * @param options 
      * @return true 
      * @return false 
      */
-    bool init(size_t shm_key, size_t shm_body_size = 0, bool is_create = false);
+    bool init(size_t shm_key, size_t shm_body_size = 0, bool is_create = false,
+        const SHM_OPTIONS& options = SHM_OPTIONS());
+
+    /**
+     * @brief 在一段已挂载的内存（如注册表中分配的区域）上初始化，不调用 shmget/shmat，
+     * 内存由调用者管理，析构时不卸载；NUMA 放置和预分配选项不生效
+     * 
+     * @param addr 
+     * @param capacity 这段内存的长度
+     * @param shm_body_size 
+     * @param is_create 
+     * @param options 
+     * @return true 
+     * @return false 
+     */
+    bool init_in_place(void* addr, size_t capacity, size_t shm_body_size = 0, bool is_create = false,
+        const SHM_OPTIONS& options = SHM_OPTIONS());
 
     /**
      * @brief 设置错误信息
@@ -61,40 +114,71 @@ public:
     void set_err_msg(const std::string& err_msg);
 
     /**
-     * @brief 获取错误信息
+     * @brief 获取错误信息，出错时只记录错误码，调用该函数时才格式化
      * 
      * @return std::string 
      */
     std::string get_err_msg() const;
 
-protected:
     /**
-     * @brief 设置内存头
+     * @brief 获取错误码
      * 
-     * @return true 
-     * @return false 
+     * @return SHM_ERR_CODE 
      */
-    virtual bool set_header() = 0;
+    SHM_ERR_CODE get_err_code() const {
+        return err_.code();
+    }
 
     /**
-     * @brief 解析内存头
+     * @brief 获取错误详情（错误码、errno、参数）
      * 
-     * @param header 
-     * @return uint32_t 
+     * @return const CShmError& 
      */
-    virtual uint32_t parse_header(const TH& header) = 0;
+    const CShmError& get_error() const {
+        return err_;
+    }
 
-public:
     /**
-     * @brief 遍历
+     * @brief 创建时是否成功设置了 NUMA 放置策略，mbind 失败时内存按 first touch 分配，不影响使用
      * 
-     * @param node_func 
      * @return true 
      * @return false 
      */
-    virtual bool traverse(TRAVERSE_METHOD_FUNC node_func) = 0;
+    bool is_numa_placed() const {
+        return numa_placed_;
+    }
+
+    /**
+     * @brief 获取创建耗时，挂载已存在的共享内存时各项为 0
+     * 
+     * @return const SHM_CREATE_TIMING& 
+     */
+    const SHM_CREATE_TIMING& get_create_timing() const {
+        return create_timing_;
+    }
 
 protected:
+    /**
+     * @brief 记录错误，不分配内存
+     * 
+     * @param code 
+     * @param where 出错位置，必须是字符串常量
+     * @param arg0 
+     * @param arg1 
+     */
+    void set_err(SHM_ERR_CODE code, const char* where, int64_t arg0 = 0, int64_t arg1 = 0) {
+        err_.set(code, where, arg0, arg1);
+    }
+
+    /**
+     * @brief 记录外层调用位置
+     * 
+     * @param context 必须是字符串常量
+     */
+    void wrap_err(const char* context) {
+        err_.wrap(context);
+    }
+
     /**
      * @brief 获取节点的地址
      * 
@@ -140,7 +224,35 @@ protected:
         return sizeof(T);
     }
 
+    /**
+     * @brief 是否只读挂载
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool is_read_only() const {
+        return options_.read_only;
+    }
+
+    /**
+     * @brief 获取共享内存起始地址，未挂载时返回 nullptr
+     * 
+     * @return char* 
+     */
+    char* get_shm_addr() const {
+        return is_attach_ ? reinterpret_cast<char*>(shm_.first) : nullptr;
+    }
+
 private:
+    /**
+     * @brief 获取派生类
+     * 
+     * @return TDerived* 
+     */
+    TDerived* derived() {
+        return static_cast<TDerived*>(this);
+    }
+
     /**
      * @brief 创建共享内存
      * 
@@ -209,24 +321,35 @@ private:
     bool is_create_{false};
     bool is_attach_{false};
     bool is_set_callback_{false};
+    bool numa_placed_{false};
+    // 在调用者的内存上初始化，不需要卸载
+    bool is_in_place_{false};
 
 private:
     size_t shm_key_{0};
     size_t shm_length_{0};
     size_t shm_header_len_{0};
     size_t shm_body_len_{0};
-    std::string err_msg_;
+    CShmError err_;
+    SHM_OPTIONS options_;
+    SHM_CREATE_TIMING create_timing_{};
 
     SHM_TYPE shm_;
     SHM_TYPE shm_header_;
     SHM_TYPE shm_body_;
 };
 
-template <class T, class TH>
-bool CShm<T, TH>::init(size_t shm_key, size_t shm_body_size /* =0 */, bool is_create /* =false */) {
+template <class T, class TH, class TDerived>
+bool CShm<T, TH, TDerived>::init(size_t shm_key, size_t shm_body_size /* =0 */, bool is_create /* =false */,
+    const SHM_OPTIONS& options /* =SHM_OPTIONS() */) {
+    if (is_create && options.read_only) {
+        set_err(SHM_ERR_READ_ONLY, "CShm::init");
+        return false;
+    }
     if (!is_create) {
         shm_body_size = 0;
     }
+    options_ = options;
     shm_key_ = shm_key;
     is_create_ = is_create;
 
@@ -236,7 +359,7 @@ bool CShm<T, TH>::init(size_t shm_key, size_t shm_body_size /* =0 */, bool is_cr
 
     is_init_ = false;
     if (is_create_ && shm_body_len_ == 0) {
-        set_err_msg("The specifying length is invalid (==0) when creating SHM");
+        set_err(SHM_ERR_INVALID_PARAM, "CShm::init", 0, 0);
         return false;
     }
     // 尝试挂载，如果挂载成功说明不需要重新 create
@@ -249,39 +372,88 @@ bool CShm<T, TH>::init(size_t shm_key, size_t shm_body_size /* =0 */, bool is_cr
         if (header == nullptr) {
             return false;
         }
-        // 虚函数，继承类实现，返回共享内存的大小
-        size_t length = this->parse_header(*header);
+        // 派生类实现，返回共享内存的大小
+        size_t length = derived()->parse_header(*header);
         do_detach(header);
-        if (length <= 0) {
+        if (length == 0) {
             return false;
         }
         shm_length_ = length;
-        attach();
+        if (!attach()) {
+            return false;
+        }
     } else {
         // // 尝试挂载内存失败，或者指定需要创建的情况
+        uint64_t begin_ns = get_now_monotonic_time_ns();
         if (!create()) {
             return false;
         }
-        // 虚函数，继承类实现
-        if (!this->set_header()) {
+        // 派生类实现
+        if (!derived()->set_header()) {
             return false;
         }
+        create_timing_.total_ns = get_now_monotonic_time_ns() - begin_ns;
     }
     is_init_ = true;
     return true;
 }
 
-template <class T, class TH>
-bool CShm<T, TH>::create() {
+template <class T, class TH, class TDerived>
+bool CShm<T, TH, TDerived>::init_in_place(void* addr, size_t capacity, size_t shm_body_size /* =0 */,
+    bool is_create /* =false */, const SHM_OPTIONS& options /* =SHM_OPTIONS() */) {
+    if (is_create && options.read_only) {
+        set_err(SHM_ERR_READ_ONLY, "CShm::init_in_place");
+        return false;
+    }
+    shm_header_len_ = get_header_size();
+    if (addr == nullptr || capacity < shm_header_len_ || (is_create && shm_body_size == 0)) {
+        set_err(SHM_ERR_INVALID_PARAM, "CShm::init_in_place", capacity, shm_body_size);
+        return false;
+    }
+    options_ = options;
+    shm_key_ = 0;
+    is_create_ = is_create;
+    is_init_ = false;
+    if (is_create_) {
+        shm_length_ = shm_header_len_ + shm_body_size;
+    } else {
+        // 派生类实现，返回共享内存的大小
+        shm_length_ = derived()->parse_header(*reinterpret_cast<TH*>(addr));
+        if (shm_length_ == 0) {
+            return false;
+        }
+    }
+    if (shm_length_ > capacity) {
+        set_err(SHM_ERR_INVALID_PARAM, "CShm::init_in_place", capacity, shm_length_);
+        return false;
+    }
+    shm_body_len_ = shm_length_ - shm_header_len_;
+    shm_.first = addr;
+    shm_.second = shm_length_;
+    shm_header_.first = addr;
+    shm_header_.second = shm_header_len_;
+    shm_body_.first = reinterpret_cast<char*>(addr) + shm_header_len_;
+    shm_body_.second = shm_body_len_;
+    is_attach_ = true;
+    is_in_place_ = true;
+    if (is_create_ && !derived()->set_header()) {
+        return false;
+    }
+    is_init_ = true;
+    return true;
+}
+
+template <class T, class TH, class TDerived>
+bool CShm<T, TH, TDerived>::create() {
     if (!is_create_ || shm_length_ == 0) {
-        err_msg_ = "Parameter initialized error";
+        set_err(SHM_ERR_INVALID_PARAM, "CShm::create");
         return false;
     }
     void* p_shm = nullptr;
     int flag = 0666 | IPC_CREAT;
     int ret = get_shm(&p_shm, shm_key_, shm_length_, flag);
     if (ret < 0) {
-        err_msg_ = "Failed to create shared memory";
+        // get_shm 中已记录错误
         return false;
     }
     shm_.first = p_shm;
@@ -297,10 +469,10 @@ bool CShm<T, TH>::create() {
     return is_attach_;
 }
 
-template <class T, class TH>
-bool CShm<T, TH>::attach() {
+template <class T, class TH, class TDerived>
+bool CShm<T, TH, TDerived>::attach() {
     if (is_create_ || shm_length_ == 0) {
-        err_msg_ = "Not initialized";
+        set_err(SHM_ERR_NOT_INIT, "CShm::attach");
         return false;
     }
     void* p_shm = do_attach(shm_length_);
@@ -320,30 +492,32 @@ bool CShm<T, TH>::attach() {
     return is_attach_;
 }
 
-template <class T, class TH>
-bool CShm<T, TH>::detach() {
+template <class T, class TH, class TDerived>
+bool CShm<T, TH, TDerived>::detach() {
     if (!is_attach_) {
-        err_msg_ = "Not attach";
+        set_err(SHM_ERR_NOT_ATTACH, "CShm::detach");
         return false;
     }
-    do_detach(shm_.first);
+    if (!is_in_place_) {
+        do_detach(shm_.first);
+    }
     is_attach_ = false;
     return true;
 }
 
-template <class T, class TH>
-void* CShm<T, TH>::do_attach(size_t length) {
+template <class T, class TH, class TDerived>
+void* CShm<T, TH, TDerived>::do_attach(size_t length) {
     int flag = 0666;
     void* p_shm = get_shm(shm_key_, length, flag);
     if (p_shm == nullptr) {
-        err_msg_ = "Failed to attach shared memory";
+        // get_shm 中已记录错误
         return nullptr;
     }
     return p_shm;
 }
 
-template <class T, class TH>
-bool CShm<T, TH>::do_detach(void* p_shm) {
+template <class T, class TH, class TDerived>
+bool CShm<T, TH, TDerived>::do_detach(void* p_shm) {
     if (nullptr == p_shm) {
         return false;
     }
@@ -351,38 +525,38 @@ bool CShm<T, TH>::do_detach(void* p_shm) {
     return true;
 }
 
-template <class T, class TH>
-void CShm<T, TH>::set_err_msg(const std::string& err_msg) {
-    err_msg_ = err_msg;
+template <class T, class TH, class TDerived>
+void CShm<T, TH, TDerived>::set_err_msg(const std::string& err_msg) {
+    err_.set_custom(err_msg);
 }
 
-template <class T, class TH>
-std::string CShm<T, TH>::get_err_msg() const {
-    return err_msg_;
+template <class T, class TH, class TDerived>
+std::string CShm<T, TH, TDerived>::get_err_msg() const {
+    return err_.to_string();
 }
 
-template <class T, class TH>
-bool CShm<T, TH>::do_set_header(const TH& header) {
+template <class T, class TH, class TDerived>
+bool CShm<T, TH, TDerived>::do_set_header(const TH& header) {
     if (false == is_attach_) {
-        err_msg_ = "Not attach";
+        set_err(SHM_ERR_NOT_ATTACH, "CShm::do_set_header");
         return false;
     }
     memcpy(shm_header_.first, &header, get_header_size());
     return true;
 }
 
-template <class T, class TH>
-bool CShm<T, TH>::do_get_header(TH* header) {
+template <class T, class TH, class TDerived>
+bool CShm<T, TH, TDerived>::do_get_header(TH* header) {
     if (false == is_attach_) {
-        err_msg_ = "Not attach";
+        set_err(SHM_ERR_NOT_ATTACH, "CShm::do_get_header");
         return false;
     }
     memcpy(header, shm_header_.first, get_header_size());
     return true;
 }
 
-template <class T, class TH>
-T* CShm<T, TH>::get_node_by_pos(size_t pos, size_t offset) const {
+template <class T, class TH, class TDerived>
+T* CShm<T, TH, TDerived>::get_node_by_pos(size_t pos, size_t offset) const {
     if (false == is_attach_) {
         return nullptr;
     }
@@ -390,49 +564,51 @@ T* CShm<T, TH>::get_node_by_pos(size_t pos, size_t offset) const {
     return (shm_body + pos);
 }
 
-template <class T, class TH>
-void* CShm<T, TH>::get_shm(size_t shm_key, size_t shm_size, int flag) {
-    char msg[1024] = {0};
+template <class T, class TH, class TDerived>
+void* CShm<T, TH, TDerived>::get_shm(size_t shm_key, size_t shm_size, int flag) {
     if (shm_key == 0) {
-        snprintf(msg, sizeof(msg), "[CShm::get_shm] shm_key: %zu should lager than 0", shm_key);
-        set_err_msg(msg);
+        set_err(SHM_ERR_INVALID_PARAM, "CShm::get_shm");
         return nullptr;
     }
     int shm_id = shmget(shm_key, shm_size, flag);
     if (shm_id < 0) {
-        snprintf(msg, sizeof(msg), "[CShm::get_shm] Failed to call shmget, ret: %d, key: %zu, size: %zu, reason: %s",
-            shm_id, shm_key, shm_size, strerror(errno));
-        set_err_msg(msg);
+        err_.set_sys(SHM_ERR_SHMGET, "CShm::get_shm", shm_key, shm_size);
         return nullptr;
     }
-    void* p_shm = shmat(shm_id, nullptr, 0);
-    if (p_shm == nullptr) {
-        snprintf(msg, sizeof(msg), "[CShm::get_shm] Failed to call shmat");
+    void* p_shm = shmat(shm_id, nullptr, options_.read_only ? SHM_RDONLY : 0);
+    if (p_shm == reinterpret_cast<void*>(-1)) {
+        err_.set_sys(SHM_ERR_SHMAT, "CShm::get_shm", shm_key);
         return nullptr;
     }
     return p_shm;
 }
 
-template <class T, class TH>
-int CShm<T, TH>::get_shm(void** pp_shm, size_t shm_key, size_t shm_size, int flag) {
-    char msg[1024] = {0};
+template <class T, class TH, class TDerived>
+int CShm<T, TH, TDerived>::get_shm(void** pp_shm, size_t shm_key, size_t shm_size, int flag) {
     if (shm_key == 0) {
-        snprintf(msg, sizeof(msg), "[CShm::get_shm] shm_key: %zu should lager than 0", shm_key);
-        set_err_msg(msg);
+        set_err(SHM_ERR_INVALID_PARAM, "CShm::get_shm");
         return -1;
     }
     void* p_shm = get_shm(shm_key, shm_size, flag & (~IPC_CREAT));
     if (nullptr == p_shm) {
         if (!(flag & IPC_CREAT)) {
-            snprintf(msg, sizeof(msg), "[CShm::get_shm] Try to attach shm which is not exist! shm_key: %zu", shm_key);
-            set_err_msg(msg);
+            set_err(SHM_ERR_NOT_EXIST, "CShm::get_shm", shm_key);
             return -2;
         }
+        uint64_t begin_ns = get_now_monotonic_time_ns();
         p_shm = get_shm(shm_key, shm_size, flag);
         if (nullptr == p_shm) {
             return -3;
         }
-        memset(p_shm, 0, shm_size);
+        uint64_t get_end_ns = get_now_monotonic_time_ns();
+        // 放置策略只对尚未分配的页生效，必须在预分配之前设置
+        numa_placed_ = numa_apply_policy(p_shm, shm_size, options_.numa_policy, options_.numa_nodes,
+            options_.numa_cpus);
+        uint64_t numa_end_ns = get_now_monotonic_time_ns();
+        shm_prefault(p_shm, shm_size, options_.prefault, options_.prefault_threads, &create_timing_);
+        create_timing_.get_ns = get_end_ns - begin_ns;
+        create_timing_.numa_ns = numa_end_ns - get_end_ns;
+        create_timing_.prefault_ns = get_now_monotonic_time_ns() - numa_end_ns;
         *pp_shm = p_shm;
         return 1;
     }
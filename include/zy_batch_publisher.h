@@ -0,0 +1,477 @@
+/**
+ * @file zy_batch_publisher.h
+ * @author noahyzhang
+ * @brief 批量异步发布
+ * 业务线程把记录追加到各自的线程局部环形缓冲区（单生产者单消费者，不等待后台线程），线程退出后缓冲区被回收复用，
+ * 后台线程按固定周期或积压条数合并后加锁发布到 CArrayShm，业务线程不会阻塞在信号量等进程间操作上
+ * @version 0.1
+ * @date 2023-05-30
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "zy_array_shm.h"
+#include "zy_semaphore.h"
+#include "zy_shm_error.h"
+
+namespace thread_mem_shm_sdk {
+
+// 批量发布的可选项
+struct BATCH_PUBLISHER_OPTIONS {
+    // 发布周期（毫秒）
+    uint32_t flush_interval_ms = 10;
+    // 单个线程积压的记录达到该条数时提前唤醒后台线程，0 表示只按周期发布
+    uint32_t batch_size = 256;
+    // 每个线程的环形缓冲区容量（条），向上取整为 2 的幂，写满后新记录被丢弃
+    uint32_t ring_capacity = 1024;
+    // 同时追加的最多业务线程数，超出的线程追加的记录被丢弃；线程退出后其缓冲区被取空后由新线程复用
+    uint32_t max_threads = 256;
+};
+
+// 批量发布的统计
+struct BATCH_PUBLISHER_STATS {
+    // 追加成功的记录数
+    uint64_t append_count;
+    // 缓冲区满、线程数超限、超出共享内存容量（无 key 时为较早的记录，有 key 时为新的 key）而丢弃的记录数
+    uint64_t drop_count;
+    // 发布次数
+    uint64_t flush_count;
+    // 发布失败次数
+    uint64_t flush_fail_count;
+    // 合并的记录数
+    uint64_t merge_count;
+};
+
+/**
+ * @brief 批量异步发布
+ * 未设置 key 函数时，每次发布的内容为上次成功发布之后追加的记录（超出 max_node_count 时保留最新的）；
+ * 设置 key 函数后按 key 合并，同一 key 只保留最新的记录，发布的内容为所有 key 的最新记录，
+ * 不同 key 的个数最多为 max_node_count，之后出现的新 key 的记录被丢弃并计入 drop_count。
+ * 发布失败时暂存的记录保留到下一次发布
+ *
+ * @tparam T 节点类型
+ * @tparam TH 头部类型
+ */
+template <class T, class TH = ARRAY_SHM_HEADER>
+class CBatchPublisher {
+public:
+    // 记录的 key，用于合并
+    using KEY_FUNC = uint64_t (*)(const T& record);
+
+public:
+    CBatchPublisher() : id_(next_id()) {}
+    ~CBatchPublisher() { stop(); }
+    CBatchPublisher(const CBatchPublisher&) = delete;
+    CBatchPublisher& operator=(const CBatchPublisher&) = delete;
+    CBatchPublisher(CBatchPublisher&&) = delete;
+    CBatchPublisher& operator=(CBatchPublisher&&) = delete;
+
+public:
+    /**
+     * @brief 初始化
+     *
+     * @param array_shm 已初始化的共享内存
+     * @param sem 发布时加的锁，可以为 nullptr
+     * @param options
+     * @param key_func 合并记录使用的 key，可以为 nullptr
+     * @return true
+     * @return false
+     */
+    bool init(CArrayShm<T, TH>* array_shm, CSemaphore* sem,
+        const BATCH_PUBLISHER_OPTIONS& options = BATCH_PUBLISHER_OPTIONS(), KEY_FUNC key_func = nullptr);
+
+    /**
+     * @brief 启动后台发布线程
+     *
+     * @return true
+     * @return false
+     */
+    bool start();
+
+    /**
+     * @brief 停止后台发布线程，停止前发布剩余的记录
+     *
+     */
+    void stop();
+
+    /**
+     * @brief 追加一条记录，线程第一次调用时注册自己的缓冲区（优先复用已退出线程的缓冲区）
+     * 不等待后台线程，只在积压刚达到 batch_size 时短暂持有唤醒锁
+     *
+     * @param record
+     * @return true
+     * @return false 缓冲区已满或线程数超限，记录被丢弃
+     */
+    bool append(const T& record);
+
+    /**
+     * @brief 立即合并并发布，只能在后台线程未启动时调用，或由后台线程调用
+     *
+     * @return true
+     * @return false
+     */
+    bool flush();
+
+    /**
+     * @brief 获取统计
+     *
+     * @return BATCH_PUBLISHER_STATS
+     */
+    BATCH_PUBLISHER_STATS get_stats() const;
+
+    /**
+     * @brief 获取最近一次发布失败的错误码
+     *
+     * @return SHM_ERR_CODE
+     */
+    SHM_ERR_CODE get_err_code() const { return static_cast<SHM_ERR_CODE>(err_code_.load(std::memory_order_relaxed)); }
+
+private:
+    // 缓冲区的状态
+    enum RING_STATE : uint32_t {
+        // 没有线程使用，可以被新线程认领
+        RING_FREE = 0,
+        // 属于某个存活的线程
+        RING_ACTIVE = 1,
+        // 所属线程已退出，后台线程取空后置为 RING_FREE
+        RING_RETIRED = 2,
+    };
+
+    // 单生产者单消费者环形缓冲区，生产者和消费者的下标放在不同的缓存行上
+    struct RING {
+        alignas(64) std::atomic<uint64_t> tail{0};
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) uint64_t mask{0};
+        std::atomic<uint32_t> state{RING_ACTIVE};
+        std::unique_ptr<T[]> slots;
+    };
+
+    // 线程局部的缓冲区缓存，线程和发布器都持有缓冲区，任意一方先退出都不会访问已释放的内存
+    struct TLS_ENTRY {
+        uint64_t publisher_id;
+        std::shared_ptr<RING> ring;
+    };
+
+    // 线程退出时析构，把本线程的缓冲区交给后台线程回收
+    struct TLS_RINGS {
+        std::vector<TLS_ENTRY> entries;
+        ~TLS_RINGS() {
+            for (const TLS_ENTRY& entry : entries) {
+                // 与后台线程读取状态的 acquire 配对，之前追加的记录都可见
+                entry.ring->state.store(RING_RETIRED, std::memory_order_release);
+            }
+        }
+    };
+
+private:
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> id{0};
+        return id.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    /**
+     * @brief 获取当前线程的缓冲区，第一次调用时注册
+     *
+     * @return RING*
+     */
+    RING* get_ring();
+
+    /**
+     * @brief 后台线程
+     *
+     */
+    void run();
+
+    /**
+     * @brief 取出所有缓冲区中的记录并合并
+     *
+     * @return size_t 取出的记录数
+     */
+    size_t drain();
+
+private:
+    uint64_t id_;
+    CArrayShm<T, TH>* array_shm_{nullptr};
+    CSemaphore* sem_{nullptr};
+    BATCH_PUBLISHER_OPTIONS options_;
+    KEY_FUNC key_func_{nullptr};
+    uint64_t ring_capacity_{0};
+
+    // 已注册的缓冲区，注册和后台线程复制列表时加锁
+    std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<RING>> rings_;
+    std::atomic<uint32_t> ring_count_{0};
+    // 可以复用的缓冲区个数，为 0 时超限的线程不加锁直接丢弃
+    std::atomic<uint32_t> free_ring_count_{0};
+
+    // 后台线程
+    std::thread flusher_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> wake_{false};
+
+    // 以下只由发布线程访问
+    std::vector<RING*> drain_rings_;
+    std::vector<T> publish_nodes_;
+    std::unordered_map<uint64_t, size_t> key_index_;
+    bool dirty_{false};
+
+    std::atomic<uint64_t> append_count_{0};
+    std::atomic<uint64_t> drop_count_{0};
+    std::atomic<uint64_t> flush_count_{0};
+    std::atomic<uint64_t> flush_fail_count_{0};
+    std::atomic<uint64_t> merge_count_{0};
+    std::atomic<int> err_code_{SHM_OK};
+};
+
+template <class T, class TH>
+bool CBatchPublisher<T, TH>::init(CArrayShm<T, TH>* array_shm, CSemaphore* sem,
+    const BATCH_PUBLISHER_OPTIONS& options, KEY_FUNC key_func) {
+    if (array_shm == nullptr || options.ring_capacity == 0 || running_.load()) {
+        err_code_.store(SHM_ERR_INVALID_PARAM, std::memory_order_relaxed);
+        return false;
+    }
+    array_shm_ = array_shm;
+    sem_ = sem;
+    options_ = options;
+    key_func_ = key_func;
+    ring_capacity_ = 1;
+    while (ring_capacity_ < options.ring_capacity) {
+        ring_capacity_ <<= 1;
+    }
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    rings_.reserve(options.max_threads);
+    return true;
+}
+
+template <class T, class TH>
+bool CBatchPublisher<T, TH>::start() {
+    if (array_shm_ == nullptr || running_.exchange(true)) {
+        err_code_.store(SHM_ERR_NOT_INIT, std::memory_order_relaxed);
+        return false;
+    }
+    flusher_ = std::thread(&CBatchPublisher::run, this);
+    return true;
+}
+
+template <class T, class TH>
+void CBatchPublisher<T, TH>::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wake_.store(true, std::memory_order_relaxed);
+    }
+    wake_cv_.notify_one();
+    flusher_.join();
+    flush();
+}
+
+template <class T, class TH>
+typename CBatchPublisher<T, TH>::RING* CBatchPublisher<T, TH>::get_ring() {
+    static thread_local TLS_RINGS tls_rings;
+    for (const TLS_ENTRY& entry : tls_rings.entries) {
+        if (entry.publisher_id == id_) {
+            return entry.ring.get();
+        }
+    }
+    // 线程数已达上限且没有可复用的缓冲区，不加锁直接丢弃；未注册成功不缓存，之后有缓冲区被回收时再注册
+    bool full = ring_count_.load(std::memory_order_relaxed) >= options_.max_threads;
+    if (full && free_ring_count_.load(std::memory_order_acquire) == 0) {
+        return nullptr;
+    }
+    // 第一次追加，注册缓冲区（每个线程只发生一次）
+    std::shared_ptr<RING> ring;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        for (const auto& free_ring : rings_) {
+            uint32_t state = RING_FREE;
+            if (free_ring->state.compare_exchange_strong(state, RING_ACTIVE, std::memory_order_acquire)) {
+                free_ring_count_.fetch_sub(1, std::memory_order_relaxed);
+                ring = free_ring;
+                break;
+            }
+        }
+        if (ring == nullptr && rings_.size() < options_.max_threads) {
+            ring.reset(new RING());
+            ring->mask = ring_capacity_ - 1;
+            ring->slots.reset(new T[ring_capacity_]);
+            rings_.push_back(ring);
+            ring_count_.store(static_cast<uint32_t>(rings_.size()), std::memory_order_release);
+        }
+    }
+    if (ring == nullptr) {
+        return nullptr;
+    }
+    // 顺带清理已析构的发布器留下的缓存，此时只有本线程持有其缓冲区
+    auto& entries = tls_rings.entries;
+    for (size_t i = 0; i < entries.size();) {
+        if (entries[i].ring.use_count() == 1) {
+            entries[i] = std::move(entries.back());
+            entries.pop_back();
+        } else {
+            ++i;
+        }
+    }
+    entries.push_back(TLS_ENTRY{id_, ring});
+    return ring.get();
+}
+
+template <class T, class TH>
+bool CBatchPublisher<T, TH>::append(const T& record) {
+    RING* ring = get_ring();
+    if (ring == nullptr) {
+        drop_count_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    if (tail - head > ring->mask) {
+        drop_count_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    ring->slots[tail & ring->mask] = record;
+    ring->tail.store(tail + 1, std::memory_order_release);
+    append_count_.fetch_add(1, std::memory_order_relaxed);
+    // 积压刚达到阈值时唤醒后台线程，wake_ 在锁内修改，后台线程检查条件和开始等待之间不会丢失唤醒
+    if (options_.batch_size > 0 && tail + 1 - head == options_.batch_size) {
+        bool notify = false;
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            notify = !wake_.exchange(true, std::memory_order_relaxed);
+        }
+        if (notify) {
+            wake_cv_.notify_one();
+        }
+    }
+    return true;
+}
+
+template <class T, class TH>
+size_t CBatchPublisher<T, TH>::drain() {
+    uint32_t ring_count = ring_count_.load(std::memory_order_acquire);
+    if (drain_rings_.size() < ring_count) {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        drain_rings_.clear();
+        for (const auto& ring : rings_) {
+            drain_rings_.push_back(ring.get());
+        }
+    }
+    // 无 key 时 publish_nodes_ 在发布成功后才清空，发布失败的记录与新记录一起在下一次发布
+    size_t max_count = array_shm_->get_max_node_count();
+    size_t drained = 0;
+    for (RING* ring : drain_rings_) {
+        // 先读状态再读 tail：读到已退出时，该线程追加的所有记录都在本次取出
+        bool retired = ring->state.load(std::memory_order_acquire) == RING_RETIRED;
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            const T& record = ring->slots[head & ring->mask];
+            if (key_func_ == nullptr) {
+                publish_nodes_.push_back(record);
+                continue;
+            }
+            uint64_t key = key_func_(record);
+            auto it = key_index_.find(key);
+            if (it != key_index_.end()) {
+                publish_nodes_[it->second] = record;
+                merge_count_.fetch_add(1, std::memory_order_relaxed);
+            } else if (publish_nodes_.size() < max_count) {
+                key_index_.emplace(key, publish_nodes_.size());
+                publish_nodes_.push_back(record);
+            } else {
+                // key 的个数已达共享内存容量，发布时也会被截断，直接丢弃
+                drop_count_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        drained += tail - ring->head.load(std::memory_order_relaxed);
+        ring->head.store(tail, std::memory_order_release);
+        uint32_t state = RING_RETIRED;
+        if (retired && ring->state.compare_exchange_strong(state, RING_FREE, std::memory_order_release)) {
+            free_ring_count_.fetch_add(1, std::memory_order_release);
+        }
+    }
+    // 超出容量时保留最新的记录，注意按线程顺序取出，"最新"指各线程中靠后追加的记录
+    if (key_func_ == nullptr && publish_nodes_.size() > max_count) {
+        size_t excess = publish_nodes_.size() - max_count;
+        publish_nodes_.erase(publish_nodes_.begin(), publish_nodes_.begin() + excess);
+        drop_count_.fetch_add(excess, std::memory_order_relaxed);
+    }
+    return drained;
+}
+
+template <class T, class TH>
+bool CBatchPublisher<T, TH>::flush() {
+    if (array_shm_ == nullptr) {
+        err_code_.store(SHM_ERR_NOT_INIT, std::memory_order_relaxed);
+        return false;
+    }
+    dirty_ = (drain() > 0) || dirty_;
+    if (!dirty_) {
+        return true;
+    }
+    // drain 已把记录数限制在共享内存的容量以内
+    const T* nodes = publish_nodes_.data();
+    size_t count = publish_nodes_.size();
+    if (sem_ != nullptr && !sem_->lock()) {
+        flush_fail_count_.fetch_add(1, std::memory_order_relaxed);
+        err_code_.store(sem_->get_err_code(), std::memory_order_relaxed);
+        return false;
+    }
+    int ret = array_shm_->insert(nodes, count);
+    if (sem_ != nullptr) {
+        sem_->unlock();
+    }
+    if (ret < 0) {
+        flush_fail_count_.fetch_add(1, std::memory_order_relaxed);
+        err_code_.store(array_shm_->get_err_code(), std::memory_order_relaxed);
+        return false;
+    }
+    // 发布成功后才丢弃本批记录，失败时保留到下一次发布，不会用空数组覆盖已发布的数据
+    if (key_func_ == nullptr) {
+        publish_nodes_.clear();
+    }
+    dirty_ = false;
+    flush_count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+template <class T, class TH>
+void CBatchPublisher<T, TH>::run() {
+    auto interval = std::chrono::milliseconds(options_.flush_interval_ms);
+    while (running_.load(std::memory_order_relaxed)) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            wake_cv_.wait_for(lock, interval, [this]() { return wake_.load(std::memory_order_relaxed); });
+            wake_.store(false, std::memory_order_relaxed);
+        }
+        flush();
+    }
+}
+
+template <class T, class TH>
+BATCH_PUBLISHER_STATS CBatchPublisher<T, TH>::get_stats() const {
+    BATCH_PUBLISHER_STATS stats;
+    stats.append_count = append_count_.load(std::memory_order_relaxed);
+    stats.drop_count = drop_count_.load(std::memory_order_relaxed);
+    stats.flush_count = flush_count_.load(std::memory_order_relaxed);
+    stats.flush_fail_count = flush_fail_count_.load(std::memory_order_relaxed);
+    stats.merge_count = merge_count_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+}  // namespace thread_mem_shm_sdk
@@ -0,0 +1,100 @@
+/**
+ * @file zy_malloc_hook.h
+ * @author noahyzhang
+ * @brief 分配器接入：按线程统计分配和释放的内存，定期发布到 CArrayShm<THREAD_MEM_NODE>
+ * libzy_malloc_hook.so 通过 LD_PRELOAD 加载或直接链接，拦截 malloc/free 等函数后转发给下一个分配器
+ * （glibc、jemalloc、tcmalloc 均可），按 malloc_usable_size 计入当前线程的计数；
+ * 使用分配器自身回调的程序链接 libzy_mem_stats.so，在回调中调用 mem_hook_record_alloc / mem_hook_record_free。
+ * 热路径上计数只是一次线程局部变量的累加，不加锁、不分配内存，后台线程按周期汇总所有线程的计数后整段发布；
+ * 拦截时每次分配和释放还要多调用一次 malloc_usable_size，这是主要开销（glibc 上小块 malloc/free 一对多 10~20 ns）
+ * @version 0.1
+ * @date 2023-06-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thread_mem_shm_sdk {
+
+/**
+ * @brief 每个线程的内存统计，与示例中的 DataNode 布局相同
+ * 分配和释放均为累计值（KB），超过 uint32_t 后回绕，读者按差值计算速率；
+ * 已退出的线程以及超出线程上限的线程合并到 tid 为 0 的节点
+ */
+struct THREAD_MEM_NODE {
+    uint32_t tid;
+    uint32_t arena_id;
+    uint32_t allocated_kb;
+    uint32_t deallocated_kb;
+};
+
+// 最多同时统计的线程个数，共享内存的节点个数为该值加一（合并节点）
+const uint32_t g_mem_hook_max_threads = 4096;
+// 默认的发布周期
+const uint32_t g_mem_hook_interval_ms = 1000;
+
+/**
+ * 通过 LD_PRELOAD 加载时使用的环境变量，设置了 ZY_MEM_HOOK_SHM_KEY 才会在加载时启动发布：
+ * ZY_MEM_HOOK_SHM_KEY       共享内存的 key，支持 0x 前缀
+ * ZY_MEM_HOOK_INTERVAL_MS   发布周期，默认 g_mem_hook_interval_ms
+ * ZY_MEM_HOOK_KEY_PER_PID   非 0 时 key 加上进程号，多个进程继承同一环境变量时互不覆盖
+ */
+
+// 发布选项
+struct MEM_HOOK_OPTIONS {
+    size_t shm_key = 0;
+    uint32_t interval_ms = g_mem_hook_interval_ms;
+    // 在共享内存尾部附加统计块
+    bool enable_stats = true;
+};
+
+/**
+ * @brief 启动后台发布线程，已启动时返回 false
+ * fork 出的子进程中发布被停止，子进程需要以不同的 shm_key 重新调用
+ *
+ * @param options
+ * @return true
+ * @return false
+ */
+bool mem_hook_start(const MEM_HOOK_OPTIONS& options);
+
+/**
+ * @brief 停止后台发布线程，停止前发布一次
+ *
+ */
+void mem_hook_stop();
+
+/**
+ * @brief 立即发布一次
+ *
+ * @return int 发布的节点个数，未启动或出错返回 -1
+ */
+int mem_hook_flush();
+
+/**
+ * @brief 计入当前线程的一次分配，供分配器回调使用
+ *
+ * @param size
+ */
+void mem_hook_record_alloc(size_t size);
+
+/**
+ * @brief 计入当前线程的一次释放，供分配器回调使用
+ *
+ * @param size
+ */
+void mem_hook_record_free(size_t size);
+
+/**
+ * @brief 设置当前线程的 arena 编号（如 jemalloc 的 thread.arena），默认为 0
+ *
+ * @param arena_id
+ */
+void mem_hook_set_arena(uint32_t arena_id);
+
+}  // namespace thread_mem_shm_sdk
@@ -0,0 +1,281 @@
+/**
+ * @file zy_replicated_array_shm.h
+ * @author noahyzhang
+ * @brief 按 NUMA 节点复制的数组共享内存
+ * 写者为每个节点创建一份绑定在该节点上的副本，每次发布写入所有副本；
+ * 读者挂载所在节点的副本，遍历时只访问本地内存。节点 n 的副本使用 key: shm_key + n
+ * @version 0.1
+ * @date 2023-05-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "zy_array_shm.h"
+#include "zy_shm_error.h"
+#include "zy_shm_numa.h"
+
+namespace thread_mem_shm_sdk {
+
+/**
+ * @brief 按节点复制的数组共享内存
+ *
+ * @tparam T 节点类型
+ * @tparam TH 头部类型
+ */
+template <class T, class TH = ARRAY_SHM_HEADER>
+class CReplicatedArrayShm {
+public:
+    using ARRAY_SHM = CArrayShm<T, TH>;
+
+public:
+    CReplicatedArrayShm() = default;
+    ~CReplicatedArrayShm() = default;
+    CReplicatedArrayShm(const CReplicatedArrayShm&) = delete;
+    CReplicatedArrayShm& operator=(const CReplicatedArrayShm&) = delete;
+    CReplicatedArrayShm(CReplicatedArrayShm&&) = delete;
+    CReplicatedArrayShm& operator=(CReplicatedArrayShm&&) = delete;
+
+public:
+    /**
+     * @brief 初始化
+     * 1. 写者 is_create=true：为 options.numa_nodes 中的每个节点（为 0 时为所有在线节点）创建或挂载一份副本，
+     *    每份副本绑定到对应节点，options 中的 numa_policy 被忽略
+     * 2. 读者 is_create=false：挂载 options.numa_nodes 中编号最小的节点的副本，为 0 时使用当前所在节点，
+     *    该节点没有副本时依次尝试其他在线节点
+     * 不在线的节点映射到在线节点上放置，单节点机器上也可以创建多份副本
+     *
+     * @param shm_key
+     * @param node_count
+     * @param is_create
+     * @param options
+     * @return true
+     * @return false
+     */
+    bool init(size_t shm_key, size_t node_count = 0, bool is_create = false,
+        const ARRAY_SHM_OPTIONS& options = ARRAY_SHM_OPTIONS());
+
+    /**
+     * @brief 发布到所有副本
+     *
+     * @param node_vec
+     * @return int 写入的节点个数，出错返回 -1
+     */
+    int insert(const std::vector<T>& node_vec) {
+        return insert(node_vec.data(), node_vec.size());
+    }
+
+    /**
+     * @brief 整段发布到所有副本
+     *
+     * @param nodes
+     * @param count
+     * @return int 写入的节点个数，出错返回 -1
+     */
+    int insert(const T* nodes, size_t count);
+
+    /**
+     * @brief 遍历本地副本
+     *
+     * @tparam F 形如 bool(T* node)
+     * @param node_func
+     * @return true
+     * @return false
+     */
+    template <class F>
+    bool traverse(F&& node_func) {
+        if (replicas_.empty()) {
+            err_.set(SHM_ERR_NOT_INIT, "CReplicatedArrayShm::traverse");
+            return false;
+        }
+        return check(replicas_[0].second->traverse(std::forward<F>(node_func)), 0);
+    }
+
+    /**
+     * @brief 遍历本地副本，同时预取后续节点
+     *
+     * @tparam F 形如 bool(T* node)
+     * @param node_func
+     * @return true
+     * @return false
+     */
+    template <class F>
+    bool traverse_prefetch(F&& node_func) {
+        if (replicas_.empty()) {
+            err_.set(SHM_ERR_NOT_INIT, "CReplicatedArrayShm::traverse_prefetch");
+            return false;
+        }
+        return check(replicas_[0].second->traverse_prefetch(std::forward<F>(node_func)), 0);
+    }
+
+    /**
+     * @brief 获取本地副本的头部
+     *
+     * @param header
+     * @return true
+     * @return false
+     */
+    bool get_header(TH* header);
+
+    /**
+     * @brief 拷贝本地副本的快照
+     *
+     * @param header
+     * @param node_vec
+     * @return true
+     * @return false
+     */
+    bool snapshot(TH* header, std::vector<T>* node_vec);
+
+    /**
+     * @brief 副本个数，读者为 1
+     *
+     * @return size_t
+     */
+    size_t get_replica_count() const { return replicas_.size(); }
+
+    /**
+     * @brief 第 idx 个副本所属的节点
+     *
+     * @param idx
+     * @return int
+     */
+    int get_replica_node(size_t idx) const { return replicas_[idx].first; }
+
+    /**
+     * @brief 第 idx 个副本，读者只有本地副本
+     *
+     * @param idx
+     * @return ARRAY_SHM*
+     */
+    ARRAY_SHM* get_replica(size_t idx) const { return replicas_[idx].second.get(); }
+
+    /**
+     * @brief 获取错误码
+     *
+     * @return SHM_ERR_CODE
+     */
+    SHM_ERR_CODE get_err_code() const { return err_.code(); }
+
+    /**
+     * @brief 获取错误信息
+     *
+     * @return std::string
+     */
+    std::string get_err_msg() const { return err_.to_string(); }
+
+private:
+    /**
+     * @brief 出错时记录副本的错误
+     *
+     * @param ok
+     * @param idx
+     * @return true
+     * @return false
+     */
+    bool check(bool ok, size_t idx) {
+        if (!ok) {
+            err_ = replicas_[idx].second->get_error();
+        }
+        return ok;
+    }
+
+private:
+    // (节点, 副本)
+    std::vector<std::pair<int, std::unique_ptr<ARRAY_SHM>>> replicas_;
+    CShmError err_;
+};
+
+template <class T, class TH>
+bool CReplicatedArrayShm<T, TH>::init(size_t shm_key, size_t node_count, bool is_create,
+    const ARRAY_SHM_OPTIONS& options) {
+    if (!replicas_.empty()) {
+        err_.set(SHM_ERR_ALREADY_INIT, "CReplicatedArrayShm::init");
+        return false;
+    }
+    std::vector<int> nodes;
+    for (uint32_t node = 0; node < g_shm_numa_max_nodes; ++node) {
+        if (options.numa_nodes & (1ULL << node)) {
+            nodes.push_back(node);
+        }
+    }
+    std::vector<int> online = numa_online_nodes();
+    if (is_create) {
+        if (nodes.empty()) {
+            nodes = online;
+        }
+    } else {
+        // 优先挂载本地节点的副本，其次是其他在线节点
+        int local = nodes.empty() ? numa_current_node() : nodes[0];
+        nodes.assign(1, local);
+        for (int node : online) {
+            if (node != local) {
+                nodes.push_back(node);
+            }
+        }
+    }
+    for (int node : nodes) {
+        ARRAY_SHM_OPTIONS replica_options = options;
+        replica_options.numa_policy = SHM_NUMA_BIND;
+        replica_options.numa_nodes = 1ULL << node;
+        std::unique_ptr<ARRAY_SHM> replica(new ARRAY_SHM());
+        if (!replica->init(shm_key + node, node_count, is_create, replica_options)) {
+            err_ = replica->get_error();
+            if (is_create) {
+                replicas_.clear();
+                return false;
+            }
+            continue;
+        }
+        replicas_.emplace_back(node, std::move(replica));
+        if (!is_create) {
+            break;
+        }
+    }
+    if (replicas_.empty()) {
+        return false;
+    }
+    return true;
+}
+
+template <class T, class TH>
+int CReplicatedArrayShm<T, TH>::insert(const T* nodes, size_t count) {
+    if (replicas_.empty()) {
+        err_.set(SHM_ERR_NOT_INIT, "CReplicatedArrayShm::insert");
+        return -1;
+    }
+    int ret = 0;
+    for (size_t i = 0; i < replicas_.size(); ++i) {
+        ret = replicas_[i].second->insert(nodes, count);
+        if (!check(ret >= 0, i)) {
+            return -1;
+        }
+    }
+    return ret;
+}
+
+template <class T, class TH>
+bool CReplicatedArrayShm<T, TH>::get_header(TH* header) {
+    if (replicas_.empty()) {
+        err_.set(SHM_ERR_NOT_INIT, "CReplicatedArrayShm::get_header");
+        return false;
+    }
+    return check(replicas_[0].second->get_header(header), 0);
+}
+
+template <class T, class TH>
+bool CReplicatedArrayShm<T, TH>::snapshot(TH* header, std::vector<T>* node_vec) {
+    if (replicas_.empty()) {
+        err_.set(SHM_ERR_NOT_INIT, "CReplicatedArrayShm::snapshot");
+        return false;
+    }
+    return check(replicas_[0].second->snapshot(header, node_vec), 0);
+}
+
+}  // namespace thread_mem_shm_sdk
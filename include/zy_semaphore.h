@@ -17,6 +17,9 @@
 #include <sys/sem.h>
 #include <errno.h>
 #include <stdio.h>
+#include "zy_shm_error.h"
+#include "zy_shm_stats.h"
+#include "zy_utils.h"
 
 namespace thread_mem_shm_sdk {
 
@@ -57,38 +60,7 @@ public:
         #endif
         if ((sem_id_ = semget(sem_key, sems, 00666)) < 0) {
             if ((sem_id_ = semget(sem_key, sems, IPC_CREAT | IPC_EXCL | 00666)) < 0) {
-                switch (errno) {
-                case EACCES:
-                    snprintf(err_msg_, ERR_MSG_SIZE, "A semaphore set exists for key,"
-                        "but the calling process does not have permission to access the  set.\n");
-                    break;
-                case EEXIST:
-                    snprintf(err_msg_, ERR_MSG_SIZE, "A semaphore set exists"
-                        " for key and semflg was asserting both IPC_CREAT and IPC_EXCL.\n");
-                    break;
-                case ENOENT:
-                    snprintf(err_msg_, ERR_MSG_SIZE, "No semaphore set exists for key"
-                        " and semflg wasn't asserting IPC_CREAT.");
-                    break;
-                case EINVAL:
-                    snprintf(err_msg_, ERR_MSG_SIZE, "nsems  is  less  than  0  or"
-                        " greater  than  the limit on the number of semaphores per semaphore set(SEMMSL),"
-                        " or a semaphore set corresponding to key already exists,"
-                        " and nsems is larger than the number of semaphores in that set.\n");
-                    break;
-                case ENOMEM:
-                    snprintf(err_msg_, ERR_MSG_SIZE, "A semaphore set has to be created"
-                        " but the system has not enough memory for the new data structure.\n");
-                    break;
-                case ENOSPC:
-                    snprintf(err_msg_, ERR_MSG_SIZE, "A semaphore set has to be created"
-                        " but the system limit for the maximum number of semaphore sets(SEMMNI),"
-                        " or the system wide maximum number of semaphores (SEMMNS), would be exceeded.\n");
-                    break;
-                default:
-                    snprintf(err_msg_, ERR_MSG_SIZE, "unkown error.\n");
-                    break;
-                }
+                err_.set_sys(SHM_ERR_SEMGET, "CSemaphore::create", sem_key);
                 return false;
             }
             is_create_ = true;
@@ -96,7 +68,7 @@ public:
                 union semun arg;
                 arg.val = 1;
                 if (semctl(sem_id_, 0, SETVAL, arg) == -1) {
-                    snprintf(err_msg_, ERR_MSG_SIZE, "semctl setval error");
+                    err_.set_sys(SHM_ERR_SEMCTL, "CSemaphore::create");
                     return false;
                 }
             }
@@ -112,13 +84,24 @@ public:
      * @return false 
      */
     bool lock(const bool wait = true) {
-        struct sembuf sem_buf[2] = {{0, -1, SEM_UNDO}, {0, -1, IPC_NOWAIT | SEM_UNDO}};
+        short undo = undo_ ? SEM_UNDO : 0;
+        struct sembuf sem_buf[2] = {{0, -1, undo}, {0, -1, static_cast<short>(IPC_NOWAIT | undo)}};
         if (sem_id_ == -1) {
-            snprintf(err_msg_, ERR_MSG_SIZE, "no create sem.");
+            err_.set(SHM_ERR_SEM_NOT_CREATE, "CSemaphore::lock");
             return false;
         }
-        if (semop(sem_id_, &sem_buf[wait ? 0 : 1], 1) < 0) {
-            snprintf(err_msg_, ERR_MSG_SIZE, "semop err: (errno=%d)", errno);
+        if (stats_ == nullptr) {
+            if (semop(sem_id_, &sem_buf[wait ? 0 : 1], 1) < 0) {
+                err_.set_sys(SHM_ERR_SEMOP, "CSemaphore::lock");
+                return false;
+            }
+            return true;
+        }
+        uint64_t begin_ns = get_now_monotonic_time_ns();
+        int ret = semop(sem_id_, &sem_buf[wait ? 0 : 1], 1);
+        shm_stats_record_lock(stats_, get_now_monotonic_time_ns() - begin_ns, ret == 0);
+        if (ret < 0) {
+            err_.set_sys(SHM_ERR_SEMOP, "CSemaphore::lock");
             return false;
         }
         return true;
@@ -131,13 +114,13 @@ public:
      * @return false 
      */
     bool unlock() {
-        struct sembuf sem_buf[1] = {{0, 1, SEM_UNDO}};
+        struct sembuf sem_buf[1] = {{0, 1, static_cast<short>(undo_ ? SEM_UNDO : 0)}};
         if (sem_id_ == -1) {
-            snprintf(err_msg_, ERR_MSG_SIZE, "no create sem");
+            err_.set(SHM_ERR_SEM_NOT_CREATE, "CSemaphore::unlock");
             return false;
         }
         if (semop(sem_id_, &sem_buf[0], 1) < 0) {
-            snprintf(err_msg_, ERR_MSG_SIZE, "semop err: (errno=%d)", errno);
+            err_.set_sys(SHM_ERR_SEMOP, "CSemaphore::unlock");
             return false;
         }
         return true;
@@ -151,25 +134,55 @@ public:
      */
     bool destroy() {
         if (semctl(sem_id_, 0, IPC_RMID) == -1) {
-            snprintf(err_msg_, ERR_MSG_SIZE, "semctl IPC_RMID err: (errno=%d)", errno);
+            err_.set_sys(SHM_ERR_SEMCTL, "CSemaphore::destroy");
             return false;
         }
         return true;
     }
 
     /**
-     * @brief 获取当前操作错误信息
+     * @brief 设置统计块，设置后 lock 会记录等待时间，传入 nullptr 关闭统计
+     * 
+     * @param stats 
+     */
+    void set_stats(SHM_STATS* stats) { stats_ = stats; }
+
+    /**
+     * @brief 设置 lock/unlock 是否带 SEM_UNDO，默认带
+     * 带 SEM_UNDO 时持锁进程退出后内核自动归还，但每次 semop 都要维护进程的 undo 记录；
+     * 使用崩溃安全发布（ARRAY_SHM_OPTIONS::crash_safe）时读者不需要加锁，锁只用于多个写者互斥，
+     * 可以关闭以减少开销，此时持锁的写者崩溃后需要重建信号量
+     * 
+     * @param undo 
+     */
+    void set_undo(bool undo) { undo_ = undo; }
+
+    /**
+     * @brief 获取当前操作错误信息，出错时只记录错误码，调用该函数时才格式化
      * 
      * @return const char* 
      */
-    const char* get_err_msg() const { return err_msg_; }
+    const char* get_err_msg() const { return err_.format(err_msg_, sizeof(err_msg_)); }
+
+    /**
+     * @brief 获取错误码
+     * 
+     * @return SHM_ERR_CODE 
+     */
+    SHM_ERR_CODE get_err_code() const { return err_.code(); }
 
 private:
     static const int ERR_MSG_SIZE = 1023;
-    char err_msg_[ERR_MSG_SIZE+1] = {0};
+    // 格式化后的错误信息
+    mutable char err_msg_[ERR_MSG_SIZE+1] = {0};
+    CShmError err_;
     int32_t sem_id_ = -1;
     // 是否创建信号量（true：是，false：否）
     bool is_create_ = false;
+    // 共享内存中的统计块，为空时不统计
+    SHM_STATS* stats_ = nullptr;
+    // lock/unlock 是否带 SEM_UNDO
+    bool undo_ = true;
 };
 
 }  // namespace thread_mem_shm_sdk
@@ -0,0 +1,282 @@
+/**
+ * @file zy_shm_clock.h
+ * @author noahyzhang
+ * @brief 发布时间戳的时钟源
+ * 头部中的时间戳是时钟源的原始读数（tick），同时记录换算参数：
+ * wall_ns = base_ns + (ticks * mult) >> shift，读者据此换算为系统时间
+ * @version 0.1
+ * @date 2023-05-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#include "zy_utils.h"
+
+namespace thread_mem_shm_sdk {
+
+// 时钟源类型
+enum SHM_CLOCK_TYPE {
+    // CLOCK_REALTIME，会随 NTP 调整跳变
+    SHM_CLOCK_REALTIME = 0,
+    // CLOCK_MONOTONIC
+    SHM_CLOCK_MONOTONIC = 1,
+    // CLOCK_MONOTONIC_COARSE，精度为一个 tick（通常 1~4ms），开销最低
+    SHM_CLOCK_MONOTONIC_COARSE = 2,
+    // TSC，创建时按 CLOCK_MONOTONIC 校准，不支持 invariant TSC 时退化为 SHM_CLOCK_MONOTONIC
+    SHM_CLOCK_TSC = 3,
+    // 使用者提供的时钟，返回单调的纳秒值，其他进程无法读取，只能换算为系统时间
+    SHM_CLOCK_USER = 4,
+};
+
+// 使用者提供的时钟，返回纳秒
+using SHM_CLOCK_FUNC = uint64_t (*)();
+
+// 时钟换算参数，放在共享内存头部中
+struct SHM_CLOCK_CALIB {
+    // 时钟源类型，见 SHM_CLOCK_TYPE
+    uint32_t clock_id;
+    uint32_t shift;
+    uint64_t mult;
+    // tick 为 0 时对应的系统时间（纳秒）
+    int64_t base_ns;
+};
+
+/**
+ * @brief 把 tick 换算为纳秒（时钟源自身的时间轴）
+ *
+ * @param calib
+ * @param ticks
+ * @return uint64_t
+ */
+inline uint64_t shm_clock_ticks_to_ns(const SHM_CLOCK_CALIB& calib, uint64_t ticks) {
+    if (calib.shift == 0 && calib.mult <= 1) {
+        return ticks;
+    }
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(ticks) * calib.mult) >> calib.shift);
+}
+
+/**
+ * @brief 把 tick 换算为系统时间（纳秒）
+ *
+ * @param calib
+ * @param ticks
+ * @return uint64_t
+ */
+inline uint64_t shm_clock_to_wall_ns(const SHM_CLOCK_CALIB& calib, uint64_t ticks) {
+    return static_cast<uint64_t>(calib.base_ns + static_cast<int64_t>(shm_clock_ticks_to_ns(calib, ticks)));
+}
+
+/**
+ * @brief 读取 clock_gettime
+ *
+ * @param clock_id
+ * @return uint64_t
+ */
+inline uint64_t shm_clock_gettime_ns(clockid_t clock_id) {
+    struct timespec tp;
+    clock_gettime(clock_id, &tp);
+    return tp.tv_sec * static_cast<uint64_t>(1E9) + tp.tv_nsec;
+}
+
+/**
+ * @brief 读取指定时钟源的当前 tick，用户时钟无法在其他进程中读取，返回 false
+ *
+ * @param clock_id
+ * @param ticks
+ * @return true
+ * @return false
+ */
+inline bool shm_clock_read_ticks(uint32_t clock_id, uint64_t* ticks) {
+    switch (clock_id) {
+    case SHM_CLOCK_REALTIME:
+        *ticks = shm_clock_gettime_ns(CLOCK_REALTIME);
+        return true;
+    case SHM_CLOCK_MONOTONIC:
+        *ticks = shm_clock_gettime_ns(CLOCK_MONOTONIC);
+        return true;
+    case SHM_CLOCK_MONOTONIC_COARSE:
+        *ticks = shm_clock_gettime_ns(CLOCK_MONOTONIC_COARSE);
+        return true;
+#if defined(__x86_64__) || defined(__i386__)
+    case SHM_CLOCK_TSC:
+        *ticks = __rdtsc();
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief 计算 tick 距今的时间（纳秒）
+ * 能读取同一时钟源时在时钟源自身的时间轴上计算，不受系统时间跳变影响，否则换算为系统时间后计算
+ *
+ * @param calib
+ * @param ticks
+ * @return uint64_t
+ */
+inline uint64_t shm_clock_age_ns(const SHM_CLOCK_CALIB& calib, uint64_t ticks) {
+    uint64_t now_ticks = 0;
+    if (shm_clock_read_ticks(calib.clock_id, &now_ticks)) {
+        return now_ticks > ticks ? shm_clock_ticks_to_ns(calib, now_ticks - ticks) : 0;
+    }
+    uint64_t now_ns = get_now_system_time_ns();
+    uint64_t wall_ns = shm_clock_to_wall_ns(calib, ticks);
+    return now_ns > wall_ns ? now_ns - wall_ns : 0;
+}
+
+/**
+ * @brief 是否支持 invariant TSC（频率恒定，各核同步）
+ *
+ * @return true
+ * @return false
+ */
+inline bool shm_clock_has_invariant_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007) {
+        return false;
+    }
+    __cpuid(0x80000007, eax, ebx, ecx, edx);
+    return (edx & (1U << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief 发布时间戳的时钟
+ *
+ */
+class CShmClock {
+public:
+    // TSC 校准的采样时长
+    static const uint64_t TSC_CALIB_NS = 2000000;
+
+public:
+    /**
+     * @brief 初始化并校准
+     *
+     * @param type
+     * @param user_func 仅 SHM_CLOCK_USER 使用
+     * @return true
+     * @return false 类型非法或用户时钟为空
+     */
+    bool init(SHM_CLOCK_TYPE type, SHM_CLOCK_FUNC user_func = nullptr) {
+        calib_.shift = 0;
+        calib_.mult = 1;
+        user_func_ = user_func;
+        switch (type) {
+        case SHM_CLOCK_REALTIME:
+            calib_.base_ns = 0;
+            break;
+        case SHM_CLOCK_MONOTONIC:
+        case SHM_CLOCK_MONOTONIC_COARSE:
+            calib_.base_ns = calc_base_ns(type);
+            break;
+        case SHM_CLOCK_TSC:
+            if (!calibrate_tsc()) {
+                type = SHM_CLOCK_MONOTONIC;
+                calib_.base_ns = calc_base_ns(type);
+            }
+            break;
+        case SHM_CLOCK_USER:
+            if (user_func_ == nullptr) {
+                return false;
+            }
+            calib_.base_ns = static_cast<int64_t>(get_now_system_time_ns() - user_func_());
+            break;
+        default:
+            return false;
+        }
+        calib_.clock_id = type;
+        return true;
+    }
+
+    /**
+     * @brief 当前 tick
+     *
+     * @return uint64_t
+     */
+    uint64_t now() const {
+        if (calib_.clock_id == SHM_CLOCK_USER) {
+            return user_func_();
+        }
+        uint64_t ticks = 0;
+        shm_clock_read_ticks(calib_.clock_id, &ticks);
+        return ticks;
+    }
+
+    /**
+     * @brief 获取实际使用的时钟源类型（TSC 可能退化为 MONOTONIC）
+     *
+     * @return SHM_CLOCK_TYPE
+     */
+    SHM_CLOCK_TYPE get_type() const { return static_cast<SHM_CLOCK_TYPE>(calib_.clock_id); }
+
+    /**
+     * @brief 获取换算参数
+     *
+     * @return const SHM_CLOCK_CALIB&
+     */
+    const SHM_CLOCK_CALIB& get_calib() const { return calib_; }
+
+private:
+    /**
+     * @brief 计算 tick 为 0 时对应的系统时间
+     *
+     * @param type
+     * @return int64_t
+     */
+    static int64_t calc_base_ns(SHM_CLOCK_TYPE type) {
+        uint64_t ticks = 0;
+        shm_clock_read_ticks(type, &ticks);
+        return static_cast<int64_t>(get_now_system_time_ns() - ticks);
+    }
+
+    /**
+     * @brief 按 CLOCK_MONOTONIC 校准 TSC 频率
+     *
+     * @return true
+     * @return false 不支持 invariant TSC
+     */
+    bool calibrate_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+        if (!shm_clock_has_invariant_tsc()) {
+            return false;
+        }
+        uint64_t begin_ns = get_now_monotonic_time_ns();
+        uint64_t begin_tsc = __rdtsc();
+        uint64_t end_ns = begin_ns;
+        while (end_ns - begin_ns < TSC_CALIB_NS) {
+            end_ns = get_now_monotonic_time_ns();
+        }
+        uint64_t end_tsc = __rdtsc();
+        if (end_tsc <= begin_tsc) {
+            return false;
+        }
+        calib_.shift = 32;
+        calib_.mult = ((end_ns - begin_ns) << calib_.shift) / (end_tsc - begin_tsc);
+        uint64_t wall_ns = get_now_system_time_ns();
+        calib_.base_ns = static_cast<int64_t>(wall_ns - shm_clock_ticks_to_ns(calib_, __rdtsc()));
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+    SHM_CLOCK_CALIB calib_{SHM_CLOCK_REALTIME, 0, 1, 0};
+    SHM_CLOCK_FUNC user_func_{nullptr};
+};
+
+}  // namespace thread_mem_shm_sdk
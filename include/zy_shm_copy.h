@@ -0,0 +1,90 @@
+/**
+ * @file zy_shm_copy.h
+ * @author noahyzhang
+ * @brief 整段拷贝
+ * 大段发布使用非临时（non-temporal）存储，数据直接写回内存，不占用写者的缓存，
+ * 这些数据只有读者会访问
+ * @version 0.1
+ * @date 2023-05-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace thread_mem_shm_sdk {
+
+// 默认超过该长度时使用非临时存储，取超出常见 LLC 的大小，缓存放得下时普通拷贝更快
+const size_t g_shm_nt_store_threshold = 32UL << 20;
+
+// 缓存行大小
+const size_t g_shm_cache_line_size = 64;
+
+// 遍历时预取的提前量（字节）
+const size_t g_shm_prefetch_distance = 8 * g_shm_cache_line_size;
+
+/**
+ * @brief 使用非临时存储拷贝，结束后 sfence，保证之后写入的头部不会先于数据可见
+ *
+ * @param dst
+ * @param src
+ * @param length
+ */
+inline void shm_copy_nontemporal(void* dst, const void* src, size_t length) {
+#if defined(__SSE2__)
+    char* d = reinterpret_cast<char*>(dst);
+    const char* s = reinterpret_cast<const char*>(src);
+    // 先按普通方式拷贝到 16 字节对齐
+    size_t head = (16 - (reinterpret_cast<uintptr_t>(d) & 15)) & 15;
+    if (head > length) {
+        head = length;
+    }
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    length -= head;
+    size_t blocks = length / 64;
+    for (size_t i = 0; i < blocks; ++i) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+        __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32));
+        __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d), v0);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), v1);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), v2);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), v3);
+        d += 64;
+        s += 64;
+    }
+    memcpy(d, s, length - blocks * 64);
+    _mm_sfence();
+#else
+    memcpy(dst, src, length);
+#endif
+}
+
+/**
+ * @brief 整段拷贝，长度不小于 nt_threshold 时使用非临时存储
+ *
+ * @param dst
+ * @param src
+ * @param length
+ * @param nt_threshold
+ */
+inline void shm_copy(void* dst, const void* src, size_t length, size_t nt_threshold) {
+    if (length >= nt_threshold) {
+        shm_copy_nontemporal(dst, src, length);
+    } else {
+        memcpy(dst, src, length);
+    }
+}
+
+}  // namespace thread_mem_shm_sdk
@@ -0,0 +1,322 @@
+/**
+ * @file zy_shm_error.h
+ * @author noahyzhang
+ * @brief 错误码及延迟格式化的错误信息
+ * 出错时只记录错误码、出错位置（字符串常量）、errno 以及两个整数参数，不分配内存也不格式化字符串，
+ * 只有调用 get_err_msg 时才格式化
+ * @version 0.1
+ * @date 2023-05-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+namespace thread_mem_shm_sdk {
+
+// 错误码
+enum SHM_ERR_CODE {
+    SHM_OK = 0,
+    // 未初始化或初始化失败
+    SHM_ERR_NOT_INIT,
+    // 重复初始化
+    SHM_ERR_ALREADY_INIT,
+    // 参数错误
+    SHM_ERR_INVALID_PARAM,
+    // 只读模式下写入
+    SHM_ERR_READ_ONLY,
+    // 未挂载
+    SHM_ERR_NOT_ATTACH,
+    // 共享内存不存在
+    SHM_ERR_NOT_EXIST,
+    // 调用 shmget 失败，arg0: key，arg1: size
+    SHM_ERR_SHMGET,
+    // 调用 shmat 失败，arg0: key
+    SHM_ERR_SHMAT,
+    // 版本（布局指纹）校验失败，arg0: 实际版本，arg1: 期望版本
+    SHM_ERR_VERSION,
+    // 头部 CRC 校验失败，arg0: 实际 CRC，arg1: 计算的 CRC
+    SHM_ERR_CRC,
+    // 节点个数错误，arg0: cur_node_count，arg1: max_node_count
+    SHM_ERR_NODE_COUNT,
+    // 遍历回调返回 false，arg0: 节点位置
+    SHM_ERR_CALLBACK,
+    // 缺少依赖的头部字段
+    SHM_ERR_HEADER_FIELD,
+    // 索引不存在或与当前发布不一致
+    SHM_ERR_INDEX,
+    // 分组提交未完成或并发提交导致重试次数用尽
+    SHM_ERR_COMMIT,
+    // 多缓冲的缓冲区都被读者占用，或并发发布导致重试次数用尽
+    SHM_ERR_BUFFER_BUSY,
+    // 读者表的槽位都被存活的读者占用，arg0: 槽位个数
+    SHM_ERR_READER_FULL,
+    // 信号量未创建
+    SHM_ERR_SEM_NOT_CREATE,
+    // 调用 semget 失败，arg0: key
+    SHM_ERR_SEMGET,
+    // 调用 semctl 失败
+    SHM_ERR_SEMCTL,
+    // 调用 semop 失败
+    SHM_ERR_SEMOP,
+    // 通过 set_err_msg 设置的自定义信息
+    SHM_ERR_CUSTOM,
+};
+
+/**
+ * @brief 错误码的描述
+ *
+ * @param code
+ * @return const char*
+ */
+inline const char* shm_err_code_str(SHM_ERR_CODE code) {
+    switch (code) {
+    case SHM_OK: return "success";
+    case SHM_ERR_NOT_INIT: return "init might be mistaken";
+    case SHM_ERR_ALREADY_INIT: return "already initialized, can't reinitialized";
+    case SHM_ERR_INVALID_PARAM: return "invalid parameter";
+    case SHM_ERR_READ_ONLY: return "can't write in read only mode";
+    case SHM_ERR_NOT_ATTACH: return "not attach";
+    case SHM_ERR_NOT_EXIST: return "try to attach shm which is not exist";
+    case SHM_ERR_SHMGET: return "failed to call shmget";
+    case SHM_ERR_SHMAT: return "failed to call shmat";
+    case SHM_ERR_VERSION: return "version check error";
+    case SHM_ERR_CRC: return "CRC calibration error";
+    case SHM_ERR_NODE_COUNT: return "cur_node_count larger than max_node_count";
+    case SHM_ERR_CALLBACK: return "callback TRAVERSE_METHOD function return false";
+    case SHM_ERR_HEADER_FIELD: return "header type lacks a required field";
+    case SHM_ERR_INDEX: return "index not exist or not match the current publish";
+    case SHM_ERR_COMMIT: return "group commit in progress, retry exhausted";
+    case SHM_ERR_BUFFER_BUSY: return "all buffers pinned by readers or retry exhausted";
+    case SHM_ERR_READER_FULL: return "all reader slots occupied by live readers";
+    case SHM_ERR_SEM_NOT_CREATE: return "no create sem";
+    case SHM_ERR_SEMGET: return "failed to call semget";
+    case SHM_ERR_SEMCTL: return "failed to call semctl";
+    case SHM_ERR_SEMOP: return "semop err";
+    case SHM_ERR_CUSTOM: return "custom error";
+    }
+    return "unknown error";
+}
+
+/**
+ * @brief 错误信息，记录时不分配内存
+ *
+ */
+class CShmError {
+public:
+    /**
+     * @brief 记录错误
+     *
+     * @param code
+     * @param where 出错位置，必须是字符串常量
+     * @param arg0
+     * @param arg1
+     */
+    void set(SHM_ERR_CODE code, const char* where, int64_t arg0 = 0, int64_t arg1 = 0) {
+        code_ = code;
+        where_ = where;
+        context_ = nullptr;
+        sys_errno_ = 0;
+        arg0_ = arg0;
+        arg1_ = arg1;
+    }
+
+    /**
+     * @brief 记录系统调用错误，同时保存 errno
+     *
+     * @param code
+     * @param where
+     * @param arg0
+     * @param arg1
+     */
+    void set_sys(SHM_ERR_CODE code, const char* where, int64_t arg0 = 0, int64_t arg1 = 0) {
+        int sys_errno = errno;
+        set(code, where, arg0, arg1);
+        sys_errno_ = sys_errno;
+    }
+
+    /**
+     * @brief 记录外层调用位置，例如 traverse 中 parse_header 失败
+     *
+     * @param context 必须是字符串常量
+     */
+    void wrap(const char* context) {
+        context_ = context;
+    }
+
+    /**
+     * @brief 设置自定义错误信息（会分配内存，不要在热路径上使用）
+     *
+     * @param msg
+     */
+    void set_custom(const std::string& msg) {
+        set(SHM_ERR_CUSTOM, nullptr);
+        custom_msg_ = msg;
+    }
+
+    /**
+     * @brief 清除错误
+     *
+     */
+    void clear() {
+        set(SHM_OK, nullptr);
+    }
+
+    SHM_ERR_CODE code() const { return code_; }
+    int sys_errno() const { return sys_errno_; }
+    int64_t arg0() const { return arg0_; }
+    int64_t arg1() const { return arg1_; }
+
+    /**
+     * @brief 格式化错误信息到 buf 中
+     *
+     * @param buf
+     * @param size
+     * @return const char* buf
+     */
+    const char* format(char* buf, size_t size) const {
+        if (size == 0) {
+            return buf;
+        }
+        buf[0] = '\0';
+        if (code_ == SHM_ERR_CUSTOM) {
+            snprintf(buf, size, "%s", custom_msg_.c_str());
+            return buf;
+        }
+        if (code_ == SHM_OK) {
+            return buf;
+        }
+        int len = 0;
+        if (context_ != nullptr) {
+            len = snprintf(buf, size, "[%s] ", context_);
+        }
+        append(buf, size, &len, "[%s] %s", where_ != nullptr ? where_ : "", shm_err_code_str(code_));
+        switch (code_) {
+        case SHM_ERR_SHMGET:
+            append(buf, size, &len, ", key: %ld, size: %ld", arg0_, arg1_);
+            break;
+        case SHM_ERR_SHMAT:
+        case SHM_ERR_NOT_EXIST:
+        case SHM_ERR_SEMGET:
+            append(buf, size, &len, ", key: %ld", arg0_);
+            break;
+        case SHM_ERR_VERSION:
+            append(buf, size, &len, ", version: 0x%lx, expect: 0x%lx", static_cast<uint64_t>(arg0_),
+                static_cast<uint64_t>(arg1_));
+            break;
+        case SHM_ERR_CRC:
+            append(buf, size, &len, ", header crc: 0x%lx, calc crc: 0x%lx", static_cast<uint64_t>(arg0_),
+                static_cast<uint64_t>(arg1_));
+            break;
+        case SHM_ERR_NODE_COUNT:
+            append(buf, size, &len, ", cur_node_count: %ld, max_node_count: %ld", arg0_, arg1_);
+            break;
+        case SHM_ERR_CALLBACK:
+            append(buf, size, &len, ", pos: %ld", arg0_);
+            break;
+        case SHM_ERR_INDEX:
+            append(buf, size, &len, ", index: %ld", arg0_);
+            break;
+        case SHM_ERR_BUFFER_BUSY:
+            append(buf, size, &len, ", buffer_count: %ld", arg0_);
+            break;
+        case SHM_ERR_COMMIT:
+            append(buf, size, &len, ", seq: %ld, retry: %ld", arg0_, arg1_);
+            break;
+        default:
+            break;
+        }
+        if (sys_errno_ != 0) {
+            append(buf, size, &len, ", errno: %d, reason: %s", sys_errno_, sys_errno_desc());
+        }
+        return buf;
+    }
+
+    /**
+     * @brief 格式化错误信息
+     *
+     * @return std::string
+     */
+    std::string to_string() const {
+        if (code_ == SHM_ERR_CUSTOM) {
+            return custom_msg_;
+        }
+        char buf[512];
+        return format(buf, sizeof(buf));
+    }
+
+private:
+    /**
+     * @brief 追加格式化内容
+     *
+     * @param buf
+     * @param size
+     * @param len
+     * @param fmt
+     * @param ...
+     */
+    static void append(char* buf, size_t size, int* len, const char* fmt, ...) __attribute__((format(printf, 4, 5))) {
+        if (*len < 0 || static_cast<size_t>(*len) >= size) {
+            return;
+        }
+        va_list ap;
+        va_start(ap, fmt);
+        int ret = vsnprintf(buf + *len, size - *len, fmt, ap);
+        va_end(ap);
+        if (ret > 0) {
+            *len += ret;
+        }
+    }
+
+    /**
+     * @brief errno 的描述，信号量创建失败时给出更详细的说明
+     *
+     * @return const char*
+     */
+    const char* sys_errno_desc() const {
+        if (code_ == SHM_ERR_SEMGET) {
+            switch (sys_errno_) {
+            case EACCES:
+                return "A semaphore set exists for key, but the calling process does not have permission"
+                    " to access the set.";
+            case EEXIST:
+                return "A semaphore set exists for key and semflg was asserting both IPC_CREAT and IPC_EXCL.";
+            case ENOENT:
+                return "No semaphore set exists for key and semflg wasn't asserting IPC_CREAT.";
+            case EINVAL:
+                return "nsems is less than 0 or greater than the limit on the number of semaphores per"
+                    " semaphore set(SEMMSL), or a semaphore set corresponding to key already exists,"
+                    " and nsems is larger than the number of semaphores in that set.";
+            case ENOMEM:
+                return "A semaphore set has to be created but the system has not enough memory"
+                    " for the new data structure.";
+            case ENOSPC:
+                return "A semaphore set has to be created but the system limit for the maximum number of"
+                    " semaphore sets(SEMMNI), or the system wide maximum number of semaphores (SEMMNS),"
+                    " would be exceeded.";
+            default:
+                break;
+            }
+        }
+        return strerror(sys_errno_);
+    }
+
+private:
+    SHM_ERR_CODE code_{SHM_OK};
+    const char* where_{nullptr};
+    const char* context_{nullptr};
+    int sys_errno_{0};
+    int64_t arg0_{0};
+    int64_t arg1_{0};
+    std::string custom_msg_;
+};
+
+}  // namespace thread_mem_shm_sdk
@@ -0,0 +1,331 @@
+/**
+ * @file zy_shm_group.h
+ * @author noahyzhang
+ * @brief 共享内存分组的提交记录
+ * 多个相关的 CArrayShm（key 各不相同）组成一个分组，分组的提交记录放在单独的共享内存中，
+ * 格式为：| SHM_GROUP_HEADER | 成员 key | ... | 成员 key |
+ * 写者在 begin_commit / end_commit 之间发布所有成员，提交序号为奇数表示正在提交；
+ * 读者在读取前后各读一次提交序号，两次一致且为偶数时读到的各成员互相一致，否则重试，不需要加锁
+ * @version 0.1
+ * @date 2023-06-05
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <sched.h>
+#include <stdint.h>
+#include <vector>
+#include "zy_base_shm.h"
+#include "zy_shm_error.h"
+#include "zy_utils.h"
+
+namespace thread_mem_shm_sdk {
+
+// 分组提交记录的格式版本，高 8 位与数组共享内存的魔数不同，观察工具不会误识别
+const uint32_t g_shm_group_version = 0xFE000001;
+
+// 读者默认的最多重试次数
+const uint32_t g_shm_group_max_retry = 1000;
+
+// 提交未完成时读者先自旋的次数，之后让出 CPU
+const uint32_t g_shm_group_spin_count = 64;
+
+// 分组提交记录的头部
+struct SHM_GROUP_HEADER {
+    uint32_t version;
+    // 成员个数
+    uint32_t member_count;
+    // 提交序号，奇数表示正在提交，只通过原子操作访问
+    uint64_t seq;
+    // 最近一次完成提交的系统时间
+    uint64_t commit_time_ns;
+};
+
+/**
+ * @brief 共享内存分组
+ * 只支持单个写者，多个写者需要在提交外加 CSemaphore 互斥。
+ * 写者在提交过程中退出时提交序号停留在奇数，读者返回 SHM_ERR_COMMIT，直到重启的写者完成下一次提交
+ */
+class CShmGroup : public CShm<uint64_t, SHM_GROUP_HEADER, CShmGroup> {
+    using BASE = CShm<uint64_t, SHM_GROUP_HEADER, CShmGroup>;
+    friend BASE;
+
+public:
+    CShmGroup() = default;
+    ~CShmGroup() = default;
+
+public:
+    /**
+     * @brief 初始化
+     * 写者传入所有成员的 key，挂载已存在的分组时成员必须一致；读者不需要传入，通过 get_member_keys 获取
+     *
+     * @param shm_key 分组提交记录的 key
+     * @param member_keys
+     * @param is_create
+     * @param options
+     * @return true
+     * @return false
+     */
+    bool init(size_t shm_key, const std::vector<size_t>& member_keys = std::vector<size_t>(),
+        bool is_create = false, const SHM_OPTIONS& options = SHM_OPTIONS());
+
+    /**
+     * @brief 开始提交，之后写者可以发布各成员
+     * 上一个写者在提交过程中退出时序号已是奇数，保持不变
+     *
+     * @return true
+     * @return false
+     */
+    bool begin_commit();
+
+    /**
+     * @brief 完成提交，读者此后看到的是本次提交的所有成员
+     *
+     * @return true
+     * @return false
+     */
+    bool end_commit();
+
+    /**
+     * @brief 在一次提交中发布各成员
+     * 发布函数返回 false 时仍会完成提交，发布函数应在修改任何成员之前检查参数
+     *
+     * @tparam F 形如 bool()
+     * @param publish_func
+     * @return true
+     * @return false
+     */
+    template <class F>
+    bool commit(F&& publish_func);
+
+    /**
+     * @brief 读取一致的快照，读取期间有提交时重试
+     * 读取函数中通常对各成员调用 snapshot，提交过程中读到的数据可能不完整（如 CRC 校验失败），
+     * 此时读取函数返回 false 即可，提交序号变化时会重试
+     *
+     * @tparam F 形如 bool()
+     * @param read_func
+     * @param max_retry
+     * @return true
+     * @return false
+     */
+    template <class F>
+    bool read(F&& read_func, uint32_t max_retry = g_shm_group_max_retry);
+
+    /**
+     * @brief 获取当前的提交序号
+     *
+     * @return uint64_t
+     */
+    uint64_t get_commit_seq() const;
+
+    /**
+     * @brief 获取成员的 key
+     *
+     * @return const std::vector<size_t>&
+     */
+    const std::vector<size_t>& get_member_keys() const { return member_keys_; }
+
+    /**
+     * @brief 读者累计的重试次数
+     *
+     * @return uint64_t
+     */
+    uint64_t get_retry_count() const { return retry_count_; }
+
+private:
+    /**
+     * @brief 设置头部和成员
+     *
+     * @return true
+     * @return false
+     */
+    bool set_header();
+
+    /**
+     * @brief 解析头部
+     *
+     * @param header
+     * @return size_t 整个共享内存的长度，出错返回 0
+     */
+    size_t parse_header(const SHM_GROUP_HEADER& header);
+
+    /**
+     * @brief 共享内存中的头部
+     *
+     * @return SHM_GROUP_HEADER*
+     */
+    SHM_GROUP_HEADER* shm_header() const {
+        return reinterpret_cast<SHM_GROUP_HEADER*>(get_shm_addr());
+    }
+
+    /**
+     * @brief 等待提交完成并读取提交序号
+     *
+     * @param seq
+     * @param max_retry
+     * @return true
+     * @return false 重试次数用尽
+     */
+    bool wait_commit(uint64_t* seq, uint32_t max_retry);
+
+private:
+    bool is_init_{false};
+    std::vector<size_t> member_keys_;
+    uint64_t retry_count_{0};
+};
+
+inline bool CShmGroup::init(size_t shm_key, const std::vector<size_t>& member_keys, bool is_create,
+    const SHM_OPTIONS& options) {
+    if (is_init_) {
+        set_err(SHM_ERR_ALREADY_INIT, "CShmGroup::init");
+        return false;
+    }
+    if (is_create && member_keys.empty()) {
+        set_err(SHM_ERR_INVALID_PARAM, "CShmGroup::init");
+        return false;
+    }
+    member_keys_ = member_keys;
+    if (!BASE::init(shm_key, member_keys.size() * sizeof(uint64_t), is_create, options)) {
+        return false;
+    }
+    // 挂载已存在的分组时，成员以共享内存中的记录为准
+    SHM_GROUP_HEADER* header = shm_header();
+    std::vector<size_t> shm_member_keys(header->member_count);
+    for (uint32_t i = 0; i < header->member_count; ++i) {
+        shm_member_keys[i] = *get_node_by_pos(i);
+    }
+    if (is_create && shm_member_keys != member_keys) {
+        set_err(SHM_ERR_INVALID_PARAM, "CShmGroup::init", member_keys.size(), header->member_count);
+        return false;
+    }
+    member_keys_.swap(shm_member_keys);
+    is_init_ = true;
+    return true;
+}
+
+inline bool CShmGroup::set_header() {
+    SHM_GROUP_HEADER header;
+    memset(&header, 0, sizeof(header));
+    header.version = g_shm_group_version;
+    header.member_count = static_cast<uint32_t>(member_keys_.size());
+    for (size_t i = 0; i < member_keys_.size(); ++i) {
+        *get_node_by_pos(i) = member_keys_[i];
+    }
+    return do_set_header(header);
+}
+
+inline size_t CShmGroup::parse_header(const SHM_GROUP_HEADER& header) {
+    if (header.version != g_shm_group_version) {
+        set_err(SHM_ERR_VERSION, "CShmGroup::parse_header", header.version, g_shm_group_version);
+        return 0;
+    }
+    return sizeof(SHM_GROUP_HEADER) + header.member_count * sizeof(uint64_t);
+}
+
+inline bool CShmGroup::begin_commit() {
+    if (!is_init_) {
+        set_err(SHM_ERR_NOT_INIT, "CShmGroup::begin_commit");
+        return false;
+    }
+    if (is_read_only()) {
+        set_err(SHM_ERR_READ_ONLY, "CShmGroup::begin_commit");
+        return false;
+    }
+    SHM_GROUP_HEADER* header = shm_header();
+    uint64_t seq = __atomic_load_n(&header->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) == 0) {
+        __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELAXED);
+    }
+    // 之后对成员的写入不会先于奇数的序号可见
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return true;
+}
+
+inline bool CShmGroup::end_commit() {
+    if (!is_init_) {
+        set_err(SHM_ERR_NOT_INIT, "CShmGroup::end_commit");
+        return false;
+    }
+    if (is_read_only()) {
+        set_err(SHM_ERR_READ_ONLY, "CShmGroup::end_commit");
+        return false;
+    }
+    SHM_GROUP_HEADER* header = shm_header();
+    uint64_t seq = __atomic_load_n(&header->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) == 0) {
+        set_err(SHM_ERR_COMMIT, "CShmGroup::end_commit", seq);
+        return false;
+    }
+    __atomic_store_n(&header->commit_time_ns, get_now_system_time_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+template <class F>
+bool CShmGroup::commit(F&& publish_func) {
+    if (!begin_commit()) {
+        return false;
+    }
+    bool res = publish_func();
+    if (!end_commit()) {
+        return false;
+    }
+    if (!res) {
+        set_err(SHM_ERR_CALLBACK, "CShmGroup::commit");
+    }
+    return res;
+}
+
+inline uint64_t CShmGroup::get_commit_seq() const {
+    return is_init_ ? __atomic_load_n(&shm_header()->seq, __ATOMIC_ACQUIRE) : 0;
+}
+
+inline bool CShmGroup::wait_commit(uint64_t* seq, uint32_t max_retry) {
+    SHM_GROUP_HEADER* header = shm_header();
+    for (uint32_t i = 0; i <= max_retry; ++i) {
+        *seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+        if ((*seq & 1) == 0) {
+            return true;
+        }
+        ++retry_count_;
+        if (i >= g_shm_group_spin_count) {
+            sched_yield();
+        }
+    }
+    set_err(SHM_ERR_COMMIT, "CShmGroup::read", *seq, max_retry);
+    return false;
+}
+
+template <class F>
+bool CShmGroup::read(F&& read_func, uint32_t max_retry) {
+    if (!is_init_) {
+        set_err(SHM_ERR_NOT_INIT, "CShmGroup::read");
+        return false;
+    }
+    SHM_GROUP_HEADER* header = shm_header();
+    for (uint32_t retry = 0; retry <= max_retry; ++retry) {
+        uint64_t begin_seq = 0;
+        if (!wait_commit(&begin_seq, max_retry)) {
+            return false;
+        }
+        bool res = read_func();
+        // 读取函数中的读操作不会晚于第二次读取序号
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t end_seq = __atomic_load_n(&header->seq, __ATOMIC_RELAXED);
+        if (end_seq == begin_seq) {
+            if (!res) {
+                set_err(SHM_ERR_CALLBACK, "CShmGroup::read");
+            }
+            return res;
+        }
+        ++retry_count_;
+    }
+    set_err(SHM_ERR_COMMIT, "CShmGroup::read", get_commit_seq(), max_retry);
+    return false;
+}
+
+}  // namespace thread_mem_shm_sdk
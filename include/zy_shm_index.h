@@ -0,0 +1,196 @@
+/**
+ * @file zy_shm_index.h
+ * @author noahyzhang
+ * @brief 共享内存中的有序索引
+ * 每个索引由索引头、按 key 升序排列的 key 数组和对应的节点位置数组组成，读者在 key 数组上二分查找，
+ * 只访问命中的节点。写者在本地保留上一次发布的 key，发布时只对变化的节点重新排序后归并，
+ * 写入共享内存时逐个比较，只改写与共享内存中不同的条目
+ * @version 0.1
+ * @date 2023-06-02
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace thread_mem_shm_sdk {
+
+// 最多支持的索引个数
+const uint32_t g_shm_max_index_count = 15;
+
+// 索引头
+struct SHM_INDEX_HEADER {
+    // 有效条目数，与发布的节点个数一致
+    uint32_t count;
+    // 写者是否设置了 key 函数，未设置的索引不可用；发布期间为 0，读者查询后据此确认没有并发发布
+    uint32_t valid;
+    // 索引对应的发布代数，与头部的 generation 不一致时索引不可用
+    uint64_t generation;
+};
+
+/**
+ * @brief 一个索引占用的长度：索引头 + key 数组 + 位置数组（按 8 字节对齐）
+ *
+ * @param max_node_count
+ * @return size_t
+ */
+inline size_t shm_index_length(size_t max_node_count) {
+    size_t pos_length = (max_node_count * sizeof(uint32_t) + 7) / 8 * 8;
+    return sizeof(SHM_INDEX_HEADER) + max_node_count * sizeof(uint64_t) + pos_length;
+}
+
+/**
+ * @brief 共享内存中一个索引的视图
+ *
+ */
+struct SHM_INDEX_VIEW {
+    SHM_INDEX_HEADER* header;
+    uint64_t* keys;
+    uint32_t* pos;
+
+    SHM_INDEX_VIEW() : header(nullptr), keys(nullptr), pos(nullptr) {}
+
+    SHM_INDEX_VIEW(char* addr, size_t max_node_count)
+        : header(reinterpret_cast<SHM_INDEX_HEADER*>(addr)),
+          keys(reinterpret_cast<uint64_t*>(addr + sizeof(SHM_INDEX_HEADER))),
+          pos(reinterpret_cast<uint32_t*>(addr + sizeof(SHM_INDEX_HEADER) + max_node_count * sizeof(uint64_t))) {}
+
+    /**
+     * @brief 第一个 key 不小于 key 的条目
+     *
+     * @param key
+     * @return size_t
+     */
+    size_t lower_bound(uint64_t key) const {
+        return std::lower_bound(keys, keys + header->count, key) - keys;
+    }
+
+    /**
+     * @brief 第一个 key 大于 key 的条目
+     *
+     * @param key
+     * @return size_t
+     */
+    size_t upper_bound(uint64_t key) const {
+        return std::upper_bound(keys, keys + header->count, key) - keys;
+    }
+};
+
+/**
+ * @brief 写者维护的索引
+ * 本地保留按位置排列的上一次的 key 以及有序的条目，发布时找出 key 变化、新增和删除的位置，
+ * 变化较少时从有序条目中删去这些位置，对变化的条目排序后归并；变化较多时整体排序
+ */
+class CShmIndexBuilder {
+public:
+    /**
+     * @brief 按新发布的节点更新索引
+     *
+     * @tparam T
+     * @tparam K 形如 uint64_t(const T& node)
+     * @param nodes
+     * @param count
+     * @param key_func
+     * @return size_t 变化的位置个数
+     */
+    template <class T, class K>
+    size_t update(const T* nodes, size_t count, K key_func);
+
+    /**
+     * @brief 把有序条目写入共享内存中的索引，逐个与共享内存中的条目比较，只改写不同的条目，最后置为有效
+     * 仍需读一遍所有条目；key 变化的节点在有序数组中移动时，新旧位置之间的条目错位一格，与相邻条目不同的都要改写
+     *
+     * @param view
+     * @param generation
+     * @param copy_entries 条目没有变化时只更新索引头
+     * @return size_t 改写的条目个数
+     */
+    size_t write(const SHM_INDEX_VIEW& view, uint64_t generation, bool copy_entries) const {
+        size_t written = 0;
+        size_t count = copy_entries ? entries_.size() : 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (view.keys[i] != entries_[i].key || view.pos[i] != entries_[i].pos) {
+                view.keys[i] = entries_[i].key;
+                view.pos[i] = entries_[i].pos;
+                ++written;
+            }
+        }
+        view.header->count = static_cast<uint32_t>(entries_.size());
+        view.header->generation = generation;
+        __atomic_store_n(&view.header->valid, 1, __ATOMIC_RELEASE);
+        return written;
+    }
+
+private:
+    struct ENTRY {
+        uint64_t key;
+        uint32_t pos;
+
+        bool operator<(const ENTRY& other) const {
+            return key < other.key || (key == other.key && pos < other.pos);
+        }
+    };
+
+private:
+    // 按位置排列的上一次发布的 key
+    std::vector<uint64_t> keys_;
+    // 按 (key, pos) 有序的条目
+    std::vector<ENTRY> entries_;
+    // 以下为更新时复用的缓冲区
+    std::vector<uint8_t> changed_;
+    std::vector<ENTRY> added_;
+    std::vector<ENTRY> merged_;
+};
+
+template <class T, class K>
+size_t CShmIndexBuilder::update(const T* nodes, size_t count, K key_func) {
+    size_t old_count = keys_.size();
+    changed_.assign(std::max(old_count, count), 0);
+    added_.clear();
+    size_t changed_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t key = key_func(nodes[i]);
+        if (i < old_count && keys_[i] == key) {
+            continue;
+        }
+        changed_[i] = 1;
+        ++changed_count;
+        added_.push_back(ENTRY{key, static_cast<uint32_t>(i)});
+    }
+    for (size_t i = count; i < old_count; ++i) {
+        changed_[i] = 1;
+        ++changed_count;
+    }
+    if (changed_count == 0) {
+        return 0;
+    }
+    keys_.resize(count);
+    for (const ENTRY& entry : added_) {
+        keys_[entry.pos] = entry.key;
+    }
+    // 变化超过四分之一时整体排序更快
+    if (changed_count * 4 > count) {
+        entries_.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            entries_[i] = ENTRY{keys_[i], static_cast<uint32_t>(i)};
+        }
+        std::sort(entries_.begin(), entries_.end());
+        return changed_count;
+    }
+    std::sort(added_.begin(), added_.end());
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+        [this](const ENTRY& entry) { return changed_[entry.pos] != 0; }), entries_.end());
+    merged_.resize(entries_.size() + added_.size());
+    std::merge(entries_.begin(), entries_.end(), added_.begin(), added_.end(), merged_.begin());
+    entries_.swap(merged_);
+    return changed_count;
+}
+
+}  // namespace thread_mem_shm_sdk
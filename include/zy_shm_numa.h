@@ -0,0 +1,229 @@
+/**
+ * @file zy_shm_numa.h
+ * @author noahyzhang
+ * @brief 共享内存的 NUMA 放置策略
+ * 直接使用 mbind/getcpu 系统调用并读取 sysfs，不依赖 libnuma。
+ * 指定的节点不在线时按在线节点个数取模映射到在线节点上，因此单节点机器上也能运行所有策略
+ * @version 0.1
+ * @date 2023-05-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace thread_mem_shm_sdk {
+
+// 放置策略
+enum SHM_NUMA_POLICY {
+    // 不干预，由首次访问的进程决定（first touch）
+    SHM_NUMA_DEFAULT = 0,
+    // 绑定到 numa_nodes 中的节点
+    SHM_NUMA_BIND = 1,
+    // 在 numa_nodes 中的节点上交错分配，numa_nodes 为 0 时使用所有在线节点
+    SHM_NUMA_INTERLEAVE = 2,
+    // 绑定到 numa_cpus 中的 CPU 所在的节点
+    SHM_NUMA_CPUS = 3,
+};
+
+// 支持的最大节点个数，节点集合使用 64 位掩码表示
+const uint32_t g_shm_numa_max_nodes = 64;
+
+// mbind 的模式，见 linux/mempolicy.h
+const int g_shm_mpol_bind = 2;
+const int g_shm_mpol_interleave = 3;
+
+/**
+ * @brief 解析形如 "0-3,8,10-11" 的列表
+ *
+ * @param str
+ * @param ids
+ */
+inline void numa_parse_list(const char* str, std::vector<int>* ids) {
+    const char* p = str;
+    while (*p != '\0' && *p != '\n') {
+        char* end = nullptr;
+        long begin = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = begin;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long id = begin; id <= last; ++id) {
+            ids->push_back(static_cast<int>(id));
+        }
+        if (*p == ',') {
+            ++p;
+        }
+    }
+}
+
+/**
+ * @brief 获取在线的节点，读取失败时认为只有节点 0
+ *
+ * @return std::vector<int>
+ */
+inline std::vector<int> numa_online_nodes() {
+    std::vector<int> nodes;
+    FILE* fp = fopen("/sys/devices/system/node/online", "r");
+    if (fp != nullptr) {
+        char buf[256] = {0};
+        if (fgets(buf, sizeof(buf), fp) != nullptr) {
+            numa_parse_list(buf, &nodes);
+        }
+        fclose(fp);
+    }
+    std::vector<int> valid;
+    for (int node : nodes) {
+        if (node >= 0 && node < static_cast<int>(g_shm_numa_max_nodes)) {
+            valid.push_back(node);
+        }
+    }
+    if (valid.empty()) {
+        valid.push_back(0);
+    }
+    return valid;
+}
+
+/**
+ * @brief 把节点映射到在线节点上，不在线的节点按在线节点个数取模映射
+ *
+ * @param node
+ * @return int
+ */
+inline int numa_map_node(int node) {
+    std::vector<int> online = numa_online_nodes();
+    for (int id : online) {
+        if (id == node) {
+            return node;
+        }
+    }
+    return online[static_cast<size_t>(node < 0 ? 0 : node) % online.size()];
+}
+
+/**
+ * @brief 获取 CPU 所在的节点，读取失败时返回 0
+ *
+ * @param cpu
+ * @return int
+ */
+inline int numa_node_of_cpu(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if (dir == nullptr) {
+        return 0;
+    }
+    int node = 0;
+    struct dirent* entry = nullptr;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+/**
+ * @brief 获取当前线程运行所在的节点
+ *
+ * @return int
+ */
+inline int numa_current_node() {
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return static_cast<int>(node);
+}
+
+/**
+ * @brief 按策略计算实际使用的节点掩码，所有节点都已映射到在线节点上
+ *
+ * @param policy
+ * @param nodes 节点掩码
+ * @param cpus
+ * @return uint64_t 为 0 时表示不需要设置
+ */
+inline uint64_t numa_resolve_nodes(SHM_NUMA_POLICY policy, uint64_t nodes, const std::vector<int>& cpus) {
+    uint64_t mask = 0;
+    switch (policy) {
+    case SHM_NUMA_BIND:
+    case SHM_NUMA_INTERLEAVE:
+        if (nodes == 0 && policy == SHM_NUMA_INTERLEAVE) {
+            for (int node : numa_online_nodes()) {
+                mask |= 1ULL << node;
+            }
+            break;
+        }
+        for (uint32_t node = 0; node < g_shm_numa_max_nodes; ++node) {
+            if (nodes & (1ULL << node)) {
+                mask |= 1ULL << numa_map_node(node);
+            }
+        }
+        break;
+    case SHM_NUMA_CPUS:
+        for (int cpu : cpus) {
+            mask |= 1ULL << numa_map_node(numa_node_of_cpu(cpu));
+        }
+        break;
+    default:
+        break;
+    }
+    return mask;
+}
+
+/**
+ * @brief 对尚未访问的内存设置放置策略，必须在首次写入之前调用
+ *
+ * @param addr 页对齐的地址
+ * @param length
+ * @param policy
+ * @param nodes
+ * @param cpus
+ * @return true 设置成功或不需要设置
+ * @return false mbind 失败（如内核不支持），内存仍按 first touch 分配
+ */
+inline bool numa_apply_policy(void* addr, size_t length, SHM_NUMA_POLICY policy, uint64_t nodes,
+    const std::vector<int>& cpus) {
+    uint64_t mask = numa_resolve_nodes(policy, nodes, cpus);
+    if (mask == 0) {
+        return policy == SHM_NUMA_DEFAULT;
+    }
+    int mode = (policy == SHM_NUMA_INTERLEAVE) ? g_shm_mpol_interleave : g_shm_mpol_bind;
+    return syscall(SYS_mbind, addr, length, mode, &mask, g_shm_numa_max_nodes + 1, 0) == 0;
+}
+
+/**
+ * @brief 查询地址所在页所在的节点，失败时返回 -1
+ *
+ * @param addr
+ * @return int
+ */
+inline int numa_node_of_addr(const void* addr) {
+    // MPOL_F_NODE | MPOL_F_ADDR
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0, addr, 3) != 0) {
+        return -1;
+    }
+    return node;
+}
+
+}  // namespace thread_mem_shm_sdk
@@ -0,0 +1,135 @@
+/**
+ * @file zy_shm_prefault.h
+ * @author noahyzhang
+ * @brief 创建共享内存后的预分配（prefault）
+ * 新创建的 SysV 共享内存由内核按页清零，不需要再 memset，预分配只是为了让缺页发生在启动阶段而不是发布路径上
+ * @version 0.1
+ * @date 2023-05-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+namespace thread_mem_shm_sdk {
+
+// 预分配方式
+enum SHM_PREFAULT_MODE {
+    // 不预分配，首次访问时缺页
+    SHM_PREFAULT_NONE = 0,
+    // 整段 memset 清零（旧行为），单线程
+    SHM_PREFAULT_MEMSET = 1,
+    // 每页原子地写一次（不改变内容），可多线程
+    SHM_PREFAULT_TOUCH = 2,
+    // madvise(MADV_POPULATE_WRITE)，内核不支持时退化为 SHM_PREFAULT_TOUCH，可多线程
+    SHM_PREFAULT_MADVISE = 3,
+};
+
+// 多线程预分配时每个线程至少处理的长度
+const size_t g_shm_prefault_min_chunk = 16UL << 20;
+
+// 创建耗时
+struct SHM_CREATE_TIMING {
+    // shmget + shmat
+    uint64_t get_ns;
+    // 设置 NUMA 放置策略
+    uint64_t numa_ns;
+    // 预分配
+    uint64_t prefault_ns;
+    // 整个创建过程（含设置头部）
+    uint64_t total_ns;
+    // 实际使用的预分配方式和线程数
+    SHM_PREFAULT_MODE prefault_mode;
+    uint32_t prefault_threads;
+};
+
+/**
+ * @brief 预分配一段内存
+ *
+ * @param addr 页对齐的地址
+ * @param length
+ * @param mode
+ * @return SHM_PREFAULT_MODE 实际使用的方式
+ */
+inline SHM_PREFAULT_MODE shm_prefault_range(char* addr, size_t length, SHM_PREFAULT_MODE mode) {
+    switch (mode) {
+    case SHM_PREFAULT_MEMSET:
+        memset(addr, 0, length);
+        return mode;
+    case SHM_PREFAULT_MADVISE:
+        if (madvise(addr, length, MADV_POPULATE_WRITE) == 0) {
+            return mode;
+        }
+        // fall through
+    case SHM_PREFAULT_TOUCH: {
+        size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        for (size_t offset = 0; offset < length; offset += page_size) {
+            // 原子地或 0，触发写缺页但不改变内容，不会覆盖并发写入的数据
+            __atomic_fetch_or(addr + offset, 0, __ATOMIC_RELAXED);
+        }
+        return SHM_PREFAULT_TOUCH;
+    }
+    default:
+        return SHM_PREFAULT_NONE;
+    }
+}
+
+/**
+ * @brief 预分配整段共享内存，长度较大时按页切分给多个线程
+ *
+ * @param addr 页对齐的地址
+ * @param length
+ * @param mode
+ * @param threads 期望的线程数，实际线程数保证每个线程至少处理 g_shm_prefault_min_chunk
+ * @param timing 记录实际使用的方式和线程数
+ */
+inline void shm_prefault(void* addr, size_t length, SHM_PREFAULT_MODE mode, uint32_t threads,
+    SHM_CREATE_TIMING* timing) {
+    char* base = reinterpret_cast<char*>(addr);
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t max_threads = std::max<size_t>(1, length / g_shm_prefault_min_chunk);
+    size_t thread_count = std::min<size_t>(std::max<uint32_t>(threads, 1), max_threads);
+    if (mode == SHM_PREFAULT_NONE || mode == SHM_PREFAULT_MEMSET) {
+        thread_count = 1;
+    }
+    timing->prefault_threads = static_cast<uint32_t>(thread_count);
+    if (thread_count == 1) {
+        timing->prefault_mode = shm_prefault_range(base, length, mode);
+        return;
+    }
+    size_t pages = (length + page_size - 1) / page_size;
+    size_t pages_per_thread = (pages + thread_count - 1) / thread_count;
+    std::vector<SHM_PREFAULT_MODE> used(thread_count, mode);
+    std::vector<std::thread> workers;
+    workers.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        size_t begin = i * pages_per_thread * page_size;
+        if (begin >= length) {
+            break;
+        }
+        size_t end = std::min(length, begin + pages_per_thread * page_size);
+        workers.emplace_back([base, begin, end, mode, &used, i]() {
+            used[i] = shm_prefault_range(base + begin, end - begin, mode);
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    timing->prefault_mode = used[0];
+}
+
+}  // namespace thread_mem_shm_sdk
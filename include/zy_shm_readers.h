@@ -0,0 +1,283 @@
+/**
+ * @file zy_shm_readers.h
+ * @author noahyzhang
+ * @brief 共享内存内的读者表
+ * 读者挂载时占用一个槽位，记录进程号、正在读取的发布代数（epoch）和心跳，写者据此得到仍在读取的最旧代数，
+ * 比它更旧的版本可以安全回收（类似 RCU）；观察工具据此得到每个读者落后的代数。进程退出后槽位由写者或新读者回收，
+ * 槽位同时记录进程的启动时间，进程号被新进程复用时同样视为已退出
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include "zy_utils.h"
+
+namespace thread_mem_shm_sdk {
+
+// 最多支持的读者槽位个数
+const uint32_t g_shm_max_reader_count = 255;
+
+// 读者空闲时的 epoch，取最小值时自然被忽略
+const uint64_t g_shm_reader_idle_epoch = UINT64_MAX;
+
+// 槽位正在被回收时 pid 的取值，不是合法的进程号，避免多个回收者重复归还读者计数
+const uint32_t g_shm_reader_reaping_pid = UINT32_MAX;
+
+/**
+ * @brief 读者槽位，每个槽位占一个缓存行，读者只写自己的槽位
+ * 槽位所在的内存在创建时已被清零，pid 为 0 表示空闲
+ */
+struct alignas(64) SHM_READER_SLOT {
+    std::atomic<uint32_t> pid;
+    // 多缓冲模式下占用的缓冲区加一，0 表示没有占用，回收时据此归还读者计数
+    std::atomic<uint32_t> pinned_buffer;
+    // 正在读取的发布代数，空闲时为 g_shm_reader_idle_epoch
+    std::atomic<uint64_t> epoch;
+    // 最近一次读完的发布代数
+    std::atomic<uint64_t> last_epoch;
+    // 最近一次读完或主动心跳的单调时间
+    std::atomic<uint64_t> heartbeat_ns;
+    std::atomic<uint64_t> read_count;
+    // 进程的启动时间（/proc/<pid>/stat 第 22 项，开机后的时钟滴答数），0 表示未知，只按进程号判断
+    std::atomic<uint64_t> start_time;
+};
+
+// 读者的状态，供观察工具展示
+struct SHM_READER_INFO {
+    uint32_t slot;
+    uint32_t pid;
+    // 进程是否存活
+    bool alive;
+    // 是否正在读取
+    bool reading;
+    uint64_t epoch;
+    uint64_t last_epoch;
+    // 落后于当前发布的代数
+    uint64_t lag;
+    uint64_t heartbeat_age_ns;
+    uint64_t read_count;
+};
+
+/**
+ * @brief 读取进程的启动时间，即 /proc/<pid>/stat 的第 22 项
+ *
+ * @param pid
+ * @return uint64_t 开机后的时钟滴答数，读取失败返回 0
+ */
+inline uint64_t shm_process_start_time(uint32_t pid) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    char buf[512];
+    ssize_t len = ::read(fd, buf, sizeof(buf) - 1);
+    ::close(fd);
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+    // 第 2 项进程名可能包含空格和括号，从最后一个 ')' 之后开始数，其后第一项为第 3 项
+    char* p = strrchr(buf, ')');
+    if (p == nullptr) {
+        return 0;
+    }
+    ++p;
+    for (int field = 3; field < 22; ++field) {
+        p = strchr(p + 1, ' ');
+        if (p == nullptr) {
+            return 0;
+        }
+    }
+    return strtoull(p + 1, nullptr, 10);
+}
+
+/**
+ * @brief 进程是否存活，没有权限发信号的进程同样视为存活；
+ * 记录了启动时间时还要求启动时间一致，否则是复用了该进程号的新进程
+ *
+ * @param pid
+ * @param start_time 占用槽位时记录的启动时间，0 表示不比较
+ * @return true
+ * @return false
+ */
+inline bool shm_reader_alive(uint32_t pid, uint64_t start_time) {
+    if (kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH) {
+        return false;
+    }
+    if (start_time == 0) {
+        return true;
+    }
+    // 读不到 /proc 时无法判断，保守地视为存活
+    uint64_t cur_start_time = shm_process_start_time(pid);
+    return cur_start_time == 0 || cur_start_time == start_time;
+}
+
+/**
+ * @brief 槽位中记录的读者是否存活
+ *
+ * @param slot
+ * @param pid 已从槽位中以 acquire 读出的进程号
+ * @return true
+ * @return false
+ */
+inline bool shm_reader_alive(const SHM_READER_SLOT& slot, uint32_t pid) {
+    return shm_reader_alive(pid, slot.start_time.load(std::memory_order_relaxed));
+}
+
+/**
+ * @brief 获取当前进程号，fork 后在子进程中刷新，避免读写路径上每次都调用 getpid 陷入内核
+ * 用于识别从父进程继承的读者槽位，不经过 fork 处理函数直接调用 clone 创建的进程不能识别
+ *
+ * @return uint32_t
+ */
+inline uint32_t shm_current_pid() {
+    static std::atomic<uint32_t> s_pid{static_cast<uint32_t>(getpid())};
+    static int s_atfork = pthread_atfork(nullptr, nullptr, [] {
+        s_pid.store(static_cast<uint32_t>(getpid()), std::memory_order_relaxed);
+    });
+    (void)s_atfork;
+    return s_pid.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 占用一个空闲槽位
+ *
+ * @param slots
+ * @param count
+ * @param pid
+ * @return int 槽位编号，没有空闲槽位返回 -1
+ */
+inline int shm_reader_claim(SHM_READER_SLOT* slots, uint32_t count, uint32_t pid) {
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t expected = 0;
+        if (slots[i].pid.load(std::memory_order_relaxed) == 0
+            && slots[i].pid.compare_exchange_strong(expected, pid, std::memory_order_acq_rel)) {
+            slots[i].pinned_buffer.store(0, std::memory_order_relaxed);
+            slots[i].epoch.store(g_shm_reader_idle_epoch, std::memory_order_relaxed);
+            slots[i].last_epoch.store(0, std::memory_order_relaxed);
+            slots[i].heartbeat_ns.store(get_now_monotonic_time_ns(), std::memory_order_relaxed);
+            slots[i].read_count.store(0, std::memory_order_relaxed);
+            slots[i].start_time.store(shm_process_start_time(pid), std::memory_order_release);
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 释放槽位
+ *
+ * @param slot
+ */
+inline void shm_reader_release(SHM_READER_SLOT* slot) {
+    slot->epoch.store(g_shm_reader_idle_epoch, std::memory_order_relaxed);
+    // 先于 pid 清零，下一个占用者写入启动时间之前其他进程读到的是 0 而不是上一个占用者的启动时间
+    slot->start_time.store(0, std::memory_order_relaxed);
+    slot->pid.store(0, std::memory_order_release);
+}
+
+/**
+ * @brief 回收已退出进程的槽位
+ * 先把 pid 换成 g_shm_reader_reaping_pid 独占该槽位，归还占用的缓冲区后再置为空闲
+ *
+ * @tparam F 形如 void(uint32_t buffer)，归还多缓冲的读者计数
+ * @param slots
+ * @param count
+ * @param unpin_func
+ * @return uint32_t 回收的槽位个数
+ */
+template <class F>
+uint32_t shm_reader_reap(SHM_READER_SLOT* slots, uint32_t count, F&& unpin_func) {
+    uint32_t reaped = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t pid = slots[i].pid.load(std::memory_order_acquire);
+        if (pid == 0 || pid == g_shm_reader_reaping_pid || shm_reader_alive(slots[i], pid)) {
+            continue;
+        }
+        if (!slots[i].pid.compare_exchange_strong(pid, g_shm_reader_reaping_pid, std::memory_order_acq_rel)) {
+            continue;
+        }
+        uint32_t pinned_buffer = slots[i].pinned_buffer.exchange(0, std::memory_order_relaxed);
+        if (pinned_buffer != 0) {
+            unpin_func(pinned_buffer - 1);
+        }
+        shm_reader_release(&slots[i]);
+        ++reaped;
+    }
+    return reaped;
+}
+
+/**
+ * @brief 仍在读取的最旧发布代数，已退出的进程不计入
+ *
+ * @param slots
+ * @param count
+ * @param generation 当前发布的代数，没有读者在读取时返回该值
+ * @return uint64_t 代数小于返回值的版本没有读者在读取
+ */
+inline uint64_t shm_reader_oldest_epoch(const SHM_READER_SLOT* slots, uint32_t count, uint64_t generation) {
+    uint64_t oldest = generation;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t epoch = slots[i].epoch.load(std::memory_order_seq_cst);
+        if (epoch >= oldest) {
+            continue;
+        }
+        uint32_t pid = slots[i].pid.load(std::memory_order_acquire);
+        if (pid != 0 && pid != g_shm_reader_reaping_pid && shm_reader_alive(slots[i], pid)) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * @brief 收集所有已占用槽位的读者状态
+ *
+ * @param slots
+ * @param count
+ * @param generation 当前发布的代数
+ * @param infos
+ */
+inline void shm_reader_collect(const SHM_READER_SLOT* slots, uint32_t count, uint64_t generation,
+    std::vector<SHM_READER_INFO>* infos) {
+    infos->clear();
+    uint64_t now_ns = get_now_monotonic_time_ns();
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t pid = slots[i].pid.load(std::memory_order_acquire);
+        if (pid == 0 || pid == g_shm_reader_reaping_pid) {
+            continue;
+        }
+        SHM_READER_INFO info;
+        info.slot = i;
+        info.pid = pid;
+        info.alive = shm_reader_alive(slots[i], pid);
+        info.epoch = slots[i].epoch.load(std::memory_order_relaxed);
+        info.reading = info.epoch != g_shm_reader_idle_epoch;
+        info.last_epoch = slots[i].last_epoch.load(std::memory_order_relaxed);
+        info.lag = generation > info.last_epoch ? generation - info.last_epoch : 0;
+        uint64_t heartbeat_ns = slots[i].heartbeat_ns.load(std::memory_order_relaxed);
+        info.heartbeat_age_ns = now_ns > heartbeat_ns ? now_ns - heartbeat_ns : 0;
+        info.read_count = slots[i].read_count.load(std::memory_order_relaxed);
+        infos->push_back(info);
+    }
+}
+
+}  // namespace thread_mem_shm_sdk
@@ -0,0 +1,505 @@
+/**
+ * @file zy_shm_registry.h
+ * @author noahyzhang
+ * @brief 共享内存注册表
+ * 一段注册表共享内存记录名字到共享内存描述（类型、key 或偏移、容量、布局指纹）的映射，
+ * 并在自身的数据区中为许多小的数组分配空间，格式为：
+ * | SHM_REGISTRY_HEADER | SHM_REGISTRY_ENTRY | ... | SHM_REGISTRY_ENTRY | 数据区 |
+ * 读者只需挂载注册表一次，打开数据区中的数组不再需要 shmget/shmat
+ * @version 0.1
+ * @date 2023-06-07
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "zy_array_shm.h"
+#include "zy_base_shm.h"
+#include "zy_shm_error.h"
+
+namespace thread_mem_shm_sdk {
+
+// 注册表的格式版本，高 8 位与数组共享内存的魔数不同，观察工具不会误识别
+const uint32_t g_shm_registry_version = 0xFD000001;
+
+// 名字的最大长度（含结尾的 '\0'）
+const size_t g_shm_registry_name_len = 48;
+
+// 数据区中每个数组的对齐
+const size_t g_shm_registry_align = 64;
+
+// 注册项的类型
+enum SHM_REGISTRY_TYPE {
+    // 位于注册表数据区中，offset 为相对注册表起始的偏移
+    SHM_REGISTRY_INLINE = 1,
+    // 独立的共享内存，key 为其 key
+    SHM_REGISTRY_EXTERNAL = 2,
+};
+
+// 注册表头部
+struct SHM_REGISTRY_HEADER {
+    uint32_t version;
+    // 最多的注册项个数
+    uint32_t max_entry_count;
+    // 已发布的注册项个数，只通过原子操作访问
+    uint32_t entry_count;
+    uint32_t reserved;
+    // 数据区相对注册表起始的偏移及长度
+    uint64_t data_offset;
+    uint64_t data_size;
+    // 数据区已分配的长度，只由唯一的添加者修改，读者通过原子操作读取
+    uint64_t data_used;
+};
+
+// 注册项
+struct SHM_REGISTRY_ENTRY {
+    char name[g_shm_registry_name_len];
+    // SHM_REGISTRY_TYPE
+    uint32_t type;
+    // 布局指纹，即数组头部中的 version
+    uint32_t version;
+    // SHM_REGISTRY_EXTERNAL 时为共享内存的 key
+    uint64_t key;
+    // SHM_REGISTRY_INLINE 时为相对注册表起始的偏移
+    uint64_t offset;
+    // 占用的长度
+    uint64_t capacity;
+    uint32_t node_size;
+    uint32_t max_node_count;
+    uint64_t reserved;
+};
+
+/**
+ * @brief 共享内存注册表
+ * 只支持单个写者添加注册项（data_used、entry_count 的读改写都不是原子的），多个写者需要在添加时加 CSemaphore 互斥；
+ * 注册项填写完成后才增加 entry_count，读者查找时不需要加锁。数据区按顺序分配，不回收
+ */
+class CShmRegistry : public CShm<SHM_REGISTRY_ENTRY, SHM_REGISTRY_HEADER, CShmRegistry> {
+    using BASE = CShm<SHM_REGISTRY_ENTRY, SHM_REGISTRY_HEADER, CShmRegistry>;
+    friend BASE;
+
+public:
+    CShmRegistry() = default;
+    ~CShmRegistry() = default;
+
+public:
+    /**
+     * @brief 初始化
+     *
+     * @param shm_key
+     * @param max_entry_count 创建时的最多注册项个数
+     * @param data_size 创建时的数据区长度
+     * @param is_create
+     * @param options
+     * @return true
+     * @return false
+     */
+    bool init(size_t shm_key, size_t max_entry_count = 0, size_t data_size = 0, bool is_create = false,
+        const SHM_OPTIONS& options = SHM_OPTIONS());
+
+    /**
+     * @brief 在数据区中创建名为 name 的数组
+     * 已存在时（如写者重启）以写者身份重新挂载：不改写头部、不占用读者槽位，崩溃安全模式下丢弃未提交的发布，
+     * 此时 max_node_count 必须与创建时一致
+     *
+     * @tparam T
+     * @tparam TH
+     * @param name
+     * @param max_node_count
+     * @param array_shm 未初始化的数组
+     * @param options
+     * @return true
+     * @return false
+     */
+    template <class T, class TH>
+    bool create_array(const char* name, size_t max_node_count, CArrayShm<T, TH>* array_shm,
+        const ARRAY_SHM_OPTIONS& options = ARRAY_SHM_OPTIONS());
+
+    /**
+     * @brief 登记一个独立的数组共享内存，读者可以按名字找到其 key
+     *
+     * @tparam T
+     * @tparam TH
+     * @param name
+     * @param shm_key
+     * @param max_node_count
+     * @param options 与该数组创建时的选项一致，用于记录容量
+     * @return true
+     * @return false
+     */
+    template <class T, class TH = ARRAY_SHM_HEADER>
+    bool add_external_array(const char* name, size_t shm_key, size_t max_node_count,
+        const ARRAY_SHM_OPTIONS& options = ARRAY_SHM_OPTIONS());
+
+    /**
+     * @brief 按名字打开数组，数据区中的数组不产生系统调用，独立的数组按 key 挂载
+     * 注册表只读挂载时数组也只读打开
+     *
+     * @tparam T
+     * @tparam TH
+     * @param name
+     * @param array_shm 未初始化的数组
+     * @param options
+     * @return true
+     * @return false
+     */
+    template <class T, class TH>
+    bool open_array(const char* name, CArrayShm<T, TH>* array_shm,
+        const ARRAY_SHM_OPTIONS& options = ARRAY_SHM_OPTIONS());
+
+    /**
+     * @brief 按名字查找注册项
+     *
+     * @param name
+     * @param entry
+     * @return true
+     * @return false
+     */
+    bool find(const char* name, SHM_REGISTRY_ENTRY* entry);
+
+    /**
+     * @brief 已发布的注册项个数
+     *
+     * @return uint32_t
+     */
+    uint32_t get_entry_count() const {
+        return is_init_ ? __atomic_load_n(&shm_header()->entry_count, __ATOMIC_ACQUIRE) : 0;
+    }
+
+    /**
+     * @brief 第 idx 个注册项，idx 必须小于 get_entry_count
+     *
+     * @param idx
+     * @return const SHM_REGISTRY_ENTRY*
+     */
+    const SHM_REGISTRY_ENTRY* get_entry(uint32_t idx) const { return get_node_by_pos(idx); }
+
+    /**
+     * @brief 数据区已分配和总的长度
+     *
+     * @param used
+     * @param size
+     */
+    void get_data_usage(uint64_t* used, uint64_t* size) const {
+        *used = is_init_ ? __atomic_load_n(&shm_header()->data_used, __ATOMIC_ACQUIRE) : 0;
+        *size = is_init_ ? shm_header()->data_size : 0;
+    }
+
+private:
+    /**
+     * @brief 设置头部
+     *
+     * @return true
+     * @return false
+     */
+    bool set_header();
+
+    /**
+     * @brief 解析头部
+     *
+     * @param header
+     * @return size_t 整个共享内存的长度，出错返回 0
+     */
+    size_t parse_header(const SHM_REGISTRY_HEADER& header);
+
+    /**
+     * @brief 共享内存中的头部
+     *
+     * @return SHM_REGISTRY_HEADER*
+     */
+    SHM_REGISTRY_HEADER* shm_header() const {
+        return reinterpret_cast<SHM_REGISTRY_HEADER*>(get_shm_addr());
+    }
+
+    /**
+     * @brief 按名字查找注册项
+     *
+     * @param name
+     * @return const SHM_REGISTRY_ENTRY* 不存在时返回 nullptr
+     */
+    const SHM_REGISTRY_ENTRY* lookup(const char* name) const;
+
+    /**
+     * @brief 注册项是否还有空位
+     *
+     * @param where
+     * @param entry_count 已发布的注册项个数，即新注册项的位置
+     * @return true
+     * @return false
+     */
+    bool check_room(const char* where, uint32_t* entry_count);
+
+    /**
+     * @brief 在 check_room 得到的位置填写并发布一个注册项
+     *
+     * @param entry
+     * @param entry_count check_room 返回的已发布的注册项个数
+     */
+    void add_entry(const SHM_REGISTRY_ENTRY& entry, uint32_t entry_count);
+
+    /**
+     * @brief 检查名字并准备注册项
+     *
+     * @param name
+     * @param entry
+     * @param where
+     * @return true
+     * @return false
+     */
+    bool make_entry(const char* name, SHM_REGISTRY_ENTRY* entry, const char* where);
+
+private:
+    bool is_init_{false};
+    // 创建时的参数
+    size_t max_entry_count_{0};
+    size_t data_size_{0};
+};
+
+/**
+ * @brief 数据区的偏移
+ *
+ * @param max_entry_count
+ * @return uint64_t
+ */
+inline uint64_t shm_registry_data_offset(size_t max_entry_count) {
+    size_t offset = sizeof(SHM_REGISTRY_HEADER) + max_entry_count * sizeof(SHM_REGISTRY_ENTRY);
+    return (offset + g_shm_registry_align - 1) / g_shm_registry_align * g_shm_registry_align;
+}
+
+inline bool CShmRegistry::init(size_t shm_key, size_t max_entry_count, size_t data_size, bool is_create,
+    const SHM_OPTIONS& options) {
+    if (is_init_) {
+        set_err(SHM_ERR_ALREADY_INIT, "CShmRegistry::init");
+        return false;
+    }
+    if (is_create && max_entry_count == 0) {
+        set_err(SHM_ERR_INVALID_PARAM, "CShmRegistry::init");
+        return false;
+    }
+    max_entry_count_ = max_entry_count;
+    data_size_ = data_size;
+    size_t body_size = shm_registry_data_offset(max_entry_count) + data_size - sizeof(SHM_REGISTRY_HEADER);
+    if (!BASE::init(shm_key, is_create ? body_size : 0, is_create, options)) {
+        return false;
+    }
+    is_init_ = true;
+    return true;
+}
+
+inline bool CShmRegistry::set_header() {
+    SHM_REGISTRY_HEADER header;
+    memset(&header, 0, sizeof(header));
+    header.version = g_shm_registry_version;
+    header.max_entry_count = static_cast<uint32_t>(max_entry_count_);
+    header.data_offset = shm_registry_data_offset(max_entry_count_);
+    header.data_size = data_size_;
+    return do_set_header(header);
+}
+
+inline size_t CShmRegistry::parse_header(const SHM_REGISTRY_HEADER& header) {
+    if (header.version != g_shm_registry_version) {
+        set_err(SHM_ERR_VERSION, "CShmRegistry::parse_header", header.version, g_shm_registry_version);
+        return 0;
+    }
+    if (header.data_offset != shm_registry_data_offset(header.max_entry_count)) {
+        set_err(SHM_ERR_NODE_COUNT, "CShmRegistry::parse_header", header.entry_count, header.max_entry_count);
+        return 0;
+    }
+    return header.data_offset + header.data_size;
+}
+
+inline const SHM_REGISTRY_ENTRY* CShmRegistry::lookup(const char* name) const {
+    uint32_t entry_count = get_entry_count();
+    for (uint32_t i = 0; i < entry_count; ++i) {
+        const SHM_REGISTRY_ENTRY* entry = get_node_by_pos(i);
+        if (strncmp(entry->name, name, g_shm_registry_name_len) == 0) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+inline bool CShmRegistry::find(const char* name, SHM_REGISTRY_ENTRY* entry) {
+    if (name == nullptr || entry == nullptr) {
+        set_err(SHM_ERR_INVALID_PARAM, "CShmRegistry::find");
+        return false;
+    }
+    if (!is_init_) {
+        set_err(SHM_ERR_NOT_INIT, "CShmRegistry::find");
+        return false;
+    }
+    const SHM_REGISTRY_ENTRY* found = lookup(name);
+    if (found == nullptr) {
+        set_err(SHM_ERR_NOT_EXIST, "CShmRegistry::find");
+        return false;
+    }
+    memcpy(entry, found, sizeof(SHM_REGISTRY_ENTRY));
+    return true;
+}
+
+inline bool CShmRegistry::make_entry(const char* name, SHM_REGISTRY_ENTRY* entry, const char* where) {
+    if (!is_init_) {
+        set_err(SHM_ERR_NOT_INIT, where);
+        return false;
+    }
+    if (is_read_only()) {
+        set_err(SHM_ERR_READ_ONLY, where);
+        return false;
+    }
+    if (name == nullptr || name[0] == '\0' || strlen(name) >= g_shm_registry_name_len) {
+        set_err(SHM_ERR_INVALID_PARAM, where);
+        return false;
+    }
+    memset(entry, 0, sizeof(SHM_REGISTRY_ENTRY));
+    memcpy(entry->name, name, strlen(name));
+    return true;
+}
+
+inline bool CShmRegistry::check_room(const char* where, uint32_t* entry_count) {
+    SHM_REGISTRY_HEADER* header = shm_header();
+    if (!is_init_ || header == nullptr) {
+        set_err(SHM_ERR_NOT_INIT, where);
+        return false;
+    }
+    *entry_count = __atomic_load_n(&header->entry_count, __ATOMIC_RELAXED);
+    if (*entry_count >= header->max_entry_count) {
+        set_err(SHM_ERR_NODE_COUNT, where, *entry_count + 1, header->max_entry_count);
+        return false;
+    }
+    return true;
+}
+
+inline void CShmRegistry::add_entry(const SHM_REGISTRY_ENTRY& entry, uint32_t entry_count) {
+    // 只有唯一的添加者，entry_count 在 check_room 之后不会变化
+    memcpy(get_node_by_pos(entry_count), &entry, sizeof(SHM_REGISTRY_ENTRY));
+    // 注册项填写完成后才对读者可见
+    __atomic_store_n(&shm_header()->entry_count, entry_count + 1, __ATOMIC_RELEASE);
+}
+
+template <class T, class TH>
+bool CShmRegistry::create_array(const char* name, size_t max_node_count, CArrayShm<T, TH>* array_shm,
+    const ARRAY_SHM_OPTIONS& options) {
+    if (array_shm == nullptr) {
+        set_err(SHM_ERR_INVALID_PARAM, "CShmRegistry::create_array");
+        return false;
+    }
+    SHM_REGISTRY_ENTRY entry;
+    if (!make_entry(name, &entry, "CShmRegistry::create_array")) {
+        return false;
+    }
+    SHM_REGISTRY_HEADER* header = shm_header();
+    uint64_t capacity = CArrayShm<T, TH>::calc_length(max_node_count, options);
+    capacity = (capacity + g_shm_registry_align - 1) / g_shm_registry_align * g_shm_registry_align;
+    const SHM_REGISTRY_ENTRY* found = lookup(name);
+    if (found != nullptr) {
+        if (found->type != SHM_REGISTRY_INLINE || found->version != CArrayShm<T, TH>::get_layout_version()
+            || found->capacity != capacity || found->max_node_count != max_node_count) {
+            set_err(SHM_ERR_INVALID_PARAM, "CShmRegistry::create_array", found->max_node_count, max_node_count);
+            return false;
+        }
+        // 写者重启，以写者身份重新挂载
+        if (!array_shm->reopen_in_place(get_shm_addr() + found->offset, found->capacity, options)) {
+            set_err(array_shm->get_err_code(), "CShmRegistry::create_array");
+            return false;
+        }
+        return true;
+    }
+    // 先确认注册项有空位再初始化数组，失败时不占用数据区
+    uint32_t entry_count = 0;
+    if (!check_room("CShmRegistry::create_array", &entry_count)) {
+        return false;
+    }
+    // 只有唯一的添加者修改 data_used，不需要 CAS
+    uint64_t data_used = __atomic_load_n(&header->data_used, __ATOMIC_RELAXED);
+    if (max_node_count == 0 || data_used + capacity > header->data_size) {
+        set_err(SHM_ERR_INVALID_PARAM, "CShmRegistry::create_array", data_used + capacity, header->data_size);
+        return false;
+    }
+    entry.type = SHM_REGISTRY_INLINE;
+    entry.version = CArrayShm<T, TH>::get_layout_version();
+    entry.offset = header->data_offset + data_used;
+    entry.capacity = capacity;
+    entry.node_size = sizeof(T);
+    entry.max_node_count = static_cast<uint32_t>(max_node_count);
+    if (!array_shm->init_in_place(get_shm_addr() + entry.offset, capacity, max_node_count, true, options)) {
+        set_err(array_shm->get_err_code(), "CShmRegistry::create_array");
+        return false;
+    }
+    __atomic_store_n(&header->data_used, data_used + capacity, __ATOMIC_RELEASE);
+    add_entry(entry, entry_count);
+    return true;
+}
+
+template <class T, class TH>
+bool CShmRegistry::add_external_array(const char* name, size_t shm_key, size_t max_node_count,
+    const ARRAY_SHM_OPTIONS& options) {
+    SHM_REGISTRY_ENTRY entry;
+    if (!make_entry(name, &entry, "CShmRegistry::add_external_array")) {
+        return false;
+    }
+    const SHM_REGISTRY_ENTRY* found = lookup(name);
+    if (found != nullptr) {
+        if (found->type == SHM_REGISTRY_EXTERNAL && found->key == shm_key) {
+            return true;
+        }
+        set_err(SHM_ERR_INVALID_PARAM, "CShmRegistry::add_external_array", shm_key, found->key);
+        return false;
+    }
+    entry.type = SHM_REGISTRY_EXTERNAL;
+    entry.version = CArrayShm<T, TH>::get_layout_version();
+    entry.key = shm_key;
+    entry.capacity = CArrayShm<T, TH>::calc_length(max_node_count, options);
+    entry.node_size = sizeof(T);
+    entry.max_node_count = static_cast<uint32_t>(max_node_count);
+    uint32_t entry_count = 0;
+    if (!check_room("CShmRegistry::add_external_array", &entry_count)) {
+        return false;
+    }
+    add_entry(entry, entry_count);
+    return true;
+}
+
+template <class T, class TH>
+bool CShmRegistry::open_array(const char* name, CArrayShm<T, TH>* array_shm, const ARRAY_SHM_OPTIONS& options) {
+    if (name == nullptr || array_shm == nullptr) {
+        set_err(SHM_ERR_INVALID_PARAM, "CShmRegistry::open_array");
+        return false;
+    }
+    if (!is_init_) {
+        set_err(SHM_ERR_NOT_INIT, "CShmRegistry::open_array");
+        return false;
+    }
+    const SHM_REGISTRY_ENTRY* entry = lookup(name);
+    if (entry == nullptr) {
+        set_err(SHM_ERR_NOT_EXIST, "CShmRegistry::open_array");
+        return false;
+    }
+    if (entry->version != CArrayShm<T, TH>::get_layout_version()) {
+        set_err(SHM_ERR_VERSION, "CShmRegistry::open_array", entry->version, CArrayShm<T, TH>::get_layout_version());
+        return false;
+    }
+    ARRAY_SHM_OPTIONS open_options = options;
+    open_options.read_only = options.read_only || is_read_only();
+    bool res = false;
+    if (entry->type == SHM_REGISTRY_INLINE) {
+        if (entry->offset + entry->capacity > shm_header()->data_offset + shm_header()->data_size) {
+            set_err(SHM_ERR_NODE_COUNT, "CShmRegistry::open_array", entry->offset + entry->capacity,
+                shm_header()->data_offset + shm_header()->data_size);
+            return false;
+        }
+        res = array_shm->init_in_place(get_shm_addr() + entry->offset, entry->capacity, 0, false, open_options);
+    } else {
+        res = array_shm->init(entry->key, 0, false, open_options);
+    }
+    if (!res) {
+        set_err(array_shm->get_err_code(), "CShmRegistry::open_array");
+        return false;
+    }
+    return true;
+}
+
+}  // namespace thread_mem_shm_sdk
@@ -0,0 +1,133 @@
+/**
+ * @file zy_shm_stats.h
+ * @author noahyzhang
+ * @brief 共享内存内的统计块，热路径上使用 relaxed 原子操作更新，其他进程无需加锁即可读取
+ * @version 0.1
+ * @date 2023-05-08
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+namespace thread_mem_shm_sdk {
+
+// 等待时间直方图的桶个数，第 i 个桶统计 [2^(i-1), 2^i) 纳秒，最后一个桶统计更大的值
+const uint32_t g_shm_stats_hist_buckets = 40;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shm stats require lock free 64-bit atomics");
+
+/**
+ * @brief 统计块，写者和读者的计数放在不同的 cache line 上，避免互相干扰
+ * 统计块所在的内存在创建时已被清零
+ */
+struct SHM_STATS {
+    // 写者
+    alignas(64) std::atomic<uint64_t> insert_count;
+    std::atomic<uint64_t> insert_node_count;
+    std::atomic<uint64_t> last_publish_latency_ns;
+    std::atomic<uint64_t> max_publish_latency_ns;
+    std::atomic<uint64_t> last_publish_time_ns;
+
+    // 读者
+    alignas(64) std::atomic<uint64_t> traverse_count;
+    std::atomic<uint64_t> traverse_fail_count;
+    std::atomic<uint64_t> version_err_count;
+    std::atomic<uint64_t> crc_err_count;
+    std::atomic<uint64_t> last_reader_age_ns;
+    std::atomic<uint64_t> max_reader_age_ns;
+
+    // 信号量
+    alignas(64) std::atomic<uint64_t> lock_count;
+    std::atomic<uint64_t> lock_fail_count;
+    std::atomic<uint64_t> lock_wait_total_ns;
+    std::atomic<uint64_t> lock_wait_max_ns;
+    std::atomic<uint64_t> lock_wait_hist[g_shm_stats_hist_buckets];
+};
+
+/**
+ * @brief 计数加 val
+ *
+ * @param counter
+ * @param val
+ */
+inline void shm_stats_add(std::atomic<uint64_t>* counter, uint64_t val = 1) {
+    counter->fetch_add(val, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 设置计数
+ *
+ * @param counter
+ * @param val
+ */
+inline void shm_stats_set(std::atomic<uint64_t>* counter, uint64_t val) {
+    counter->store(val, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 更新最大值
+ *
+ * @param counter
+ * @param val
+ */
+inline void shm_stats_max(std::atomic<uint64_t>* counter, uint64_t val) {
+    uint64_t cur = counter->load(std::memory_order_relaxed);
+    while (cur < val && !counter->compare_exchange_weak(cur, val, std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief 读取计数
+ *
+ * @param counter
+ * @return uint64_t
+ */
+inline uint64_t shm_stats_get(const std::atomic<uint64_t>& counter) {
+    return counter.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 获取纳秒值对应的直方图桶
+ *
+ * @param ns
+ * @return uint32_t
+ */
+inline uint32_t shm_stats_hist_bucket(uint64_t ns) {
+    uint32_t bucket = (ns == 0) ? 0 : (64 - __builtin_clzll(ns));
+    return (bucket < g_shm_stats_hist_buckets) ? bucket : (g_shm_stats_hist_buckets - 1);
+}
+
+/**
+ * @brief 获取直方图桶的上界（纳秒），最后一个桶没有上界
+ *
+ * @param bucket
+ * @return uint64_t
+ */
+inline uint64_t shm_stats_hist_upper_ns(uint32_t bucket) {
+    return (bucket + 1 < g_shm_stats_hist_buckets) ? (1ULL << bucket) : UINT64_MAX;
+}
+
+/**
+ * @brief 记录一次加锁
+ *
+ * @param stats
+ * @param wait_ns
+ * @param success
+ */
+inline void shm_stats_record_lock(SHM_STATS* stats, uint64_t wait_ns, bool success) {
+    if (!success) {
+        shm_stats_add(&stats->lock_fail_count);
+        return;
+    }
+    shm_stats_add(&stats->lock_count);
+    shm_stats_add(&stats->lock_wait_total_ns, wait_ns);
+    shm_stats_max(&stats->lock_wait_max_ns, wait_ns);
+    shm_stats_add(&stats->lock_wait_hist[shm_stats_hist_bucket(wait_ns)]);
+}
+
+}  // namespace thread_mem_shm_sdk
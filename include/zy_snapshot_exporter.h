@@ -0,0 +1,527 @@
+/**
+ * @file zy_snapshot_exporter.h
+ * @author noahyzhang
+ * @brief 快照导出器，将数组共享内存的发布流式写入列式快照文件
+ * @version 0.1
+ * @date 2023-05-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "zy_array_shm.h"
+#include "zy_semaphore.h"
+#include "zy_snapshot_format.h"
+
+namespace thread_mem_shm_sdk {
+
+/**
+ * @brief 快照导出器
+ * 挂载到 CArrayShm 上，每次 poll 时如果发现新的一代发布，则将其暂存；
+ * 暂存的代数达到 block_gen_count 时编码成一个 BLOCK 追加到内存映射的文件中。
+ * poll 只是采样，两次 poll 之间发布的多代只记录最后一代，跳过的代数累计到文件头的 skipped_generations；
+ * 需要完整历史时由写者在每次 insert 之后调用 append
+ *
+ * @tparam T
+ */
+template <class T>
+class CSnapshotExporter {
+public:
+    CSnapshotExporter() = default;
+    ~CSnapshotExporter() { close(); }
+    CSnapshotExporter(const CSnapshotExporter&) = delete;
+    CSnapshotExporter& operator=(const CSnapshotExporter&) = delete;
+    CSnapshotExporter(CSnapshotExporter&&) = delete;
+    CSnapshotExporter& operator=(CSnapshotExporter&&) = delete;
+
+public:
+    /**
+     * @brief 打开快照文件，文件已存在时会校验格式并在最后一个完整的 BLOCK 之后继续追加
+     *
+     * @param path
+     * @param array_shm 已经初始化过的共享内存，可以为空（此时只能通过 append 写入）
+     * @param block_gen_count 每个 BLOCK 包含的最大代数
+     * @return true
+     * @return false
+     */
+    bool open(const std::string& path, CArrayShm<T>* array_shm, uint32_t block_gen_count = 64);
+
+    /**
+     * @brief 检查共享内存是否有新的一代发布，有则暂存，上一次 poll 之后发布的其他代被跳过并计数
+     *
+     * @param sem 不为空时在拷贝快照期间加锁
+     * @return int 1: 捕获了新的一代，0: 没有变化，-1: 出错
+     */
+    int poll(CSemaphore* sem = nullptr);
+
+    /**
+     * @brief 直接追加一代数据，写者在每次发布后调用时文件中是完整的历史
+     *
+     * @param header
+     * @param node_vec
+     * @return true
+     * @return false
+     */
+    bool append(const ARRAY_SHM_HEADER& header, const std::vector<T>& node_vec);
+
+    /**
+     * @brief 将暂存的数据编码写入文件
+     *
+     * @return true
+     * @return false
+     */
+    bool flush();
+
+    /**
+     * @brief 刷新并关闭文件，文件会被截断到实际使用的长度
+     *
+     * @return true
+     * @return false
+     */
+    bool close();
+
+    /**
+     * @brief 获取错误信息
+     *
+     * @return std::string
+     */
+    std::string get_err_msg() const { return err_msg_; }
+
+    /**
+     * @brief 获取已写入文件的字节数
+     *
+     * @return size_t
+     */
+    size_t get_file_size() const { return file_used_; }
+
+    /**
+     * @brief 获取累计跳过的代数（含重新打开前已写入文件的）
+     *
+     * @return uint64_t
+     */
+    uint64_t get_skipped_generations() const { return skipped_generations_; }
+
+private:
+    /**
+     * @brief 扫描已存在的文件，找到最后一个完整的 BLOCK，并重建索引文件
+     *
+     * @param file_size
+     * @return true
+     * @return false
+     */
+    bool recover(size_t file_size);
+
+    /**
+     * @brief 保证映射区域至少有 length 字节
+     *
+     * @param length
+     * @return true
+     * @return false
+     */
+    bool reserve(size_t length);
+
+    /**
+     * @brief 写入一个索引项
+     *
+     * @param entry
+     * @return true
+     * @return false
+     */
+    bool write_index(const SNAPSHOT_INDEX_ENTRY& entry);
+
+    /**
+     * @brief 读取节点的第 col 列
+     *
+     * @param p_node
+     * @param col
+     * @return uint32_t
+     */
+    uint32_t load_column(const T* p_node, uint32_t col) const {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(p_node) + col * column_width_;
+        if (column_width_ == 1) {
+            return *p;
+        }
+        uint32_t val = 0;
+        memcpy(&val, p, sizeof(val));
+        return val;
+    }
+
+    /**
+     * @brief 差值做 zigzag，差值按列宽回绕
+     *
+     * @param cur
+     * @param prev
+     * @return uint64_t
+     */
+    uint64_t column_delta(uint32_t cur, uint32_t prev) const {
+        if (column_width_ == 1) {
+            return zigzag_encode(static_cast<int8_t>(static_cast<uint8_t>(cur - prev)));
+        }
+        return zigzag_encode(static_cast<int32_t>(cur - prev));
+    }
+
+private:
+    static const size_t MIN_MAP_SIZE = 64 * 1024 * 1024;
+    // 单个 varint 最大长度
+    static const size_t MAX_VARINT_LEN = 10;
+
+    CArrayShm<T>* array_shm_{nullptr};
+    uint32_t block_gen_count_{64};
+    uint32_t column_width_{0};
+    uint32_t column_count_{0};
+
+    int fd_{-1};
+    int idx_fd_{-1};
+    uint8_t* p_map_{nullptr};
+    size_t map_size_{0};
+    size_t file_used_{0};
+
+    bool has_last_{false};
+    uint64_t last_generation_{0};
+    uint64_t last_time_ns_{0};
+    uint64_t skipped_generations_{0};
+
+    // 暂存的多代数据
+    std::vector<uint64_t> pending_time_;
+    std::vector<uint64_t> pending_generation_;
+    std::vector<uint32_t> pending_count_;
+    std::vector<T> pending_nodes_;
+
+    ARRAY_SHM_HEADER poll_header_;
+    std::vector<T> poll_nodes_;
+    std::string err_msg_;
+};
+
+template <class T>
+bool CSnapshotExporter<T>::open(const std::string& path, CArrayShm<T>* array_shm, uint32_t block_gen_count) {
+    if (fd_ >= 0) {
+        err_msg_ = "[CSnapshotExporter::open] Already opened";
+        return false;
+    }
+    if (block_gen_count == 0) {
+        err_msg_ = "[CSnapshotExporter::open] block_gen_count should larger than 0";
+        return false;
+    }
+    array_shm_ = array_shm;
+    block_gen_count_ = block_gen_count;
+    column_width_ = snapshot_column_width(sizeof(T));
+    column_count_ = sizeof(T) / column_width_;
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        err_msg_ = "[CSnapshotExporter::open] Failed to open " + path + ", reason: " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) < 0) {
+        err_msg_ = std::string("[CSnapshotExporter::open] Failed to call fstat, reason: ") + strerror(errno);
+        close();
+        return false;
+    }
+    size_t file_size = static_cast<size_t>(st.st_size);
+    if (file_size >= sizeof(SNAPSHOT_FILE_HEADER)) {
+        // 映射前先校验已有文件的格式，避免扩展不属于自己的文件
+        SNAPSHOT_FILE_HEADER file_header;
+        if (pread(fd_, &file_header, sizeof(file_header), 0) != static_cast<ssize_t>(sizeof(file_header))
+            || file_header.magic != g_snapshot_file_magic
+            || file_header.format_version != g_snapshot_format_version
+            || file_header.node_size != sizeof(T)) {
+            err_msg_ = "[CSnapshotExporter::open] Existing file format mismatch: " + path;
+            close();
+            return false;
+        }
+        // 共享内存布局变化后节点的含义可能不同，不能接在旧文件之后继续追加
+        if (file_header.shm_version != CArrayShm<T>::LAYOUT_VERSION) {
+            err_msg_ = "[CSnapshotExporter::open] Existing file shm_version " + std::to_string(file_header.shm_version)
+                + " mismatch current layout " + std::to_string(CArrayShm<T>::LAYOUT_VERSION) + ": " + path;
+            close();
+            return false;
+        }
+    }
+    // 索引文件总是根据快照文件重建
+    idx_fd_ = ::open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (idx_fd_ < 0) {
+        err_msg_ = "[CSnapshotExporter::open] Failed to open index of " + path + ", reason: " + strerror(errno);
+        close();
+        return false;
+    }
+    if (!reserve(file_size > sizeof(SNAPSHOT_FILE_HEADER) ? file_size : sizeof(SNAPSHOT_FILE_HEADER))) {
+        close();
+        return false;
+    }
+    if (file_size >= sizeof(SNAPSHOT_FILE_HEADER)) {
+        if (!recover(file_size)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    SNAPSHOT_FILE_HEADER file_header;
+    memset(&file_header, 0, sizeof(file_header));
+    file_header.magic = g_snapshot_file_magic;
+    file_header.format_version = g_snapshot_format_version;
+    file_header.shm_version = CArrayShm<T>::LAYOUT_VERSION;
+    file_header.node_size = sizeof(T);
+    file_header.column_width = column_width_;
+    file_header.column_count = column_count_;
+    memcpy(p_map_, &file_header, sizeof(file_header));
+    file_used_ = sizeof(file_header);
+    return true;
+}
+
+template <class T>
+bool CSnapshotExporter<T>::recover(size_t file_size) {
+    SNAPSHOT_FILE_HEADER file_header;
+    memcpy(&file_header, p_map_, sizeof(file_header));
+    skipped_generations_ = file_header.skipped_generations;
+    size_t offset = sizeof(SNAPSHOT_FILE_HEADER);
+    while (offset + sizeof(SNAPSHOT_BLOCK_HEADER) <= file_size) {
+        SNAPSHOT_BLOCK_HEADER block_header;
+        memcpy(&block_header, p_map_ + offset, sizeof(block_header));
+        size_t block_size = sizeof(block_header) + block_header.payload_size;
+        // 映射时文件会预先扩展，末尾的零字节或写了一半的 BLOCK 在这里截止
+        if (block_header.magic != g_snapshot_block_magic || block_header.gen_count == 0
+            || offset + block_size > file_size) {
+            break;
+        }
+        SNAPSHOT_INDEX_ENTRY entry;
+        entry.offset = offset;
+        entry.size = block_size;
+        entry.gen_count = block_header.gen_count;
+        entry.time_begin_ns = block_header.time_begin_ns;
+        entry.time_end_ns = block_header.time_end_ns;
+        entry.generation_begin = block_header.generation_begin;
+        entry.generation_end = block_header.generation_end;
+        if (!write_index(entry)) {
+            return false;
+        }
+        has_last_ = true;
+        last_generation_ = block_header.generation_end;
+        offset += block_size;
+    }
+    file_used_ = offset;
+    return true;
+}
+
+template <class T>
+bool CSnapshotExporter<T>::reserve(size_t length) {
+    if (length <= map_size_) {
+        return true;
+    }
+    size_t new_size = map_size_ * 2;
+    if (new_size < MIN_MAP_SIZE) {
+        new_size = MIN_MAP_SIZE;
+    }
+    if (new_size < length) {
+        new_size = length;
+    }
+    if (p_map_ != nullptr) {
+        munmap(p_map_, map_size_);
+        p_map_ = nullptr;
+        map_size_ = 0;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) < 0) {
+        err_msg_ = std::string("[CSnapshotExporter::reserve] Failed to call fstat, reason: ") + strerror(errno);
+        return false;
+    }
+    if (static_cast<size_t>(st.st_size) < new_size && ftruncate(fd_, new_size) < 0) {
+        err_msg_ = std::string("[CSnapshotExporter::reserve] Failed to call ftruncate, reason: ") + strerror(errno);
+        return false;
+    }
+    void* p_map = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p_map == MAP_FAILED) {
+        err_msg_ = std::string("[CSnapshotExporter::reserve] Failed to call mmap, reason: ") + strerror(errno);
+        return false;
+    }
+    p_map_ = reinterpret_cast<uint8_t*>(p_map);
+    map_size_ = new_size;
+    return true;
+}
+
+template <class T>
+bool CSnapshotExporter<T>::write_index(const SNAPSHOT_INDEX_ENTRY& entry) {
+    ssize_t ret = write(idx_fd_, &entry, sizeof(entry));
+    if (ret != static_cast<ssize_t>(sizeof(entry))) {
+        err_msg_ = std::string("[CSnapshotExporter::write_index] Failed to write index, reason: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+template <class T>
+int CSnapshotExporter<T>::poll(CSemaphore* sem) {
+    if (array_shm_ == nullptr) {
+        err_msg_ = "[CSnapshotExporter::poll] array_shm is null";
+        return -1;
+    }
+    if (sem != nullptr && !sem->lock()) {
+        err_msg_ = std::string("[CSnapshotExporter::poll] lock err: ") + sem->get_err_msg();
+        return -1;
+    }
+    bool ret = array_shm_->snapshot(&poll_header_, &poll_nodes_);
+    if (sem != nullptr) {
+        sem->unlock();
+    }
+    if (!ret) {
+        err_msg_ = "[CSnapshotExporter::poll] snapshot err: " + array_shm_->get_err_msg();
+        return -1;
+    }
+    if (has_last_ && poll_header_.generation == last_generation_ && poll_header_.time_ns == last_time_ns_) {
+        return 0;
+    }
+    if (!append(poll_header_, poll_nodes_)) {
+        return -1;
+    }
+    return 1;
+}
+
+template <class T>
+bool CSnapshotExporter<T>::append(const ARRAY_SHM_HEADER& header, const std::vector<T>& node_vec) {
+    if (fd_ < 0) {
+        err_msg_ = "[CSnapshotExporter::append] Not opened";
+        return false;
+    }
+    // 代数回退说明共享内存被重新创建，不算跳过
+    if (has_last_ && header.generation > last_generation_ + 1) {
+        skipped_generations_ += header.generation - last_generation_ - 1;
+    }
+    has_last_ = true;
+    last_generation_ = header.generation;
+    last_time_ns_ = header.time_ns;
+
+    // 文件中统一记录系统时间，按时间范围查询时不依赖写者的时钟源
+    pending_time_.push_back(array_shm_wall_time_ns(header));
+    pending_generation_.push_back(header.generation);
+    pending_count_.push_back(node_vec.size());
+    pending_nodes_.insert(pending_nodes_.end(), node_vec.begin(), node_vec.end());
+    if (pending_time_.size() >= block_gen_count_) {
+        return flush();
+    }
+    return true;
+}
+
+template <class T>
+bool CSnapshotExporter<T>::flush() {
+    if (fd_ < 0) {
+        err_msg_ = "[CSnapshotExporter::flush] Not opened";
+        return false;
+    }
+    size_t gen_count = pending_time_.size();
+    if (gen_count == 0) {
+        return true;
+    }
+    // 最坏情况下的编码长度
+    size_t max_len = sizeof(SNAPSHOT_BLOCK_HEADER) + gen_count * 3 * MAX_VARINT_LEN
+        + pending_nodes_.size() * column_count_ * MAX_VARINT_LEN;
+    if (!reserve(file_used_ + max_len)) {
+        return false;
+    }
+    SNAPSHOT_BLOCK_HEADER block_header;
+    memset(&block_header, 0, sizeof(block_header));
+    block_header.magic = g_snapshot_block_magic;
+    block_header.gen_count = gen_count;
+    block_header.node_total = pending_nodes_.size();
+    block_header.time_begin_ns = pending_time_[0];
+    block_header.time_end_ns = pending_time_[0];
+    for (size_t g = 1; g < gen_count; ++g) {
+        if (pending_time_[g] < block_header.time_begin_ns) {
+            block_header.time_begin_ns = pending_time_[g];
+        }
+        if (pending_time_[g] > block_header.time_end_ns) {
+            block_header.time_end_ns = pending_time_[g];
+        }
+    }
+    block_header.generation_begin = pending_generation_[0];
+    block_header.generation_end = pending_generation_[gen_count - 1];
+
+    uint8_t* p_begin = p_map_ + file_used_ + sizeof(block_header);
+    uint8_t* p_out = p_begin;
+    uint64_t prev_time = block_header.time_begin_ns;
+    uint64_t prev_gen = block_header.generation_begin;
+    for (size_t g = 0; g < gen_count; ++g) {
+        p_out += varint_encode(p_out, zigzag_encode(static_cast<int64_t>(pending_time_[g] - prev_time)));
+        p_out += varint_encode(p_out, zigzag_encode(static_cast<int64_t>(pending_generation_[g] - prev_gen)));
+        p_out += varint_encode(p_out, pending_count_[g]);
+        prev_time = pending_time_[g];
+        prev_gen = pending_generation_[g];
+    }
+    // 按列编码，每个值和上一代同位置的值做差
+    for (uint32_t col = 0; col < column_count_; ++col) {
+        size_t prev_row = 0;
+        size_t prev_count = 0;
+        size_t row = 0;
+        for (size_t g = 0; g < gen_count; ++g) {
+            size_t count = pending_count_[g];
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t cur = load_column(&pending_nodes_[row + i], col);
+                uint32_t prev = (i < prev_count) ? load_column(&pending_nodes_[prev_row + i], col) : 0;
+                p_out += varint_encode(p_out, column_delta(cur, prev));
+            }
+            prev_row = row;
+            prev_count = count;
+            row += count;
+        }
+    }
+    block_header.payload_size = p_out - p_begin;
+    memcpy(p_map_ + file_used_, &block_header, sizeof(block_header));
+
+    SNAPSHOT_INDEX_ENTRY entry;
+    entry.offset = file_used_;
+    entry.size = sizeof(block_header) + block_header.payload_size;
+    entry.gen_count = block_header.gen_count;
+    entry.time_begin_ns = block_header.time_begin_ns;
+    entry.time_end_ns = block_header.time_end_ns;
+    entry.generation_begin = block_header.generation_begin;
+    entry.generation_end = block_header.generation_end;
+    file_used_ += entry.size;
+    reinterpret_cast<SNAPSHOT_FILE_HEADER*>(p_map_)->skipped_generations = skipped_generations_;
+
+    pending_time_.clear();
+    pending_generation_.clear();
+    pending_count_.clear();
+    pending_nodes_.clear();
+    return write_index(entry);
+}
+
+template <class T>
+bool CSnapshotExporter<T>::close() {
+    bool res = true;
+    if (fd_ >= 0) {
+        res = flush();
+    }
+    if (p_map_ != nullptr) {
+        munmap(p_map_, map_size_);
+        p_map_ = nullptr;
+        map_size_ = 0;
+    }
+    if (fd_ >= 0) {
+        if (file_used_ > 0 && ftruncate(fd_, file_used_) < 0) {
+            err_msg_ = std::string("[CSnapshotExporter::close] Failed to call ftruncate, reason: ") + strerror(errno);
+            res = false;
+        }
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (idx_fd_ >= 0) {
+        ::close(idx_fd_);
+        idx_fd_ = -1;
+    }
+    file_used_ = 0;
+    has_last_ = false;
+    skipped_generations_ = 0;
+    return res;
+}
+
+}  // namespace thread_mem_shm_sdk
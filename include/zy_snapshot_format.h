@@ -0,0 +1,147 @@
+/**
+ * @file zy_snapshot_format.h
+ * @author noahyzhang
+ * @brief 快照文件格式定义，导出器和读取器共用
+ * @version 0.1
+ * @date 2023-05-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace thread_mem_shm_sdk {
+
+/**
+ * 快照文件是只追加的列式文件，格式为：
+ * | SNAPSHOT_FILE_HEADER | BLOCK | BLOCK | ... | BLOCK |
+ * 每个 BLOCK 为：| SNAPSHOT_BLOCK_HEADER | payload |
+ * payload 中先是每一代的信息（时间差、代数差、节点数），然后按列存放节点数据：
+ * 节点被切分成若干个宽度为 column_width 的列，每一列内的值与上一代同位置节点做差，
+ * 差值经过 zigzag 后使用 varint 编码
+ *
+ * 另有一个旁路索引文件（文件名为快照文件名 + ".idx"），由 SNAPSHOT_INDEX_ENTRY 数组组成，
+ * 记录每个 BLOCK 的偏移及时间范围，读取器缺少索引文件时会顺序扫描 BLOCK 头重建索引
+ */
+
+// 快照文件魔数 "ZYSNAP01"
+const uint64_t g_snapshot_file_magic = 0x31305041534E595AULL;
+// BLOCK 魔数
+const uint32_t g_snapshot_block_magic = 0x4B4C4253;
+// 快照文件格式版本
+const uint32_t g_snapshot_format_version = 1;
+
+// 文件头
+struct SNAPSHOT_FILE_HEADER {
+    uint64_t magic;
+    uint32_t format_version;
+    uint32_t shm_version;
+    uint32_t node_size;
+    uint32_t column_width;
+    uint32_t column_count;
+    uint32_t reserved[7];
+    // 轮询间隔内发布了多代时被跳过的代数累计，导出器每次写入 BLOCK 后更新；旧文件中该字段为 0
+    uint64_t skipped_generations;
+};
+
+// BLOCK 头
+struct SNAPSHOT_BLOCK_HEADER {
+    uint32_t magic;
+    uint32_t gen_count;
+    uint32_t node_total;
+    uint32_t payload_size;
+    uint64_t time_begin_ns;
+    uint64_t time_end_ns;
+    uint64_t generation_begin;
+    uint64_t generation_end;
+};
+
+// 索引项
+struct SNAPSHOT_INDEX_ENTRY {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t gen_count;
+    uint64_t time_begin_ns;
+    uint64_t time_end_ns;
+    uint64_t generation_begin;
+    uint64_t generation_end;
+};
+
+/**
+ * @brief 获取列宽，节点大小是 4 的倍数时按 4 字节切分，否则按字节切分
+ *
+ * @param node_size
+ * @return uint32_t
+ */
+inline uint32_t snapshot_column_width(size_t node_size) {
+    return (node_size % sizeof(uint32_t) == 0) ? sizeof(uint32_t) : 1;
+}
+
+/**
+ * @brief zigzag 编码
+ *
+ * @param val
+ * @return uint64_t
+ */
+inline uint64_t zigzag_encode(int64_t val) {
+    return (static_cast<uint64_t>(val) << 1) ^ static_cast<uint64_t>(val >> 63);
+}
+
+/**
+ * @brief zigzag 解码
+ *
+ * @param val
+ * @return int64_t
+ */
+inline int64_t zigzag_decode(uint64_t val) {
+    return static_cast<int64_t>(val >> 1) ^ -static_cast<int64_t>(val & 1);
+}
+
+/**
+ * @brief varint 编码，返回写入的字节数，调用者需保证 p_buf 至少有 10 字节空间
+ *
+ * @param p_buf
+ * @param val
+ * @return size_t
+ */
+inline size_t varint_encode(uint8_t* p_buf, uint64_t val) {
+    size_t len = 0;
+    while (val >= 0x80) {
+        p_buf[len++] = static_cast<uint8_t>(val) | 0x80;
+        val >>= 7;
+    }
+    p_buf[len++] = static_cast<uint8_t>(val);
+    return len;
+}
+
+/**
+ * @brief varint 解码，越界或格式错误时返回 nullptr
+ *
+ * @param p_buf
+ * @param p_end
+ * @param val
+ * @return const uint8_t*
+ */
+inline const uint8_t* varint_decode(const uint8_t* p_buf, const uint8_t* p_end, uint64_t* val) {
+    // 单字节是最常见的情况（差值很小），单独处理
+    if (p_buf < p_end && *p_buf < 0x80) {
+        *val = *p_buf;
+        return p_buf + 1;
+    }
+    uint64_t res = 0;
+    for (uint32_t shift = 0; p_buf < p_end && shift < 64; shift += 7) {
+        uint8_t byte = *p_buf++;
+        res |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            *val = res;
+            return p_buf;
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace thread_mem_shm_sdk
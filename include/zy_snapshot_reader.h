@@ -0,0 +1,398 @@
+/**
+ * @file zy_snapshot_reader.h
+ * @author noahyzhang
+ * @brief 快照文件读取器，内存映射快照文件并按时间范围扫描
+ * @version 0.1
+ * @date 2023-05-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "zy_snapshot_format.h"
+
+namespace thread_mem_shm_sdk {
+
+/**
+ * @brief 快照文件读取器
+ *
+ * @tparam T 和导出时的节点类型一致
+ */
+template <class T>
+class CSnapshotReader {
+public:
+    CSnapshotReader() = default;
+    ~CSnapshotReader() { close(); }
+    CSnapshotReader(const CSnapshotReader&) = delete;
+    CSnapshotReader& operator=(const CSnapshotReader&) = delete;
+    CSnapshotReader(CSnapshotReader&&) = delete;
+    CSnapshotReader& operator=(CSnapshotReader&&) = delete;
+
+public:
+    /**
+     * @brief 打开并映射快照文件，优先加载索引文件，索引文件不可用时扫描重建
+     *
+     * @param path
+     * @return true
+     * @return false
+     */
+    bool open(const std::string& path);
+
+    /**
+     * @brief 关闭
+     *
+     */
+    void close();
+
+    /**
+     * @brief 扫描时间范围 [time_begin_ns, time_end_ns] 内的每一代数据
+     * 回调形如 bool(uint64_t time_ns, uint64_t generation, const T* nodes, size_t count)，返回 false 时停止扫描
+     *
+     * @tparam F
+     * @param time_begin_ns
+     * @param time_end_ns
+     * @param func
+     * @return true
+     * @return false
+     */
+    template <class F>
+    bool scan(uint64_t time_begin_ns, uint64_t time_end_ns, F&& func);
+
+    /**
+     * @brief 扫描全部数据
+     *
+     * @tparam F
+     * @param func
+     * @return true
+     * @return false
+     */
+    template <class F>
+    bool scan(F&& func) {
+        return scan(0, UINT64_MAX, func);
+    }
+
+    /**
+     * @brief 获取 BLOCK 索引
+     *
+     * @return const std::vector<SNAPSHOT_INDEX_ENTRY>&
+     */
+    const std::vector<SNAPSHOT_INDEX_ENTRY>& get_index() const { return index_; }
+
+    /**
+     * @brief 获取导出时被跳过的代数，不为 0 时文件不是完整的历史
+     *
+     * @return uint64_t
+     */
+    uint64_t get_skipped_generations() const { return skipped_generations_; }
+
+    /**
+     * @brief 获取错误信息
+     *
+     * @return std::string
+     */
+    std::string get_err_msg() const { return err_msg_; }
+
+private:
+    /**
+     * @brief 加载索引文件
+     *
+     * @param path
+     * @return true
+     * @return false
+     */
+    bool load_index(const std::string& path);
+
+    /**
+     * @brief 扫描 BLOCK 头重建索引
+     *
+     */
+    void rebuild_index();
+
+    /**
+     * @brief 解码一个 BLOCK 到 rows_ 中
+     *
+     * @param entry
+     * @return true
+     * @return false
+     */
+    bool decode_block(const SNAPSHOT_INDEX_ENTRY& entry);
+
+    /**
+     * @brief 写入节点的第 col 列
+     *
+     * @param p_row
+     * @param col
+     * @param val
+     */
+    void store_column(uint8_t* p_row, uint32_t col, uint32_t val) const {
+        uint8_t* p = p_row + col * column_width_;
+        if (column_width_ == 1) {
+            *p = static_cast<uint8_t>(val);
+            return;
+        }
+        memcpy(p, &val, sizeof(val));
+    }
+
+    /**
+     * @brief 读取节点的第 col 列
+     *
+     * @param p_row
+     * @param col
+     * @return uint32_t
+     */
+    uint32_t load_column(const uint8_t* p_row, uint32_t col) const {
+        const uint8_t* p = p_row + col * column_width_;
+        if (column_width_ == 1) {
+            return *p;
+        }
+        uint32_t val = 0;
+        memcpy(&val, p, sizeof(val));
+        return val;
+    }
+
+private:
+    int fd_{-1};
+    const uint8_t* p_map_{nullptr};
+    size_t map_size_{0};
+    uint32_t column_width_{0};
+    uint32_t column_count_{0};
+    uint64_t skipped_generations_{0};
+    std::vector<SNAPSHOT_INDEX_ENTRY> index_;
+
+    // 解码缓存
+    std::vector<uint64_t> gen_time_;
+    std::vector<uint64_t> gen_generation_;
+    std::vector<uint32_t> gen_count_;
+    std::vector<T> rows_;
+    std::string err_msg_;
+};
+
+template <class T>
+bool CSnapshotReader<T>::open(const std::string& path) {
+    if (fd_ >= 0) {
+        err_msg_ = "[CSnapshotReader::open] Already opened";
+        return false;
+    }
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        err_msg_ = "[CSnapshotReader::open] Failed to open " + path + ", reason: " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(SNAPSHOT_FILE_HEADER)) {
+        err_msg_ = "[CSnapshotReader::open] Invalid snapshot file: " + path;
+        close();
+        return false;
+    }
+    void* p_map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p_map == MAP_FAILED) {
+        err_msg_ = std::string("[CSnapshotReader::open] Failed to call mmap, reason: ") + strerror(errno);
+        close();
+        return false;
+    }
+    p_map_ = reinterpret_cast<const uint8_t*>(p_map);
+    map_size_ = st.st_size;
+    // 顺序扫描为主
+    madvise(p_map, map_size_, MADV_SEQUENTIAL);
+
+    SNAPSHOT_FILE_HEADER file_header;
+    memcpy(&file_header, p_map_, sizeof(file_header));
+    if (file_header.magic != g_snapshot_file_magic || file_header.format_version != g_snapshot_format_version
+        || file_header.node_size != sizeof(T) || file_header.column_width != snapshot_column_width(sizeof(T))
+        || static_cast<uint64_t>(file_header.column_count) * file_header.column_width != sizeof(T)) {
+        err_msg_ = "[CSnapshotReader::open] Snapshot file format mismatch: " + path;
+        close();
+        return false;
+    }
+    column_width_ = file_header.column_width;
+    column_count_ = file_header.column_count;
+    skipped_generations_ = file_header.skipped_generations;
+    if (!load_index(path)) {
+        rebuild_index();
+    }
+    return true;
+}
+
+template <class T>
+void CSnapshotReader<T>::close() {
+    if (p_map_ != nullptr) {
+        munmap(const_cast<uint8_t*>(p_map_), map_size_);
+        p_map_ = nullptr;
+        map_size_ = 0;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    index_.clear();
+    skipped_generations_ = 0;
+}
+
+template <class T>
+bool CSnapshotReader<T>::load_index(const std::string& path) {
+    int idx_fd = ::open((path + ".idx").c_str(), O_RDONLY);
+    if (idx_fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(idx_fd, &st) < 0 || st.st_size % sizeof(SNAPSHOT_INDEX_ENTRY) != 0) {
+        ::close(idx_fd);
+        return false;
+    }
+    index_.resize(st.st_size / sizeof(SNAPSHOT_INDEX_ENTRY));
+    size_t length = index_.size() * sizeof(SNAPSHOT_INDEX_ENTRY);
+    ssize_t ret = pread(idx_fd, index_.data(), length, 0);
+    ::close(idx_fd);
+    if (ret != static_cast<ssize_t>(length)) {
+        index_.clear();
+        return false;
+    }
+    // 索引必须和文件内容吻合，否则重建
+    size_t expect_offset = sizeof(SNAPSHOT_FILE_HEADER);
+    for (const auto& entry : index_) {
+        if (entry.offset != expect_offset || entry.offset + entry.size > map_size_) {
+            index_.clear();
+            return false;
+        }
+        expect_offset += entry.size;
+    }
+    return true;
+}
+
+template <class T>
+void CSnapshotReader<T>::rebuild_index() {
+    index_.clear();
+    size_t offset = sizeof(SNAPSHOT_FILE_HEADER);
+    while (offset + sizeof(SNAPSHOT_BLOCK_HEADER) <= map_size_) {
+        SNAPSHOT_BLOCK_HEADER block_header;
+        memcpy(&block_header, p_map_ + offset, sizeof(block_header));
+        size_t block_size = sizeof(block_header) + block_header.payload_size;
+        if (block_header.magic != g_snapshot_block_magic || block_header.gen_count == 0
+            || offset + block_size > map_size_) {
+            break;
+        }
+        SNAPSHOT_INDEX_ENTRY entry;
+        entry.offset = offset;
+        entry.size = block_size;
+        entry.gen_count = block_header.gen_count;
+        entry.time_begin_ns = block_header.time_begin_ns;
+        entry.time_end_ns = block_header.time_end_ns;
+        entry.generation_begin = block_header.generation_begin;
+        entry.generation_end = block_header.generation_end;
+        index_.push_back(entry);
+        offset += block_size;
+    }
+}
+
+template <class T>
+bool CSnapshotReader<T>::decode_block(const SNAPSHOT_INDEX_ENTRY& entry) {
+    SNAPSHOT_BLOCK_HEADER block_header;
+    memcpy(&block_header, p_map_ + entry.offset, sizeof(block_header));
+    const uint8_t* p_in = p_map_ + entry.offset + sizeof(block_header);
+    const uint8_t* p_end = p_in + block_header.payload_size;
+    // 长度都来自文件：BLOCK 不能超出索引校验过的范围；每一代的 3 项和每个列值至少占 1 字节，据此限制分配的大小
+    if (sizeof(block_header) + block_header.payload_size != entry.size
+        || static_cast<uint64_t>(block_header.gen_count) * 3 > block_header.payload_size
+        || static_cast<uint64_t>(block_header.node_total) * column_count_ > block_header.payload_size) {
+        err_msg_ = "[CSnapshotReader::decode_block] Corrupted block header";
+        return false;
+    }
+
+    size_t gen_count = block_header.gen_count;
+    gen_time_.resize(gen_count);
+    gen_generation_.resize(gen_count);
+    gen_count_.resize(gen_count);
+    uint64_t prev_time = block_header.time_begin_ns;
+    uint64_t prev_gen = block_header.generation_begin;
+    size_t node_total = 0;
+    uint64_t val = 0;
+    for (size_t g = 0; g < gen_count; ++g) {
+        if ((p_in = varint_decode(p_in, p_end, &val)) == nullptr) {
+            break;
+        }
+        prev_time += zigzag_decode(val);
+        if ((p_in = varint_decode(p_in, p_end, &val)) == nullptr) {
+            break;
+        }
+        prev_gen += zigzag_decode(val);
+        if ((p_in = varint_decode(p_in, p_end, &val)) == nullptr) {
+            break;
+        }
+        if (val > block_header.node_total - node_total) {
+            p_in = nullptr;
+            break;
+        }
+        gen_time_[g] = prev_time;
+        gen_generation_[g] = prev_gen;
+        gen_count_[g] = val;
+        node_total += val;
+    }
+    if (p_in == nullptr || node_total != block_header.node_total) {
+        err_msg_ = "[CSnapshotReader::decode_block] Corrupted generation section";
+        return false;
+    }
+    rows_.resize(node_total);
+    uint8_t* p_rows = reinterpret_cast<uint8_t*>(rows_.data());
+    for (uint32_t col = 0; col < column_count_; ++col) {
+        size_t prev_row = 0;
+        size_t prev_count = 0;
+        size_t row = 0;
+        for (size_t g = 0; g < gen_count; ++g) {
+            size_t count = gen_count_[g];
+            for (size_t i = 0; i < count; ++i) {
+                if ((p_in = varint_decode(p_in, p_end, &val)) == nullptr) {
+                    err_msg_ = "[CSnapshotReader::decode_block] Corrupted column section";
+                    return false;
+                }
+                uint32_t prev = (i < prev_count) ? load_column(p_rows + (prev_row + i) * sizeof(T), col) : 0;
+                store_column(p_rows + (row + i) * sizeof(T), col,
+                    prev + static_cast<uint32_t>(zigzag_decode(val)));
+            }
+            prev_row = row;
+            prev_count = count;
+            row += count;
+        }
+    }
+    return true;
+}
+
+template <class T>
+template <class F>
+bool CSnapshotReader<T>::scan(uint64_t time_begin_ns, uint64_t time_end_ns, F&& func) {
+    if (p_map_ == nullptr) {
+        err_msg_ = "[CSnapshotReader::scan] Not opened";
+        return false;
+    }
+    for (const auto& entry : index_) {
+        if (entry.time_end_ns < time_begin_ns || entry.time_begin_ns > time_end_ns) {
+            continue;
+        }
+        if (!decode_block(entry)) {
+            return false;
+        }
+        size_t row = 0;
+        for (size_t g = 0; g < gen_time_.size(); ++g) {
+            size_t count = gen_count_[g];
+            if (gen_time_[g] >= time_begin_ns && gen_time_[g] <= time_end_ns) {
+                if (!func(gen_time_[g], gen_generation_[g], rows_.data() + row, count)) {
+                    return true;
+                }
+            }
+            row += count;
+        }
+    }
+    return true;
+}
+
+}  // namespace thread_mem_shm_sdk
@@ -33,6 +33,32 @@ inline void xsnprintf(char* buffer, const uint32_t size, const char *format, ...
     va_end(ap);
 }
 
+// CRC 的半字节表
+const uint32_t g_crc_nibble_table[16] = {0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef};
+
+// 由半字节表合成的字节表，一次处理一个字节，结果与逐半字节计算完全一致
+struct CRC_BYTE_TABLE {
+    uint32_t val[256];
+};
+
+/**
+ * @brief 编译期生成 CRC 字节表
+ * 
+ * @return CRC_BYTE_TABLE 
+ */
+constexpr CRC_BYTE_TABLE make_crc_byte_table() {
+    CRC_BYTE_TABLE table{};
+    for (uint32_t idx = 0; idx < 256; ++idx) {
+        uint32_t high = g_crc_nibble_table[idx >> 4];
+        uint32_t low = g_crc_nibble_table[(idx & 0x0f) ^ ((high >> 12) & 0x0f)];
+        table.val[idx] = (high << 4) ^ low;
+    }
+    return table;
+}
+
+constexpr CRC_BYTE_TABLE g_crc_byte_table = make_crc_byte_table();
+
 /**
  * @brief 计算数组的 CRC 值
  * 
@@ -40,21 +66,10 @@ inline void xsnprintf(char* buffer, const uint32_t size, const char *format, ...
  * @param length 
  * @return uint32_t 
  */
-uint32_t calc_crc_val(const uint8_t* p_buf, uint32_t length) {
-    static uint32_t arr_CRC_table[16] = {0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-        0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef};
-
-    uint8_t uc = 0;
+inline uint32_t calc_crc_val(const uint8_t* p_buf, uint32_t length) {
     uint32_t crc = 0;
-    for (; length-- != 0;) {
-        uc = ((uint8_t)(crc / 256)) / 16;
-        crc <<= 4;
-        crc ^= arr_CRC_table[uc ^ (*p_buf / 16)];
-
-        uc = ((uint8_t)(crc / 256)) / 16;
-        crc <<= 4;
-        crc ^= arr_CRC_table[uc ^ (*p_buf & 0x0f)];
-        p_buf++;
+    for (; length-- != 0; ++p_buf) {
+        crc = (crc << 8) ^ g_crc_byte_table.val[((crc >> 8) & 0xff) ^ *p_buf];
     }
     return crc;
 }
@@ -70,4 +85,15 @@ inline uint64_t get_now_system_time_ns() {
     return tp.tv_sec * static_cast<uint64_t>(1E9) + tp.tv_nsec;
 }
 
+/**
+ * @brief 获取当前单调时间（纳秒），用于计算耗时
+ * 
+ * @return uint64_t 
+ */
+inline uint64_t get_now_monotonic_time_ns() {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * static_cast<uint64_t>(1E9) + tp.tv_nsec;
+}
+
 }  // namespace thread_mem_shm_sdk
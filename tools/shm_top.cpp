@@ -0,0 +1,398 @@
+/**
+ * @file shm_top.cpp
+ * @author noahyzhang
+ * @brief 实时查看本机所有 SDK 共享内存的状态
+ * 通过 SHM_INFO/SHM_STAT 枚举系统中的共享内存，以只读方式挂载并校验 ARRAY_SHM_HEADER，
+ * 只读取头部和统计块，不加锁，不会干扰写者
+ * @version 0.1
+ * @date 2023-05-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <getopt.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/shm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+#include "zy_array_shm.h"
+#include "zy_shm_stats.h"
+
+using thread_mem_shm_sdk::ARRAY_SHM_HEADER;
+using thread_mem_shm_sdk::ARRAY_SHM_FLAG_STATS;
+using thread_mem_shm_sdk::CShm;
+using thread_mem_shm_sdk::SHM_ERR_CRC;
+using thread_mem_shm_sdk::SHM_ERR_NOT_INIT;
+using thread_mem_shm_sdk::SHM_ERR_READ_ONLY;
+using thread_mem_shm_sdk::SHM_ERR_VERSION;
+using thread_mem_shm_sdk::SHM_OPTIONS;
+using thread_mem_shm_sdk::SHM_READER_INFO;
+using thread_mem_shm_sdk::SHM_READER_SLOT;
+using thread_mem_shm_sdk::SHM_STATS;
+using thread_mem_shm_sdk::array_shm_age_ns;
+using thread_mem_shm_sdk::array_shm_check_header;
+using thread_mem_shm_sdk::array_shm_length;
+using thread_mem_shm_sdk::array_shm_reader_count;
+using thread_mem_shm_sdk::array_shm_reader_offset;
+using thread_mem_shm_sdk::array_shm_stats_offset;
+using thread_mem_shm_sdk::g_shm_stats_hist_buckets;
+using thread_mem_shm_sdk::g_shm_version_magic;
+using thread_mem_shm_sdk::g_shm_version_magic_mask;
+using thread_mem_shm_sdk::get_now_monotonic_time_ns;
+using thread_mem_shm_sdk::shm_reader_collect;
+using thread_mem_shm_sdk::shm_stats_get;
+using thread_mem_shm_sdk::shm_stats_hist_upper_ns;
+
+/**
+ * @brief 不关心节点类型的只读观察者，只解析头部
+ *
+ */
+class CShmInspector : public CShm<uint8_t, ARRAY_SHM_HEADER, CShmInspector> {
+    friend class CShm<uint8_t, ARRAY_SHM_HEADER, CShmInspector>;
+
+public:
+    /**
+     * @brief 读取并校验头部，写者正在写头部时可能校验失败，下一轮重试即可
+     *
+     * @param header
+     * @return true
+     * @return false
+     */
+    bool read_header(ARRAY_SHM_HEADER* header) {
+        return do_get_header(header) && array_shm_check_header(*header);
+    }
+
+    /**
+     * @brief 获取统计块，没有开启统计时返回 nullptr
+     *
+     * @param header
+     * @return const SHM_STATS*
+     */
+    const SHM_STATS* get_stats(const ARRAY_SHM_HEADER& header) const {
+        if (!(header.flags & ARRAY_SHM_FLAG_STATS)) {
+            return nullptr;
+        }
+        return reinterpret_cast<const SHM_STATS*>(get_shm_addr() + array_shm_stats_offset(header));
+    }
+
+    /**
+     * @brief 获取读者表中所有读者的状态，没有读者表时为空
+     *
+     * @param header
+     * @param infos
+     */
+    void get_readers(const ARRAY_SHM_HEADER& header, std::vector<SHM_READER_INFO>* infos) const {
+        const SHM_READER_SLOT* slots = reinterpret_cast<const SHM_READER_SLOT*>(get_shm_addr()
+            + array_shm_reader_offset(header));
+        shm_reader_collect(slots, array_shm_reader_count(header.flags), header.generation, infos);
+    }
+
+private:
+    bool set_header() {
+        set_err(SHM_ERR_READ_ONLY, "CShmInspector::set_header");
+        return false;
+    }
+
+    size_t parse_header(const ARRAY_SHM_HEADER& header) {
+        // 只有魔数不符才确定不是 SDK 格式；头部全零可能是写者刚创建还没写入，校验和不符可能是头部正在被改写
+        if (header.version == 0) {
+            set_err(SHM_ERR_NOT_INIT, "CShmInspector::parse_header");
+            return 0;
+        }
+        if ((header.version & g_shm_version_magic_mask) != g_shm_version_magic) {
+            set_err(SHM_ERR_VERSION, "CShmInspector::parse_header", header.version, g_shm_version_magic);
+            return 0;
+        }
+        if (!array_shm_check_header(header)) {
+            set_err(SHM_ERR_CRC, "CShmInspector::parse_header", header.header_crc_val);
+            return 0;
+        }
+        return array_shm_length(header);
+    }
+};
+
+// 单个共享内存的观察状态
+struct SEGMENT_VIEW {
+    int shm_id = -1;
+    key_t key = 0;
+    size_t size = 0;
+    uint64_t attach_count = 0;
+    std::unique_ptr<CShmInspector> inspector;
+
+    ARRAY_SHM_HEADER header;
+    bool has_header = false;
+    uint64_t sample_ns = 0;
+    double publish_rate = 0;
+    double lock_rate = 0;
+    double lock_wait_avg_ns = 0;
+    uint64_t last_lock_count = 0;
+    uint64_t last_lock_wait_ns = 0;
+};
+
+// 命令行参数
+struct TOP_ARGS {
+    uint32_t interval_ms = 100;
+    uint64_t iterations = 0;
+    key_t key_filter = 0;
+    bool batch = false;
+    std::vector<key_t> sem_keys;
+};
+
+// 挂载失败但不能确定不是 SDK 格式的共享内存，隔多少轮枚举后重新尝试
+const uint32_t g_retry_discover_rounds = 10;
+// 确定不是 SDK 格式的共享内存，不再尝试
+const uint32_t g_foreign_skip_rounds = UINT32_MAX;
+
+/**
+ * @brief 枚举系统中所有 SDK 共享内存，已挂载的保留，新出现的尝试挂载，消失的删除
+ *
+ * @param args
+ * @param views
+ * @param rejected 挂载失败的 shm_id 及还需跳过的枚举轮数，魔数不符的一直跳过，其他失败（如头部还没写入）隔几轮重试
+ */
+void discover(const TOP_ARGS& args, std::map<int, SEGMENT_VIEW>* views, std::map<int, uint32_t>* rejected) {
+    struct shm_info info;
+    int max_idx = shmctl(0, SHM_INFO, reinterpret_cast<struct shmid_ds*>(&info));
+    if (max_idx < 0) {
+        return;
+    }
+    std::set<int> alive;
+    for (int idx = 0; idx <= max_idx; ++idx) {
+        struct shmid_ds ds;
+        int shm_id = shmctl(idx, SHM_STAT, &ds);
+        if (shm_id < 0) {
+            continue;
+        }
+        key_t key = ds.shm_perm.__key;
+        if (key == IPC_PRIVATE || (args.key_filter != 0 && key != args.key_filter)) {
+            continue;
+        }
+        if (ds.shm_segsz < sizeof(ARRAY_SHM_HEADER)) {
+            continue;
+        }
+        alive.insert(shm_id);
+        auto rejected_iter = rejected->find(shm_id);
+        if (rejected_iter != rejected->end()) {
+            if (rejected_iter->second == g_foreign_skip_rounds || --rejected_iter->second > 0) {
+                continue;
+            }
+            rejected->erase(rejected_iter);
+        }
+        auto iter = views->find(shm_id);
+        if (iter != views->end()) {
+            iter->second.attach_count = ds.shm_nattch;
+            continue;
+        }
+        std::unique_ptr<CShmInspector> inspector(new CShmInspector());
+        SHM_OPTIONS options;
+        options.read_only = true;
+        if (!inspector->init(key, 0, false, options)) {
+            (*rejected)[shm_id] = (inspector->get_err_code() == SHM_ERR_VERSION)
+                ? g_foreign_skip_rounds : g_retry_discover_rounds;
+            continue;
+        }
+        SEGMENT_VIEW& view = (*views)[shm_id];
+        view.shm_id = shm_id;
+        view.key = key;
+        view.size = ds.shm_segsz;
+        view.attach_count = ds.shm_nattch;
+        view.inspector = std::move(inspector);
+    }
+    for (auto iter = views->begin(); iter != views->end();) {
+        if (alive.count(iter->first) == 0) {
+            iter = views->erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    for (auto iter = rejected->begin(); iter != rejected->end();) {
+        if (alive.count(iter->first) == 0) {
+            iter = rejected->erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
+/**
+ * @brief 采样一次头部和统计块，计算速率
+ *
+ * @param view
+ */
+void sample(SEGMENT_VIEW* view) {
+    ARRAY_SHM_HEADER header;
+    if (!view->inspector->read_header(&header)) {
+        return;
+    }
+    uint64_t now_ns = get_now_monotonic_time_ns();
+    const SHM_STATS* stats = view->inspector->get_stats(header);
+    uint64_t lock_count = (stats != nullptr) ? shm_stats_get(stats->lock_count) : 0;
+    uint64_t lock_wait_ns = (stats != nullptr) ? shm_stats_get(stats->lock_wait_total_ns) : 0;
+    if (view->has_header && now_ns > view->sample_ns) {
+        double dt = (now_ns - view->sample_ns) / 1e9;
+        // 指数平滑，避免高频刷新时的抖动
+        const double alpha = 0.3;
+        view->publish_rate = alpha * ((header.generation - view->header.generation) / dt)
+            + (1 - alpha) * view->publish_rate;
+        view->lock_rate = alpha * ((lock_count - view->last_lock_count) / dt) + (1 - alpha) * view->lock_rate;
+        if (lock_count > view->last_lock_count) {
+            view->lock_wait_avg_ns = static_cast<double>(lock_wait_ns - view->last_lock_wait_ns)
+                / (lock_count - view->last_lock_count);
+        }
+    }
+    view->header = header;
+    view->has_header = true;
+    view->sample_ns = now_ns;
+    view->last_lock_count = lock_count;
+    view->last_lock_wait_ns = lock_wait_ns;
+}
+
+/**
+ * @brief 根据直方图估算加锁等待的分位数（取桶上界）
+ *
+ * @param stats
+ * @param quantile
+ * @return uint64_t
+ */
+uint64_t lock_wait_quantile_ns(const SHM_STATS* stats, double quantile) {
+    uint64_t total = 0;
+    uint64_t hist[g_shm_stats_hist_buckets];
+    for (uint32_t i = 0; i < g_shm_stats_hist_buckets; ++i) {
+        hist[i] = shm_stats_get(stats->lock_wait_hist[i]);
+        total += hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(total * quantile);
+    uint64_t acc = 0;
+    for (uint32_t i = 0; i < g_shm_stats_hist_buckets; ++i) {
+        acc += hist[i];
+        if (acc > target) {
+            return shm_stats_hist_upper_ns(i);
+        }
+    }
+    return shm_stats_get(stats->lock_wait_max_ns);
+}
+
+/**
+ * @brief 输出一屏
+ *
+ * @param args
+ * @param views
+ */
+void render(const TOP_ARGS& args, const std::map<int, SEGMENT_VIEW>& views) {
+    if (!args.batch) {
+        printf("\033[H\033[2J");
+    }
+    printf("shm-top  segments: %zu  interval: %ums\n", views.size(), args.interval_ms);
+    printf("%-10s %-8s %-12s %-6s %-17s %-6s %-10s %-10s %-10s %-6s %-10s %-12s %-12s %-10s\n",
+        "KEY", "SHMID", "SIZE", "NODE", "NODES/MAX", "USE%", "GEN", "PUB/s", "AGE(ms)", "ATTACH",
+        "LOCK/s", "WAIT_AVG(us)", "WAIT_P99(us)", "CRC_ERR");
+    for (const auto& item : views) {
+        const SEGMENT_VIEW& view = item.second;
+        if (!view.has_header) {
+            printf("0x%-8x %-8d %-12zu (header not ready)\n", view.key, view.shm_id, view.size);
+            continue;
+        }
+        const ARRAY_SHM_HEADER& header = view.header;
+        char nodes[32];
+        snprintf(nodes, sizeof(nodes), "%u/%u", header.cur_node_count, header.max_node_count);
+        double use = header.max_node_count > 0 ? 100.0 * header.cur_node_count / header.max_node_count : 0;
+        double age_ms = array_shm_age_ns(header) / 1e6;
+        printf("0x%-8x %-8d %-12zu %-6u %-17s %-6.1f %-10lu %-10.1f %-10.1f %-6lu ",
+            view.key, view.shm_id, view.size, header.node_size, nodes, use,
+            header.generation, view.publish_rate, age_ms, view.attach_count);
+        const SHM_STATS* stats = view.inspector->get_stats(header);
+        if (stats == nullptr) {
+            printf("%-10s %-12s %-12s %-10s\n", "-", "-", "-", "-");
+        } else {
+            printf("%-10.1f %-12.2f %-12.2f %-10lu\n", view.lock_rate, view.lock_wait_avg_ns / 1e3,
+                lock_wait_quantile_ns(stats, 0.99) / 1e3, shm_stats_get(stats->crc_err_count));
+        }
+        // 读者表中每个读者落后的代数及心跳
+        std::vector<SHM_READER_INFO> readers;
+        view.inspector->get_readers(header, &readers);
+        for (const SHM_READER_INFO& reader : readers) {
+            printf("  reader %-4u pid: %-8u %-7s %-8s lag: %-8lu heartbeat(ms): %-10.1f reads: %lu\n",
+                reader.slot, reader.pid, reader.alive ? "alive" : "dead", reader.reading ? "reading" : "idle",
+                reader.lag, reader.heartbeat_age_ns / 1e6, reader.read_count);
+        }
+    }
+    for (key_t sem_key : args.sem_keys) {
+        int sem_id = semget(sem_key, 0, 0);
+        if (sem_id < 0) {
+            printf("sem 0x%x: not exist\n", sem_key);
+            continue;
+        }
+        printf("sem 0x%x: value: %d, waiting: %d, last pid: %d\n", sem_key, semctl(sem_id, 0, GETVAL),
+            semctl(sem_id, 0, GETNCNT), semctl(sem_id, 0, GETPID));
+    }
+    fflush(stdout);
+}
+
+void usage(const char* name) {
+    printf("usage: %s [-i interval_ms] [-n iterations] [-k shm_key] [-s sem_key]... [-b]\n"
+        "  -i  refresh interval in milliseconds, default 100\n"
+        "  -n  exit after n refreshes, default 0 (never)\n"
+        "  -k  only show the segment with this key\n"
+        "  -s  also show waiters of this semaphore key, can be repeated\n"
+        "  -b  batch mode, do not clear screen\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    TOP_ARGS args;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "i:n:k:s:bh")) != -1) {
+        switch (opt) {
+        case 'i':
+            args.interval_ms = strtoul(optarg, nullptr, 0);
+            break;
+        case 'n':
+            args.iterations = strtoull(optarg, nullptr, 0);
+            break;
+        case 'k':
+            args.key_filter = strtoul(optarg, nullptr, 0);
+            break;
+        case 's':
+            args.sem_keys.push_back(strtoul(optarg, nullptr, 0));
+            break;
+        case 'b':
+            args.batch = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (args.interval_ms == 0) {
+        args.interval_ms = 1;
+    }
+
+    std::map<int, SEGMENT_VIEW> views;
+    std::map<int, uint32_t> rejected;
+    // 重新枚举的间隔为 1 秒，其余刷新只读取已挂载的内存
+    const uint64_t discover_interval_ns = 1000 * 1000 * 1000;
+    uint64_t last_discover_ns = 0;
+    for (uint64_t i = 0; args.iterations == 0 || i < args.iterations; ++i) {
+        uint64_t now_ns = get_now_monotonic_time_ns();
+        if (i == 0 || now_ns - last_discover_ns >= discover_interval_ns) {
+            discover(args, &views, &rejected);
+            last_discover_ns = now_ns;
+        }
+        for (auto& item : views) {
+            sample(&item.second);
+        }
+        render(args, views);
+        std::this_thread::sleep_for(std::chrono::milliseconds(args.interval_ms));
+    }
+    return 0;
+}